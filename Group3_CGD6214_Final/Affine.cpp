@@ -0,0 +1,62 @@
+#include "Affine.h"
+
+Affine3x4::Affine3x4() {
+    rows[0] = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+    rows[1] = glm::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+    rows[2] = glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+}
+
+Affine3x4::Affine3x4(const glm::mat4& m) {
+    // glm is column-major: m[column][row].
+    for (int i = 0; i < 3; i++)
+        rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+}
+
+Affine3x4 Affine3x4::fromTRS(const glm::vec3& t, const glm::quat& r, const glm::vec3& s) {
+    glm::mat3 m = glm::mat3_cast(r);
+    Affine3x4 a;
+    for (int i = 0; i < 3; i++)
+        a.rows[i] = glm::vec4(m[0][i] * s.x, m[1][i] * s.y, m[2][i] * s.z, t[i]);
+    return a;
+}
+
+glm::mat4 Affine3x4::toMat4() const {
+    glm::mat4 m(1.0f);
+    for (int i = 0; i < 3; i++) {
+        m[0][i] = rows[i].x;
+        m[1][i] = rows[i].y;
+        m[2][i] = rows[i].z;
+        m[3][i] = rows[i].w;
+    }
+    return m;
+}
+
+Affine3x4 operator*(const Affine3x4& a, const Affine3x4& b) {
+    // Each output row is a combination of b's rows; the implicit (0,0,0,1)
+    // bottom row of b contributes only a's translation.
+    Affine3x4 r;
+    for (int i = 0; i < 3; i++) {
+        const glm::vec4& ai = a.rows[i];
+        r.rows[i] = ai.x * b.rows[0] + ai.y * b.rows[1] + ai.z * b.rows[2];
+        r.rows[i].w += ai.w;
+    }
+    return r;
+}
+
+Affine3x4 affineInverse(const Affine3x4& m) {
+    glm::vec3 c0 = m.axis(0), c1 = m.axis(1), c2 = m.axis(2);
+    glm::vec3 r0 = glm::cross(c1, c2);
+    glm::vec3 r1 = glm::cross(c2, c0);
+    glm::vec3 r2 = glm::cross(c0, c1);
+    float invDet = 1.0f / glm::dot(c0, r0);
+    r0 *= invDet;
+    r1 *= invDet;
+    r2 *= invDet;
+
+    glm::vec3 t = m.translation();
+    Affine3x4 inv;
+    inv.rows[0] = glm::vec4(r0, -glm::dot(r0, t));
+    inv.rows[1] = glm::vec4(r1, -glm::dot(r1, t));
+    inv.rows[2] = glm::vec4(r2, -glm::dot(r2, t));
+    return inv;
+}
@@ -0,0 +1,47 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Row-major 3x4 affine transform. The bottom row of every model matrix in
+// the city is (0, 0, 0, 1), so only the top three rows are kept: 48 bytes
+// instead of 64, and the same layout the shaders read per instance
+// (three vec4 rows, translation in w).
+struct Affine3x4 {
+    glm::vec4 rows[3];
+
+    Affine3x4();    // identity
+    explicit Affine3x4(const glm::mat4& m);
+
+    // translate * rotate * scale
+    static Affine3x4 fromTRS(const glm::vec3& t, const glm::quat& r, const glm::vec3& s);
+
+    glm::mat4 toMat4() const;
+    glm::vec3 translation() const { return glm::vec3(rows[0].w, rows[1].w, rows[2].w); }
+    void setTranslation(const glm::vec3& t) { rows[0].w = t.x; rows[1].w = t.y; rows[2].w = t.z; }
+    // Image of basis axis i (a column of the linear part).
+    glm::vec3 axis(int i) const { return glm::vec3(rows[0][i], rows[1][i], rows[2][i]); }
+
+    glm::vec3 transformPoint(const glm::vec3& p) const {
+        glm::vec4 h(p, 1.0f);
+        return glm::vec3(glm::dot(rows[0], h), glm::dot(rows[1], h), glm::dot(rows[2], h));
+    }
+    glm::vec3 transformVector(const glm::vec3& v) const {
+        glm::vec4 h(v, 0.0f);
+        return glm::vec3(glm::dot(rows[0], h), glm::dot(rows[1], h), glm::dot(rows[2], h));
+    }
+    // Linear part applied in double, for offsets between far-apart points.
+    glm::dvec3 transformVector(const glm::dvec3& v) const {
+        return glm::dvec3(rows[0].x * v.x + rows[0].y * v.y + rows[0].z * v.z,
+                          rows[1].x * v.x + rows[1].y * v.y + rows[1].z * v.z,
+                          rows[2].x * v.x + rows[2].y * v.y + rows[2].z * v.z);
+    }
+};
+
+// a * b, i.e. apply b first. 36 multiplies instead of a 4x4's 64.
+Affine3x4 operator*(const Affine3x4& a, const Affine3x4& b);
+// Inverse through the 3x3 adjugate; the linear part must not be singular.
+Affine3x4 affineInverse(const Affine3x4& m);
+
+#endif
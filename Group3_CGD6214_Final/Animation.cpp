@@ -0,0 +1,263 @@
+#include "Animation.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ANIMATION_SSE2 1
+#endif
+
+namespace {
+
+// Players are gathered this many at a time into the arrays below.
+const size_t Block = 64;
+
+// out = a + (b - a) * t over n lanes.
+void lerp(const float* a, const float* b, const float* t, float* out, size_t n) {
+    size_t i = 0;
+#ifdef ANIMATION_SSE2
+    for (; i + 4 <= n; i += 4) {
+        __m128 from = _mm_loadu_ps(a + i);
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(b + i), from);
+        _mm_storeu_ps(out + i, _mm_add_ps(from, _mm_mul_ps(d, _mm_loadu_ps(t + i))));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = a[i] + (b[i] - a[i]) * t[i];
+}
+
+// Slerp's t as a function of the nlerp t and the cosine d between the ends
+// (Zeux's polynomial fit).
+float bendT(float t, float d) {
+    float a = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+    float b = 0.848013f + d * (-1.06021f + d * 0.215638f);
+    float k = a * (t - 0.5f) * (t - 0.5f) + b;
+    return t + t * (t - 0.5f) * (t - 1.0f) * k;
+}
+
+// Normalized lerp with t bent so the result follows slerp to within about
+// 1e-3 radians, without an acos and sines per lane. Quaternions are x, y,
+// z, w rows of Block lanes.
+void slerp(const float (*a)[Block], const float (*b)[Block], const float* t, float (*out)[Block], size_t n) {
+    size_t i = 0;
+#ifdef ANIMATION_SSE2
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 three = _mm_set1_ps(3.0f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 ax = _mm_loadu_ps(a[0] + i), ay = _mm_loadu_ps(a[1] + i);
+        __m128 az = _mm_loadu_ps(a[2] + i), aw = _mm_loadu_ps(a[3] + i);
+        __m128 bx = _mm_loadu_ps(b[0] + i), by = _mm_loadu_ps(b[1] + i);
+        __m128 bz = _mm_loadu_ps(b[2] + i), bw = _mm_loadu_ps(b[3] + i);
+        __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                                _mm_add_ps(_mm_mul_ps(az, bz), _mm_mul_ps(aw, bw)));
+        // Flip b where the ends are on opposite sides.
+        __m128 flip = _mm_and_ps(dot, signBit);
+        bx = _mm_xor_ps(bx, flip);
+        by = _mm_xor_ps(by, flip);
+        bz = _mm_xor_ps(bz, flip);
+        bw = _mm_xor_ps(bw, flip);
+        __m128 d = _mm_andnot_ps(signBit, dot);
+
+        __m128 tt = _mm_loadu_ps(t + i);
+        __m128 centred = _mm_sub_ps(tt, half);
+        __m128 ka = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-3.2452f),
+            _mm_mul_ps(d, _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)))))));
+        __m128 kb = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-1.06021f),
+            _mm_mul_ps(d, _mm_set1_ps(0.215638f)))));
+        __m128 k = _mm_add_ps(_mm_mul_ps(ka, _mm_mul_ps(centred, centred)), kb);
+        __m128 bent = _mm_add_ps(tt, _mm_mul_ps(_mm_mul_ps(tt, centred), _mm_mul_ps(_mm_sub_ps(tt, one), k)));
+
+        __m128 x = _mm_add_ps(ax, _mm_mul_ps(_mm_sub_ps(bx, ax), bent));
+        __m128 y = _mm_add_ps(ay, _mm_mul_ps(_mm_sub_ps(by, ay), bent));
+        __m128 z = _mm_add_ps(az, _mm_mul_ps(_mm_sub_ps(bz, az), bent));
+        __m128 w = _mm_add_ps(aw, _mm_mul_ps(_mm_sub_ps(bw, aw), bent));
+        // 1 / length: the estimate plus one Newton step.
+        __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                                 _mm_add_ps(_mm_mul_ps(z, z), _mm_mul_ps(w, w)));
+        __m128 r = _mm_rsqrt_ps(len2);
+        r = _mm_mul_ps(_mm_mul_ps(half, r), _mm_sub_ps(three, _mm_mul_ps(len2, _mm_mul_ps(r, r))));
+        _mm_storeu_ps(out[0] + i, _mm_mul_ps(x, r));
+        _mm_storeu_ps(out[1] + i, _mm_mul_ps(y, r));
+        _mm_storeu_ps(out[2] + i, _mm_mul_ps(z, r));
+        _mm_storeu_ps(out[3] + i, _mm_mul_ps(w, r));
+    }
+#endif
+    for (; i < n; i++) {
+        float dot = a[0][i] * b[0][i] + a[1][i] * b[1][i] + a[2][i] * b[2][i] + a[3][i] * b[3][i];
+        float sign = dot < 0.0f ? -1.0f : 1.0f;
+        float bent = bendT(t[i], std::fabs(dot));
+        float q[4], len2 = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            q[c] = a[c][i] + (b[c][i] * sign - a[c][i]) * bent;
+            len2 += q[c] * q[c];
+        }
+        float r = 1.0f / std::sqrt(len2);
+        for (int c = 0; c < 4; c++) out[c][i] = q[c] * r;
+    }
+}
+
+// Where in [0, length] the clip is after playing for local seconds.
+float wrapTime(AnimationWrap wrap, double local, float length) {
+    if (length <= 0.0f) return 0.0f;
+    switch (wrap) {
+    case AnimationWrap::Loop: {
+        double t = std::fmod(local, (double)length);
+        return (float)(t < 0.0 ? t + length : t);
+    }
+    case AnimationWrap::PingPong: {
+        double t = std::fmod(local, 2.0 * length);
+        if (t < 0.0) t += 2.0 * length;
+        return (float)(t > length ? 2.0 * length - t : t);
+    }
+    default:
+        return (float)std::min(std::max(local, 0.0), (double)length);
+    }
+}
+
+}
+
+AnimationClip::AnimationClip(int channels, AnimationWrap wrap) : wrap(wrap), channelMask(channels) {}
+
+void AnimationClip::addKey(float time, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+    glm::quat q = rotation;
+    if (!rw.empty() && rx.back() * q.x + ry.back() * q.y + rz.back() * q.z + rw.back() * q.w < 0.0f)
+        q = -q;
+    times.push_back(time);
+    px.push_back(position.x);
+    py.push_back(position.y);
+    pz.push_back(position.z);
+    rx.push_back(q.x);
+    ry.push_back(q.y);
+    rz.push_back(q.z);
+    rw.push_back(q.w);
+    sx.push_back(scale.x);
+    sy.push_back(scale.y);
+    sz.push_back(scale.z);
+}
+
+void AnimationClip::addPositionKey(float time, const glm::vec3& position) {
+    addKey(time, position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f));
+}
+
+void AnimationClip::addRotationKey(float time, const glm::quat& rotation) {
+    addKey(time, glm::vec3(0.0f), rotation, glm::vec3(1.0f));
+}
+
+AnimationSystem::AnimationSystem(ThreadPool& pool) : pool(pool), lastEvaluateMs(0.0) {}
+
+int AnimationSystem::addClip(const AnimationClip& clip) {
+    clips.push_back(clip);
+    return (int)clips.size() - 1;
+}
+
+void AnimationSystem::play(NodeHandle node, int clip, double start, float speed) {
+    if (clip < 0 || clip >= (int)clips.size() || clips[clip].keyCount() == 0) return;
+    auto it = playerOf.find(node.value);
+    uint32_t i;
+    if (it != playerOf.end()) {
+        i = it->second;
+    }
+    else {
+        i = (uint32_t)players.size();
+        playerOf[node.value] = i;
+        players.push_back(node);
+        playerClip.push_back(0);
+        playerStart.push_back(0.0);
+        playerSpeed.push_back(0.0f);
+        playerKey.push_back(0);
+    }
+    playerClip[i] = clip;
+    playerStart[i] = start;
+    playerSpeed[i] = speed;
+    playerKey[i] = 0;
+}
+
+void AnimationSystem::stop(NodeHandle node) {
+    auto it = playerOf.find(node.value);
+    if (it == playerOf.end()) return;
+    // Swap the last player into the hole.
+    uint32_t i = it->second, last = (uint32_t)players.size() - 1;
+    playerOf.erase(it);
+    if (i != last) {
+        players[i] = players[last];
+        playerClip[i] = playerClip[last];
+        playerStart[i] = playerStart[last];
+        playerSpeed[i] = playerSpeed[last];
+        playerKey[i] = playerKey[last];
+        playerOf[players[i].value] = i;
+    }
+    players.pop_back();
+    playerClip.pop_back();
+    playerStart.pop_back();
+    playerSpeed.pop_back();
+    playerKey.pop_back();
+}
+
+void AnimationSystem::evaluate(Scene& scene, double time) {
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t count = players.size();
+    // Chunks of whole blocks, a few per thread.
+    size_t blocks = (count + Block - 1) / Block;
+    int chunks = (int)std::min(blocks, (size_t)pool.size() * 8);
+    if (chunks > 0) {
+        pool.parallelFor(chunks, [&](int chunk) {
+            size_t begin = blocks * chunk / chunks * Block;
+            size_t end = std::min(blocks * (chunk + 1) / chunks * Block, count);
+            for (size_t b = begin; b < end; b += Block)
+                evaluateRange(scene, time, b, std::min(b + Block, end));
+        });
+    }
+    lastEvaluateMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void AnimationSystem::evaluateRange(Scene& scene, double time, size_t begin, size_t end) {
+    // Key pairs gathered as rows of lanes: position, rotation, scale.
+    float from[10][Block], to[10][Block], out[10][Block], t[Block];
+    size_t n = end - begin;
+    for (size_t j = 0; j < n; j++) {
+        size_t i = begin + j;
+        const AnimationClip& clip = clips[playerClip[i]];
+        const std::vector<float>& times = clip.times;
+        float local = times.front() + wrapTime(clip.wrap, (time - playerStart[i]) * playerSpeed[i], clip.duration());
+
+        // Usually still the same key, or the next one.
+        uint32_t last = (uint32_t)times.size() - 1;
+        uint32_t k = std::min(playerKey[i], last);
+        if (times[k] > local || (k < last && times[k + 1] <= local)) {
+            if (k + 1 < last && times[k + 1] <= local && local < times[k + 2]) {
+                k++;
+            }
+            else {
+                size_t above = std::upper_bound(times.begin(), times.end(), local) - times.begin();
+                k = above > 0 ? (uint32_t)above - 1 : 0;
+            }
+        }
+        playerKey[i] = k;
+        uint32_t next = std::min(k + 1, last);
+        float span = times[next] - times[k];
+        t[j] = span > 0.0f ? std::min(std::max((local - times[k]) / span, 0.0f), 1.0f) : 0.0f;
+
+        const std::vector<float>* rows[10] = { &clip.px, &clip.py, &clip.pz, &clip.rx, &clip.ry, &clip.rz, &clip.rw,
+                                               &clip.sx, &clip.sy, &clip.sz };
+        for (int c = 0; c < 10; c++) {
+            from[c][j] = (*rows[c])[k];
+            to[c][j] = (*rows[c])[next];
+        }
+    }
+
+    for (int c = 0; c < 3; c++) lerp(from[c], to[c], t, out[c], n);
+    slerp(from + 3, to + 3, t, out + 3, n);
+    for (int c = 7; c < 10; c++) lerp(from[c], to[c], t, out[c], n);
+
+    for (size_t j = 0; j < n; j++) {
+        Node* node = scene.get(players[begin + j]);
+        if (!node) continue;
+        int channels = clips[playerClip[begin + j]].channelMask;
+        if (channels & AnimationClip::Position) node->position = glm::dvec3(out[0][j], out[1][j], out[2][j]);
+        if (channels & AnimationClip::Rotation) node->rotation = glm::quat(out[6][j], out[3][j], out[4][j], out[5][j]);
+        if (channels & AnimationClip::Scale) node->scale = glm::vec3(out[7][j], out[8][j], out[9][j]);
+        node->markDirty();
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "Scene.h"
+#include "ThreadPool.h"
+
+enum class AnimationWrap { Clamp, Loop, PingPong };
+
+// Keyframes of a local transform. Each component has its own array, so
+// evaluation loads four players' keys straight into SIMD lanes. Keys are
+// added in increasing time; each rotation is stored on the same side as the
+// one before, so interpolation always takes the short way round. Channels
+// the clip leaves out are not written to the node.
+class AnimationClip {
+public:
+    enum Channel { Position = 1, Rotation = 2, Scale = 4 };
+
+    AnimationWrap wrap;
+
+    explicit AnimationClip(int channels = Position | Rotation | Scale, AnimationWrap wrap = AnimationWrap::Loop);
+
+    void addKey(float time, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+    void addPositionKey(float time, const glm::vec3& position);
+    void addRotationKey(float time, const glm::quat& rotation);
+
+    int channels() const { return channelMask; }
+    size_t keyCount() const { return times.size(); }
+    float duration() const { return times.empty() ? 0.0f : times.back() - times.front(); }
+
+private:
+    friend class AnimationSystem;
+
+    int channelMask;
+    std::vector<float> times;
+    std::vector<float> px, py, pz;
+    std::vector<float> rx, ry, rz, rw;
+    std::vector<float> sx, sy, sz;
+};
+
+// Plays clips on scene nodes, thousands at a time. Each node plays at most
+// one clip; its state is parallel arrays indexed by player. evaluate()
+// splits the players into chunks over the pool and, four at a time, finds
+// their keys, interpolates with SSE (lerp for position and scale, a
+// corrected nlerp that tracks slerp for rotation) and writes the results
+// into the nodes' local TRS, marking them dirty for Scene::update.
+//
+// Time is absolute: a player started at start with speed s shows the clip
+// at (time - start) * s, so evaluating at any moment is exact and needs no
+// per-frame accumulation.
+class AnimationSystem {
+public:
+    explicit AnimationSystem(ThreadPool& pool);
+
+    int addClip(const AnimationClip& clip);
+    // Replaces whatever the node was playing.
+    void play(NodeHandle node, int clip, double start, float speed = 1.0f);
+    void stop(NodeHandle node);
+
+    // Call before Scene::update; nodes destroyed meanwhile are skipped.
+    void evaluate(Scene& scene, double time);
+
+    int playingCount() const { return (int)players.size(); }
+    const std::vector<NodeHandle>& playing() const { return players; }
+    double evaluateMs() const { return lastEvaluateMs; }
+
+private:
+    ThreadPool& pool;
+    std::vector<AnimationClip> clips;
+
+    // Per player.
+    std::vector<NodeHandle> players;
+    std::vector<int> playerClip;
+    std::vector<double> playerStart;
+    std::vector<float> playerSpeed;
+    std::vector<uint32_t> playerKey;    // key found last time, where the search starts
+    std::unordered_map<uint32_t, uint32_t> playerOf;    // by NodeHandle::value
+
+    double lastEvaluateMs;
+
+    void evaluateRange(Scene& scene, double time, size_t begin, size_t end);
+};
+
+#endif
@@ -0,0 +1,1022 @@
+#include "Benchmarks.h"
+#include "Animation.h"
+#include "BuildingFactory.h"
+#include "Collision.h"
+#include "Crowd.h"
+#include "RoadNetwork.h"
+#include "RoutePlanner.h"
+#include "Scene.h"
+#include "SceneFile.h"
+#include "SceneQuery.h"
+#include "SceneText.h"
+#include "ThreadPool.h"
+#include "Traffic.h"
+#include "WorldStreamer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+// Nodes carrying something to read back, so iteration is not optimised away.
+NodeHandle createBenchNode(NodePool& pool, float x) {
+    NodeHandle handle = pool.create();
+    pool.get(handle)->position.x = x;
+    return handle;
+}
+
+NodeHandle createBenchNode(Scene& scene, float x) {
+    NodeHandle handle = scene.create();
+    scene.get(handle)->position.x = x;
+    return handle;
+}
+
+Node* newBenchNode(float x) {
+    Node* node = new Node();
+    node->position.x = x;
+    return node;
+}
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+void printRate(const char* label, size_t ops, double ms) {
+    std::cout << "  " << std::left << std::setw(28) << label << std::right
+              << std::setw(9) << ms << " ms  "
+              << std::setw(9) << (ops / (ms * 1000.0)) << " M ops/s" << std::endl;
+}
+
+float unitRandom(uint32_t& state) {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Streets every spacing units both ways and four buildings of random size
+// in each block, the last of them turned.
+void buildBlockCity(Scene& scene, World& world, int lines, float spacing) {
+    const float extent = (lines - 1) * spacing;
+    BuildingFactory factory(scene, world);
+    for (int i = 0; i < lines; i++) {
+        factory.create(scene.root(), glm::dvec3(i * spacing, 0.0, extent * 0.5), glm::vec3(14.0f, 0.1f, extent),
+            BuildingType::ROAD);
+        factory.create(scene.root(), glm::dvec3(extent * 0.5, 0.0, i * spacing), glm::vec3(extent, 0.1f, 14.0f),
+            BuildingType::ROAD);
+    }
+    uint32_t state = 12345;
+    for (int bx = 0; bx + 1 < lines; bx++) {
+        for (int bz = 0; bz + 1 < lines; bz++) {
+            for (int k = 0; k < 4; k++) {
+                glm::dvec3 position(bx * spacing + 35.0f + (k % 2) * 50.0f, 0.0, bz * spacing + 35.0f + (k / 2) * 50.0f);
+                glm::vec3 size(20.0f + unitRandom(state) * 20.0f, 10.0f + unitRandom(state) * 90.0f,
+                    20.0f + unitRandom(state) * 20.0f);
+                position.y = size.y * 0.5f;
+                glm::quat turn = glm::angleAxis(k == 3 ? unitRandom(state) * 1.5f : 0.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+                factory.create(scene.root(), position, turn, size, BuildingType::SKYSCRAPER);
+            }
+        }
+    }
+    scene.update();
+    world.updateBounds(scene);
+}
+
+void printPercentiles(const char* label, std::vector<float> values) {
+    if (values.empty()) return;
+    std::sort(values.begin(), values.end());
+    auto at = [&](double p) { return values[std::min(values.size() - 1, (size_t)(p * values.size()))]; };
+    std::cout << "  " << std::left << std::setw(28) << label << std::right
+              << "p50 " << at(0.5) << "  p90 " << at(0.9) << "  p99 " << at(0.99)
+              << "  max " << values.back() << " us" << std::endl;
+}
+
+}
+
+bool runBenchmark(const char* name) {
+    if (std::strcmp(name, "pool") == 0) {
+        benchmarkNodePool();
+        return true;
+    }
+    if (std::strcmp(name, "scene") == 0) {
+        benchmarkSceneFile();
+        return true;
+    }
+    if (std::strcmp(name, "text") == 0) {
+        benchmarkSceneText();
+        return true;
+    }
+    if (std::strcmp(name, "stream") == 0) {
+        benchmarkStreaming();
+        return true;
+    }
+    if (std::strcmp(name, "traffic") == 0) {
+        benchmarkTraffic();
+        return true;
+    }
+    if (std::strcmp(name, "routing") == 0) {
+        benchmarkRouting();
+        return true;
+    }
+    if (std::strcmp(name, "animation") == 0) {
+        benchmarkAnimation();
+        return true;
+    }
+    if (std::strcmp(name, "crowd") == 0) {
+        benchmarkCrowd();
+        return true;
+    }
+    if (std::strcmp(name, "collision") == 0) {
+        benchmarkCollision();
+        return true;
+    }
+    if (std::strcmp(name, "raycast") == 0) {
+        benchmarkRaycast();
+        return true;
+    }
+    std::cout << "Unknown benchmark: " << name
+              << " (available: pool, scene, text, stream, traffic, routing, animation, crowd, collision, raycast)"
+              << std::endl;
+    return false;
+}
+
+// Pool versus one heap allocation per node: bulk create, churn (destroy every
+// other node and refill) and a full pass over the live nodes.
+void benchmarkNodePool() {
+    const size_t count = 500000;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Node pool, " << count << " nodes" << std::endl;
+
+    {
+        NodePool pool;
+        std::vector<NodeHandle> handles(count);
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; i++)
+            handles[i] = createBenchNode(pool, (float)i);
+        printRate("pool create", count, elapsedMs(start));
+
+        start = Clock::now();
+        for (size_t i = 0; i < count; i += 2)
+            pool.destroy(handles[i]);
+        for (size_t i = 0; i < count; i += 2)
+            handles[i] = createBenchNode(pool, (float)i);
+        printRate("pool churn (destroy+create)", count, elapsedMs(start));
+
+        float sum = 0.0f;
+        start = Clock::now();
+        pool.forEach([&](const Node& node) { sum += node.position.x; });
+        printRate("pool iterate", count, elapsedMs(start));
+
+        NodeHandle stale = handles[0];
+        pool.destroy(stale);
+        std::cout << "  stale handle resolves: " << (pool.get(stale) ? "yes (BUG)" : "no") << std::endl;
+        std::cout << "  bytes per node: " << (double)pool.memoryBytes() / pool.size()
+                  << " (sizeof(Node) " << sizeof(Node)
+                  << ", handle " << sizeof(NodeHandle) << ")  checksum " << sum << std::endl;
+    }
+
+    {
+        // Car-style spawn/move/despawn through the scene: every edit is a
+        // handful of link updates, no child lists are scanned.
+        Scene scene;
+        NodeHandle street = scene.create();
+        NodeHandle parking = scene.create();
+        scene.addChild(scene.root(), street);
+        scene.addChild(scene.root(), parking);
+        std::vector<NodeHandle> cars(count);
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; i++) {
+            cars[i] = createBenchNode(scene, (float)i);
+            scene.addChild(street, cars[i]);
+        }
+        printRate("scene spawn + attach", count, elapsedMs(start));
+
+        start = Clock::now();
+        for (size_t i = 0; i < count; i += 2)
+            scene.reparent(cars[i], parking);
+        printRate("scene reparent", count / 2, elapsedMs(start));
+
+        start = Clock::now();
+        for (size_t i = 0; i < count; i += 3)
+            scene.queueDestroySubtree(cars[i]);
+        size_t queued = scene.pendingEdits();
+        scene.flush();
+        printRate("scene deferred despawn", queued, elapsedMs(start));
+
+        start = Clock::now();
+        scene.update();
+        printRate("scene update (all dirty)", scene.nodes().size(), elapsedMs(start));
+
+        // Spin a tenth of the cars: only their matrices get rebuilt.
+        start = Clock::now();
+        glm::quat spin = glm::angleAxis(0.1f, glm::vec3(0, 1, 0));
+        size_t moved = 0;
+        for (size_t i = 1; i < count; i += 10) {
+            if (Node* car = scene.get(cars[i])) {
+                car->setRotation(spin * car->rotation);
+                moved++;
+            }
+        }
+        scene.update();
+        printRate("scene animate 10% + update", moved, elapsedMs(start));
+    }
+
+    {
+        // The same kind of churn recorded from every thread at once, one
+        // command buffer per chunk, then applied by a single flush. Done
+        // twice: the resulting hierarchy must not depend on the threads.
+        ThreadPool threadPool;
+        int chunks = (int)threadPool.size() * 8;
+        uint64_t hashes[2];
+        for (int run = 0; run < 2; run++) {
+            Scene scene;
+            NodeHandle street = scene.create();
+            NodeHandle parking = scene.create();
+            scene.addChild(scene.root(), street);
+            scene.addChild(scene.root(), parking);
+            std::vector<NodeHandle> cars(count);
+            for (size_t i = 0; i < count; i++) {
+                cars[i] = createBenchNode(scene, (float)i);
+                scene.addChild(street, cars[i]);
+            }
+
+            auto start = Clock::now();
+            int first = scene.reserveCommandBuffers(chunks);
+            threadPool.parallelFor(chunks, [&](int chunk) {
+                SceneCommandBuffer& commands = scene.commandBuffer(first + chunk);
+                size_t end = count * (chunk + 1) / chunks;
+                for (size_t i = count * chunk / chunks; i < end; i++) {
+                    switch (i % 4) {
+                    case 0: commands.setPosition(cars[i], glm::dvec3((double)i, 0.0, 1.0)); break;
+                    case 1: commands.reparent(cars[i], parking); break;
+                    case 2: commands.destroySubtree(cars[i]); break;
+                    case 3: commands.spawn(parking, glm::dvec3((double)i, 0.0, 2.0), glm::quat(), glm::vec3(1.0f)); break;
+                    }
+                }
+            });
+            double recordMs = elapsedMs(start);
+            size_t recorded = scene.pendingEdits();
+            start = Clock::now();
+            scene.flush();
+            double flushMs = elapsedMs(start);
+            if (run == 0) {
+                printRate("command record (parallel)", recorded, recordMs);
+                printRate("command flush", recorded, flushMs);
+            }
+
+            uint64_t hash = 1469598103934665603ull;
+            std::vector<NodeHandle> children;
+            scene.getChildren(street, children);
+            scene.getChildren(parking, children);
+            for (NodeHandle h : children) {
+                hash = (hash ^ h.value) * 1099511628211ull;
+                hash = (hash ^ (uint64_t)scene.get(h)->position.x) * 1099511628211ull;
+            }
+            hashes[run] = hash;
+        }
+        std::cout << "  command flush deterministic: " << (hashes[0] == hashes[1] ? "yes" : "no (BUG)") << std::endl;
+    }
+
+    {
+        std::vector<Node*> nodes(count);
+        auto start = Clock::now();
+        for (size_t i = 0; i < count; i++)
+            nodes[i] = newBenchNode((float)i);
+        printRate("new create", count, elapsedMs(start));
+
+        start = Clock::now();
+        for (size_t i = 0; i < count; i += 2)
+            delete nodes[i];
+        for (size_t i = 0; i < count; i += 2)
+            nodes[i] = newBenchNode((float)i);
+        printRate("new churn (delete+new)", count, elapsedMs(start));
+
+        float sum = 0.0f;
+        start = Clock::now();
+        for (Node* node : nodes) sum += node->position.x;
+        printRate("new iterate", count, elapsedMs(start));
+
+        // The allocator's own per-block header is not visible from here.
+        std::cout << "  bytes per node: " << sizeof(Node) + sizeof(Node*)
+                  << " + allocator overhead  checksum " << sum << std::endl;
+        for (Node* node : nodes) delete node;
+    }
+}
+
+// A 1000 x 1000 block grid written to disk, then opened through the mapping.
+// Opening validates the header and the BVH arrays; the BVH query then touches
+// just the pages it walks. Instantiating into a runtime Scene is timed
+// separately.
+void benchmarkSceneFile() {
+    const int side = 1000;
+    const char* path = "bench.scene";
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Scene file, " << side * side << " buildings" << std::endl;
+
+    SceneData data;
+    Renderable renderable = { 0, BuildingFactory::MaterialFacade };
+    for (int z = 0; z < side; z++) {
+        int32_t block = data.addGroup(-1, glm::dvec3(0.0, 0.0, z * 6.0));
+        for (int x = 0; x < side; x++) {
+            BuildingType type = (x * 7 + z * 3) % 5 == 0 ? BuildingType::SKYSCRAPER : BuildingType::HOUSE;
+            float height = type == BuildingType::SKYSCRAPER ? 20.0f : 3.0f;
+            data.add(block, glm::dvec3(x * 6.0, height * 0.5, 0.0), glm::vec3(4.0f, height, 4.0f), type, renderable);
+        }
+    }
+
+    auto start = Clock::now();
+    if (!SceneFile::write(path, data)) return;
+    std::cout << "  write (bounds + BVH)       " << elapsedMs(start) << " ms" << std::endl;
+
+    SceneFile file;
+    start = Clock::now();
+    if (!file.open(path)) return;
+    std::cout << "  open (mmap)                " << elapsedMs(start) << " ms, "
+              << file.nodeCount() << " nodes" << std::endl;
+
+    Frustum frustum;
+    frustum.extract(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 200.0f) *
+        glm::lookAt(glm::vec3(3000, 30, 3000), glm::vec3(3100, 0, 3100), glm::vec3(0, 1, 0)));
+    size_t hits = 0;
+    start = Clock::now();
+    file.bvh().queryFrustum(frustum, [&](uint32_t) { hits++; });
+    std::cout << "  first frustum query        " << elapsedMs(start) << " ms, " << hits << " candidates" << std::endl;
+
+    Scene scene;
+    World world;
+    world.meshes.push_back(Mesh{ 0, 36 });
+    world.materials.resize(BuildingFactory::MaterialCount);
+    BuildingFactory factory(scene, world);
+    start = Clock::now();
+    file.instantiate(scene, factory, world);
+    printRate("instantiate", file.nodeCount(), elapsedMs(start));
+
+    file.close();
+    std::remove(path);
+}
+
+// About a million lines of .city text generated in memory, parsed on one
+// thread and then split across the pool. The cached open is timed twice: the
+// first run parses and writes "<path>.scene", the second only maps it.
+void benchmarkSceneText() {
+    const int side = 1000;
+    const char* path = "bench.city";
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Text scene, " << side * side << " buildings" << std::endl;
+
+    std::string text = "# generated by --bench text\n";
+    text.reserve((size_t)side * side * 48);
+    char line[128];
+    int id = 0;
+    for (int z = 0; z < side; z++) {
+        int block = id++;
+        std::snprintf(line, sizeof(line), "%d -1 GROUP 0 0 %.1f 1 1 1\n", block, z * 6.0f);
+        text += line;
+        for (int x = 0; x < side; x++) {
+            bool tall = (x * 7 + z * 3) % 5 == 0;
+            std::snprintf(line, sizeof(line), "%d %d %s %.1f %.1f 0 4 %.1f 4 %d\n", id++, block,
+                tall ? "SKYSCRAPER" : "HOUSE", x * 6.0f, tall ? 10.0f : 1.5f, tall ? 20.0f : 3.0f, (x * 15) % 90);
+            text += line;
+        }
+    }
+    double megabytes = text.size() / (1024.0 * 1024.0);
+
+    SceneData data;
+    auto start = Clock::now();
+    if (!SceneText::parse(text.data(), text.size(), NULL, data)) return;
+    double singleMs = elapsedMs(start);
+    std::cout << "  parse, 1 thread            " << singleMs << " ms, "
+              << megabytes / (singleMs / 1000.0) << " MB/s" << std::endl;
+
+    ThreadPool pool;
+    start = Clock::now();
+    if (!SceneText::parse(text.data(), text.size(), &pool, data)) return;
+    double poolMs = elapsedMs(start);
+    std::cout << "  parse, " << std::setw(2) << pool.size() << " threads          " << poolMs << " ms, "
+              << megabytes / (poolMs / 1000.0) << " MB/s" << std::endl;
+
+    FILE* f = std::fopen(path, "wb");
+    if (!f) return;
+    std::fwrite(text.data(), 1, text.size(), f);
+    std::fclose(f);
+    std::string cachePath = std::string(path) + ".scene";
+    std::remove(cachePath.c_str());
+
+    SceneFile file;
+    start = Clock::now();
+    if (!SceneText::open(path, &pool, true, file)) return;
+    std::cout << "  open, no cache yet         " << elapsedMs(start) << " ms" << std::endl;
+    file.close();
+    start = Clock::now();
+    if (!SceneText::open(path, &pool, true, file)) return;
+    std::cout << "  open, cached               " << elapsedMs(start) << " ms, "
+              << file.nodeCount() << " nodes" << std::endl;
+
+    file.close();
+    std::remove(path);
+    std::remove(cachePath.c_str());
+}
+
+// A 500 x 500 block city cut into tiles, then a flythrough at 1500 units/s
+// (25 units per frame, paced at 60 Hz so loads get real time) corner to
+// corner with a budget that forces evictions. Run once with the ring around
+// the camera only and once with prefetch along the predicted path; what
+// matters is the worst frame and how many tiles were in before they were
+// needed.
+void benchmarkStreaming() {
+    const int side = 500;
+    const int blockSide = 8;
+    const float spacing = 6.0f;
+    const float tileSize = 96.0f;
+    const char* path = "bench.tiles";
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Streaming, " << side * side << " buildings in " << tileSize << " unit tiles" << std::endl;
+
+    SceneData data;
+    Renderable renderable = { 0, BuildingFactory::MaterialFacade };
+    for (int bz = 0; bz < side / blockSide; bz++) {
+        for (int bx = 0; bx < side / blockSide; bx++) {
+            glm::dvec3 corner(bx * blockSide * spacing, 0.0, bz * blockSide * spacing);
+            int32_t block = data.addGroup(-1, corner);
+            for (int z = 0; z < blockSide; z++) {
+                for (int x = 0; x < blockSide; x++) {
+                    float height = 3.0f + (float)((x * 7 + z * 3 + bx) % 9);
+                    data.add(block, glm::dvec3(x * spacing, height * 0.5, z * spacing),
+                        glm::vec3(4.0f, height, 4.0f), BuildingType::HOUSE, renderable);
+                }
+            }
+        }
+    }
+    auto start = Clock::now();
+    if (!WorldStreamer::writeTiles(path, data, tileSize)) return;
+    std::cout << "  write tiles                " << elapsedMs(start) << " ms" << std::endl;
+
+    ThreadPool pool;
+    auto flythrough = [&](const char* label, float prefetchSeconds) {
+        Scene scene;
+        World world;
+        world.meshes.push_back(Mesh{ 0, 36 });
+        world.materials.resize(BuildingFactory::MaterialCount);
+        BuildingFactory factory(scene, world);
+        WorldStreamer streamer(scene, factory, world, pool);
+        streamer.settings.memoryBudget = (size_t)48 << 20;
+        streamer.settings.prefetchSeconds = prefetchSeconds;
+        if (!streamer.open(path)) return;
+
+        const float speed = 1500.0f;
+        const double frameTime = 1.0 / 60.0;
+        glm::vec3 front = glm::normalize(glm::vec3(1.0f, 0.0f, 1.0f));
+        int frames = (int)(side * spacing * 1.414f / (speed * frameTime));
+        double worstMs = 0.0, totalMs = 0.0;
+        size_t peakBuildings = 0;
+        for (int f = 0; f < frames; f++) {
+            glm::vec3 eye = glm::vec3(0.0f, 30.0f, 0.0f) + front * (float)(speed * frameTime * f);
+            auto frameStart = Clock::now();
+            scene.flush();
+            streamer.update(f * frameTime, eye, front, speed);
+            scene.update();
+            world.updateBounds(scene);
+            double ms = elapsedMs(frameStart);
+            worstMs = std::max(worstMs, ms);
+            totalMs += ms;
+            peakBuildings = std::max(peakBuildings, streamer.buildingCount());
+            if (ms < frameTime * 1000.0)
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(frameTime * 1000.0 - ms));
+        }
+        std::cout << "  " << std::left << std::setw(27) << label << std::right << totalMs / frames << " ms avg, "
+                  << worstMs << " ms worst, " << peakBuildings << " buildings peak" << std::endl;
+        std::cout << "  ";
+        streamer.stats().print();
+    };
+    flythrough("ring only", 0.0f);
+    flythrough("predictive prefetch", StreamingSettings().prefetchSeconds);
+
+    int tiles = (int)std::ceil(side * spacing / tileSize);
+    for (int z = 0; z <= tiles; z++) {
+        for (int x = 0; x <= tiles; x++)
+            std::remove((std::string(path) + "." + std::to_string(x) + "_" + std::to_string(z)).c_str());
+    }
+    std::remove(path);
+}
+
+// A grid of two-lane-each-way roads, 141 each way 120 units apart, with 10k,
+// 100k and 1M cars. A tick is the simulation alone; sync is writing the car
+// transforms into the scene plus Scene::update and the bounds refresh.
+void benchmarkTraffic() {
+    const int lines = 141;
+    const float spacing = 120.0f;
+    const float extent = (lines - 1) * spacing;
+    std::cout << std::fixed << std::setprecision(2);
+
+    Scene roadScene;
+    World roadWorld;
+    BuildingFactory roadFactory(roadScene, roadWorld);
+    for (int i = 0; i < lines; i++) {
+        roadFactory.create(roadScene.root(), glm::dvec3(i * spacing, 0.0, extent * 0.5), glm::vec3(14.0f, 0.1f, extent),
+            BuildingType::ROAD);
+        roadFactory.create(roadScene.root(), glm::dvec3(extent * 0.5, 0.0, i * spacing), glm::vec3(extent, 0.1f, 14.0f),
+            BuildingType::ROAD);
+    }
+    roadScene.update();
+    RoadNetwork network;
+    auto start = Clock::now();
+    network.addRoads(roadScene, roadWorld);
+    network.build();
+    std::cout << "Traffic, " << network.edges.size() << " edges, " << network.laneCount() << " lanes, "
+              << network.intersectionCount() << " intersections (built in " << elapsedMs(start) << " ms)" << std::endl;
+
+    ThreadPool pool;
+    const float dt = 1.0f / 30.0f;
+    for (int count : { 10000, 100000, 1000000 }) {
+        Scene scene;
+        World world;
+        BuildingFactory factory(scene, world);
+        Traffic traffic(network, pool);
+        int placed = traffic.spawn(count, 1, &factory, scene.root());
+        scene.update();
+        world.updateBounds(scene);
+
+        int ticks = count >= 1000000 ? 30 : 120;
+        for (int i = 0; i < 10; i++) traffic.tick(dt);
+        start = Clock::now();
+        for (int i = 0; i < ticks; i++) traffic.tick(dt);
+        double tickMs = elapsedMs(start) / ticks;
+
+        int syncs = 5;
+        start = Clock::now();
+        for (int i = 0; i < syncs; i++) {
+            traffic.tick(dt);
+            traffic.syncTransforms(scene);
+            scene.update();
+            world.updateBounds(scene);
+        }
+        double syncMs = elapsedMs(start) / syncs - tickMs;
+
+        std::cout << "  " << std::setw(7) << placed << " cars, " << std::setw(2) << pool.size() << " threads  "
+                  << std::setw(8) << tickMs << " ms/tick " << std::setw(9) << 1000.0 / tickMs << " ticks/s  sync "
+                  << syncMs << " ms" << std::endl;
+    }
+}
+
+// Shortest routes on a 320 x 320 street grid (over 100k intersections):
+// landmark preprocessing, then single-query latency with and without
+// landmarks, a batch on the pool, and a batch where most requests repeat a
+// few popular trips so the cache answers them.
+void benchmarkRouting() {
+    const int lines = 320;
+    const float spacing = 100.0f;
+    const float extent = (lines - 1) * spacing;
+    const int queries = 20000;
+    std::cout << std::fixed << std::setprecision(2);
+
+    RoadNetwork network;
+    for (int i = 0; i < lines; i++) {
+        network.addRoad(glm::vec3(i * spacing, 0.0f, 0.0f), glm::vec3(i * spacing, 0.0f, extent), 8.0f);
+        network.addRoad(glm::vec3(0.0f, 0.0f, i * spacing), glm::vec3(extent, 0.0f, i * spacing), 8.0f);
+    }
+    auto start = Clock::now();
+    network.build();
+    std::cout << "Routing, " << network.nodes.size() << " nodes, " << network.edges.size() << " edges (built in "
+              << elapsedMs(start) << " ms)" << std::endl;
+
+    ThreadPool pool;
+    RoutePlanner planner(network, pool);
+    planner.preprocess();
+    std::cout << "  " << planner.landmarkCount() << " landmarks preprocessed in " << planner.stats().preprocessMs
+              << " ms on " << pool.size() << " threads" << std::endl;
+
+    uint32_t random = 12345;
+    auto nextNode = [&]() {
+        random = random * 1664525u + 1013904223u;
+        return (int)((random >> 8) % network.nodes.size());
+    };
+    std::vector<RouteRequest> requests(queries);
+    for (RouteRequest& r : requests) {
+        r.from = nextNode();
+        r.to = nextNode();
+    }
+
+    RoutePlanner dijkstra(network, pool);
+    dijkstra.settings.landmarks = 0;
+    dijkstra.preprocess();
+    for (int pass = 0; pass < 2; pass++) {
+        RoutePlanner& p = pass == 0 ? dijkstra : planner;
+        int count = pass == 0 ? 500 : queries;
+        RoutePlanner::Search search;
+        Route route;
+        std::vector<float> latency;
+        int64_t settled = 0;
+        for (int i = 0; i < count; i++) {
+            auto queryStart = Clock::now();
+            p.findRoute(requests[i].from, requests[i].to, search, route);
+            latency.push_back(std::chrono::duration<float, std::micro>(Clock::now() - queryStart).count());
+            settled += search.settled;
+        }
+        printPercentiles(pass == 0 ? "Dijkstra, 1 thread" : "ALT, 1 thread", latency);
+        std::cout << "  " << std::setw(28) << "" << settled / count << " nodes settled per query" << std::endl;
+    }
+
+    std::vector<Route> routes;
+    std::vector<float> latency;
+    planner.settings.cacheSize = 0;
+    start = Clock::now();
+    planner.route(requests, routes, &latency);
+    double ms = elapsedMs(start);
+    printPercentiles("ALT batch, no cache", latency);
+    std::cout << "  " << std::setw(28) << "" << queries / (ms / 1000.0) << " queries/s" << std::endl;
+
+    // 90% of requests are one of 256 trips.
+    std::vector<RouteRequest> popular(256);
+    for (RouteRequest& r : popular) {
+        r.from = nextNode();
+        r.to = nextNode();
+    }
+    for (int i = 0; i < queries; i++) {
+        if (i % 10 != 0) requests[i] = popular[(random = random * 1664525u + 1013904223u) >> 24];
+    }
+    planner.settings.cacheSize = 4096;
+    planner.clearCache();
+    start = Clock::now();
+    planner.route(requests, routes, &latency);
+    ms = elapsedMs(start);
+    int hitsBefore = planner.stats().cacheHits;
+    start = Clock::now();
+    planner.route(requests, routes, &latency);
+    double warmMs = elapsedMs(start);
+    printPercentiles("ALT batch, warm cache", latency);
+    std::cout << "  " << std::setw(28) << "" << queries / (warmMs / 1000.0) << " queries/s warm, "
+              << queries / (ms / 1000.0) << " cold, "
+              << 100.0 * (planner.stats().cacheHits - hitsBefore) / queries << "% hits when warm" << std::endl;
+}
+
+// Rooftop fans (looping rotation), doors (swinging back and forth) and cars
+// on a rail (looping position and heading), a third each, at 1k, 10k and
+// 100k props. Evaluate is the animation alone; update adds Scene::update.
+void benchmarkAnimation() {
+    std::cout << std::fixed << std::setprecision(3);
+    std::cout << "Animation" << std::endl;
+    const glm::vec3 up(0.0f, 1.0f, 0.0f);
+    AnimationClip fan(AnimationClip::Rotation, AnimationWrap::Loop);
+    for (int k = 0; k <= 4; k++)
+        fan.addRotationKey(k * 0.5f, glm::angleAxis(k * 1.5707963f, up));
+    AnimationClip door(AnimationClip::Rotation, AnimationWrap::PingPong);
+    door.addRotationKey(0.0f, glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+    door.addRotationKey(1.5f, glm::angleAxis(1.5f, up));
+    door.addRotationKey(4.0f, glm::angleAxis(1.5f, up));
+    AnimationClip rail(AnimationClip::Position | AnimationClip::Rotation, AnimationWrap::Loop);
+    for (int k = 0; k <= 8; k++) {
+        float angle = k * 0.7853982f;
+        rail.addKey(k * 2.0f, glm::vec3(std::cos(angle), 0.0f, std::sin(angle)) * 40.0f,
+            glm::angleAxis(-angle, up), glm::vec3(1.0f));
+    }
+
+    ThreadPool pool;
+    for (int count : { 1000, 10000, 100000 }) {
+        Scene scene;
+        AnimationSystem animation(pool);
+        int clips[3] = { animation.addClip(fan), animation.addClip(door), animation.addClip(rail) };
+        for (int i = 0; i < count; i++) {
+            NodeHandle prop = scene.create();
+            scene.addChild(scene.root(), prop);
+            animation.play(prop, clips[i % 3], -0.01 * i, 0.5f + (i % 7) * 0.25f);
+        }
+        scene.update();
+
+        const int frames = 200;
+        double evaluateMs = 0.0, worstMs = 0.0, updateMs = 0.0;
+        for (int f = 0; f < frames; f++) {
+            animation.evaluate(scene, f / 60.0);
+            evaluateMs += animation.evaluateMs();
+            worstMs = std::max(worstMs, animation.evaluateMs());
+            auto start = Clock::now();
+            scene.update();
+            updateMs += elapsedMs(start);
+        }
+        std::cout << "  " << std::setw(7) << count << " props: evaluate " << evaluateMs / frames << " ms avg, "
+                  << worstMs << " ms worst, + update " << updateMs / frames << " ms" << std::endl;
+    }
+}
+
+// 10k and 100k pedestrians on the sidewalks of a 61 x 61 road grid. A tick
+// is the grid rebuild, steering and movement; touching counts pairs closer
+// than two radii at the end, found through the same grid.
+void benchmarkCrowd() {
+    const int lines = 61;
+    const float spacing = 80.0f;
+    const float extent = (lines - 1) * spacing;
+    std::cout << std::fixed << std::setprecision(2);
+
+    Scene scene;
+    World world;
+    BuildingFactory factory(scene, world);
+    for (int i = 0; i < lines; i++) {
+        factory.create(scene.root(), glm::dvec3(i * spacing, 0.0, extent * 0.5), glm::vec3(14.0f, 0.1f, extent),
+            BuildingType::ROAD);
+        factory.create(scene.root(), glm::dvec3(extent * 0.5, 0.0, i * spacing), glm::vec3(extent, 0.1f, 14.0f),
+            BuildingType::ROAD);
+    }
+    scene.update();
+    RoadNetwork network;
+    network.addRoads(scene, world);
+    network.build();
+    std::cout << "Crowd, " << network.edges.size() << " sidewalks" << std::endl;
+
+    ThreadPool pool;
+    const float dt = 1.0f / 60.0f;
+    for (int count : { 10000, 100000 }) {
+        Crowd crowd(network, pool);
+        crowd.spawn(count, 1);
+        const int ticks = 300;
+        double totalMs = 0.0, worstMs = 0.0;
+        for (int t = 0; t < ticks; t++) {
+            crowd.tick(dt);
+            totalMs += crowd.tickMs();
+            worstMs = std::max(worstMs, crowd.tickMs());
+        }
+        Frustum everything;
+        for (int p = 0; p < 6; p++) everything.planes[p] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        std::vector<glm::vec3> agents;
+        crowd.gatherVisible(everything, glm::vec3(0.0f), 1e9f, 1.0f, agents);
+        float contact = crowd.settings.radius * 2.0f;
+        int touching = 0;
+        std::unordered_map<uint64_t, std::vector<int>> cells;
+        auto key = [&](int cx, int cz) { return ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cz; };
+        for (size_t i = 0; i < agents.size(); i++)
+            cells[key((int)std::floor(agents[i].x / contact), (int)std::floor(agents[i].z / contact))].push_back((int)i);
+        for (size_t i = 0; i < agents.size(); i++) {
+            int cx = (int)std::floor(agents[i].x / contact), cz = (int)std::floor(agents[i].z / contact);
+            for (int dz = -1; dz <= 1; dz++) {
+                for (int dx = -1; dx <= 1; dx++) {
+                    auto it = cells.find(key(cx + dx, cz + dz));
+                    if (it == cells.end()) continue;
+                    for (int j : it->second) {
+                        if (j <= (int)i) continue;
+                        glm::vec3 d = agents[i] - agents[j];
+                        touching += d.x * d.x + d.z * d.z < contact * contact;
+                    }
+                }
+            }
+        }
+        std::cout << "  " << std::setw(7) << count << " agents: " << totalMs / ticks << " ms/tick avg, " << worstMs
+                  << " ms worst, " << touching << " touching pairs" << std::endl;
+    }
+}
+
+// A 41 x 41 street grid with four buildings per block, some turned, and
+// 10k cars. Pairs from the broadphase against a brute force over every car
+// pair, then camera slides at random through the city, none of which may
+// end up inside a building.
+void benchmarkCollision() {
+    const int lines = 41;
+    const float spacing = 120.0f;
+    const float extent = (lines - 1) * spacing;
+    std::cout << std::fixed << std::setprecision(2);
+
+    Scene scene;
+    World world;
+    buildBlockCity(scene, world, lines, spacing);
+    uint32_t state = 12345;
+    auto random = [&]() { return unitRandom(state); };
+
+    std::vector<OBB> boxes(world.bounds.size());
+    std::vector<uint32_t> layers(world.bounds.size());
+    for (size_t i = 0; i < world.bounds.size(); i++) {
+        Entity e = world.bounds.entity(i);
+        boxes[i] = OBB::fromTransform(scene.get(e)->worldTransform);
+        layers[i] = world.buildings.get(e)->type == BuildingType::ROAD ? CollideGround : CollideSolid;
+    }
+    ThreadPool pool;
+    CollisionWorld collision(pool);
+    auto start = Clock::now();
+    collision.setStatic(boxes, layers);
+    double staticMs = elapsedMs(start);
+
+    RoadNetwork network;
+    network.addRoads(scene, world);
+    network.build();
+    Traffic traffic(network, pool);
+    int placed = traffic.spawn(10000, 1);
+    for (int t = 0; t < 60; t++) traffic.tick(1.0f / 30.0f);
+    std::cout << "Collision, " << boxes.size() << " static boxes (BVHs built in " << staticMs << " ms), " << placed
+              << " cars, " << pool.size() << " threads" << std::endl;
+
+    std::vector<OBB> cars;
+    std::vector<CollisionPair> pairs;
+    const int rounds = 100;
+    double setMs = 0.0, pairsMs = 0.0;
+    for (int r = 0; r < rounds; r++) {
+        traffic.tick(1.0f / 30.0f);
+        traffic.carBoxes(cars);
+        start = Clock::now();
+        collision.setDynamic(cars);
+        setMs += elapsedMs(start);
+        collision.findPairs(CollideSolid, pairs);
+        pairsMs += collision.pairsMs();
+    }
+    int carPairs = 0, staticPairs = 0;
+    for (const CollisionPair& p : pairs) (p.isStatic ? staticPairs : carPairs)++;
+    int brute = 0;
+    for (size_t i = 0; i < cars.size(); i++) {
+        AABB a = cars[i].bounds();
+        for (size_t j = i + 1; j < cars.size(); j++) {
+            AABB b = cars[j].bounds();
+            if (a.min.x > b.max.x || a.max.x < b.min.x || a.min.y > b.max.y || a.max.y < b.min.y ||
+                a.min.z > b.max.z || a.max.z < b.min.z) continue;
+            brute += overlaps(cars[i], cars[j]);
+        }
+    }
+    std::cout << "  grid rebuild " << setMs / rounds << " ms, pairs " << pairsMs / rounds << " ms: " << carPairs
+              << " car pairs (brute force " << brute << "), " << staticPairs << " car-building pairs" << std::endl;
+
+    // Slides from street level in random directions, some straight at walls.
+    const int slides = 100000;
+    int inside = 0;
+    glm::dvec3 position(0.0, 1.7, 0.0);
+    start = Clock::now();
+    for (int i = 0; i < slides; i++) {
+        if (i % 1000 == 0) position = glm::dvec3(random() * extent, 1.7, random() * extent);
+        float angle = random() * 6.2831853f;
+        glm::dvec3 target = position + glm::dvec3(std::cos(angle), 0.0, std::sin(angle)) * 2.0;
+        position = collision.slide(position, target, 0.3f, CollideSolid);
+    }
+    double slideMs = elapsedMs(start);
+    position = glm::dvec3(0.0, 1.7, 0.0);
+    for (int i = 0; i < slides; i++) {
+        if (i % 1000 == 0) position = glm::dvec3(random() * extent, 1.7, random() * extent);
+        float angle = random() * 6.2831853f;
+        glm::dvec3 from = position;
+        position = collision.slide(position, position + glm::dvec3(std::cos(angle), 0.0, std::sin(angle)) * 2.0,
+            0.3f, CollideSolid);
+        // A point that started outside every building must stay outside.
+        glm::vec3 p(position);
+        bool wasInside = false, isInside = false;
+        for (size_t b = 0; b < boxes.size(); b++) {
+            if (layers[b] != CollideSolid) continue;
+            glm::vec3 d = p - boxes[b].center, d0 = glm::vec3(from) - boxes[b].center;
+            bool in = true, in0 = true;
+            for (int k = 0; k < 3; k++) {
+                in = in && std::fabs(glm::dot(d, boxes[b].axes[k])) < boxes[b].halfExtents[k];
+                in0 = in0 && std::fabs(glm::dot(d0, boxes[b].axes[k])) < boxes[b].halfExtents[k];
+            }
+            isInside = isInside || in;
+            wasInside = wasInside || in0;
+        }
+        inside += isInside && !wasInside;
+    }
+    std::cout << "  camera slide " << slideMs * 1000.0 / slides << " us each, " << inside << " of " << slides
+              << " ended inside a building" << std::endl;
+}
+
+// Rays against the same block city as the collision benchmark: a 1024 x 1024
+// view from above the streets, packed in 2 x 2 pixel quads, and as many
+// rays with random origins and directions. Each set is traced one ray at a
+// time on this thread and in packets on the pool, and both are checked
+// against a brute force over every box on a sample.
+void benchmarkRaycast() {
+    const int lines = 41;
+    const float spacing = 120.0f;
+    const float extent = (lines - 1) * spacing;
+    std::cout << std::fixed << std::setprecision(2);
+
+    Scene scene;
+    World world;
+    buildBlockCity(scene, world, lines, spacing);
+    ThreadPool pool;
+    SceneQuery query(pool);
+    auto start = Clock::now();
+    query.build(scene, world);
+    std::cout << "Raycast, " << query.entityCount() << " boxes (built in " << elapsedMs(start) << " ms), "
+              << pool.size() << " threads" << std::endl;
+
+    // The query meets rays in each box's frame through affineInverse.
+    float inverseError = 0.0f;
+    for (size_t i = 0; i < world.bounds.size(); i++) {
+        const Affine3x4& m = scene.get(world.bounds.entity(i))->worldTransform;
+        glm::mat4 expected = glm::inverse(m.toMat4()), actual = affineInverse(m).toMat4();
+        for (int c = 0; c < 4; c++)
+            for (int k = 0; k < 4; k++)
+                inverseError = std::max(inverseError, std::fabs(actual[c][k] - expected[c][k]) / (std::fabs(expected[c][k]) + 1.0f));
+    }
+    std::cout << "  affineInverse vs glm::inverse: max relative error " << std::scientific << inverseError
+              << std::fixed << std::endl;
+
+    std::vector<OBB> boxes(world.bounds.size());
+    for (size_t i = 0; i < world.bounds.size(); i++)
+        boxes[i] = OBB::fromTransform(scene.get(world.bounds.entity(i))->worldTransform);
+    auto bruteForce = [&](const Ray& ray) {
+        float best = ray.maxDistance;
+        for (const OBB& box : boxes) {
+            glm::vec3 offset = ray.origin - box.center;
+            float enter = 0.0f, exit = best;
+            bool miss = false;
+            for (int k = 0; k < 3 && !miss; k++) {
+                float o = glm::dot(offset, box.axes[k]), d = glm::dot(ray.direction, box.axes[k]);
+                if (std::fabs(d) < 1e-12f) {
+                    miss = std::fabs(o) > box.halfExtents[k];
+                    continue;
+                }
+                float t0 = (-box.halfExtents[k] - o) / d, t1 = (box.halfExtents[k] - o) / d;
+                enter = std::max(enter, std::min(t0, t1));
+                exit = std::min(exit, std::max(t0, t1));
+                miss = enter > exit;
+            }
+            if (!miss) best = std::min(best, enter);
+        }
+        return best;
+    };
+
+    const int side = 1024;
+    std::vector<Ray> view(side * side), scattered(side * side);
+    glm::vec3 eye(extent * 0.5f + 60.0f, 30.0f, extent * 0.5f + 60.0f);
+    glm::vec3 forward = glm::normalize(glm::vec3(1.0f, -0.15f, 0.4f));
+    glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+    glm::vec3 up = glm::cross(right, forward);
+    size_t r = 0;
+    for (int qy = 0; qy < side; qy += 2) {
+        for (int qx = 0; qx < side; qx += 2) {
+            for (int k = 0; k < 4; k++) {
+                float px = ((qx + (k & 1) + 0.5f) / side * 2.0f - 1.0f) * 0.8f;
+                float py = ((qy + (k >> 1) + 0.5f) / side * 2.0f - 1.0f) * 0.8f;
+                view[r].origin = eye;
+                view[r].direction = glm::normalize(forward + right * px + up * py);
+                view[r].maxDistance = 5000.0f;
+                r++;
+            }
+        }
+    }
+    uint32_t state = 777;
+    for (Ray& ray : scattered) {
+        ray.origin = glm::vec3(unitRandom(state) * extent, unitRandom(state) * 60.0f, unitRandom(state) * extent);
+        float yaw = unitRandom(state) * 6.2831853f, pitch = (unitRandom(state) - 0.5f) * 1.2f;
+        ray.direction = glm::vec3(std::cos(yaw) * std::cos(pitch), std::sin(pitch), std::sin(yaw) * std::cos(pitch));
+        ray.maxDistance = 1000.0f;
+    }
+
+    std::vector<RayHit> single(side * side), packed(side * side);
+    const char* names[2] = { "view", "scattered" };
+    const std::vector<Ray>* sets[2] = { &view, &scattered };
+    for (int set = 0; set < 2; set++) {
+        const std::vector<Ray>& rays = *sets[set];
+        start = Clock::now();
+        for (size_t i = 0; i < rays.size(); i++) query.raycast(rays[i], single[i]);
+        double singleMs = elapsedMs(start);
+        start = Clock::now();
+        query.raycastBatch(rays.data(), rays.size(), packed.data());
+        double packedMs = elapsedMs(start);
+
+        int hits = 0, differ = 0, wrong = 0;
+        for (size_t i = 0; i < rays.size(); i++) {
+            hits += !single[i].entity.isNull();
+            differ += single[i].entity.isNull() != packed[i].entity.isNull() ||
+                std::fabs(single[i].distance - packed[i].distance) > 1e-3f;
+        }
+        for (size_t i = 0; i < rays.size(); i += 997)
+            wrong += std::fabs(bruteForce(rays[i]) - single[i].distance) > 1e-3f;
+        std::cout << "  " << std::left << std::setw(10) << names[set] << std::right << " single "
+                  << std::setw(6) << rays.size() / (singleMs * 1000.0) << " M rays/s, packets "
+                  << std::setw(6) << rays.size() / (packedMs * 1000.0) << " M rays/s  (" << hits << " hits, "
+                  << differ << " differ, " << wrong << " of " << (rays.size() + 996) / 997 << " wrong)" << std::endl;
+    }
+
+    // Overlaps around random points, checked against every box on a sample.
+    const int overlaps = 100000;
+    std::vector<Entity> found;
+    size_t total = 0;
+    int wrong = 0;
+    start = Clock::now();
+    for (int i = 0; i < overlaps; i++) {
+        glm::vec3 center(unitRandom(state) * extent, unitRandom(state) * 40.0f, unitRandom(state) * extent);
+        query.overlapSphere(center, 15.0f, found);
+        total += found.size();
+    }
+    double sphereMs = elapsedMs(start);
+    start = Clock::now();
+    for (int i = 0; i < overlaps; i++) {
+        OBB box;
+        box.center = glm::vec3(unitRandom(state) * extent, unitRandom(state) * 40.0f, unitRandom(state) * extent);
+        float yaw = unitRandom(state) * 6.2831853f;
+        box.axes[0] = glm::vec3(std::cos(yaw), 0.0f, std::sin(yaw));
+        box.axes[1] = glm::vec3(0.0f, 1.0f, 0.0f);
+        box.axes[2] = glm::vec3(-std::sin(yaw), 0.0f, std::cos(yaw));
+        box.halfExtents = glm::vec3(20.0f, 5.0f, 8.0f);
+        query.overlapBox(box, found);
+        total += found.size();
+        if (i % 997 == 0) {
+            size_t expected = 0;
+            for (const OBB& other : boxes) expected += ::overlaps(box, other);
+            wrong += expected != found.size();
+        }
+    }
+    double boxMs = elapsedMs(start);
+    std::cout << "  overlapSphere " << sphereMs * 1000.0 / overlaps << " us, overlapBox " << boxMs * 1000.0 / overlaps
+              << " us  (" << total << " found, " << wrong << " of " << (overlaps + 996) / 997 << " boxes wrong)"
+              << std::endl;
+}
@@ -0,0 +1,19 @@
+#ifndef BENCHMARKS_H
+#define BENCHMARKS_H
+
+// Offline measurements, run with --bench <name> instead of opening a window.
+// Returns false for an unknown name.
+bool runBenchmark(const char* name);
+
+void benchmarkNodePool();
+void benchmarkSceneFile();
+void benchmarkSceneText();
+void benchmarkStreaming();
+void benchmarkTraffic();
+void benchmarkRouting();
+void benchmarkAnimation();
+void benchmarkCrowd();
+void benchmarkCollision();
+void benchmarkRaycast();
+
+#endif
@@ -1,32 +1,31 @@
 #include "Building.h"
 
-Building::Building() {
-    type = BuildingType::HOUSE;
-    color = glm::vec3(1.0f);
-    localTransform = glm::mat4(1.0f);
-    worldTransform = glm::mat4(1.0f);
-}
-
-Building::Building(const glm::vec3& position, const glm::vec3& scale, BuildingType t) {
-    type = t;
-    localTransform = glm::mat4(1.0f);
-    localTransform = glm::translate(localTransform, position);
-    localTransform = glm::scale(localTransform, scale);
-    worldTransform = glm::mat4(1.0f);
-
+glm::vec3 buildingColor(BuildingType type) {
     switch (type) {
-    case BuildingType::HOUSE:       color = glm::vec3(0.8f, 0.5f, 0.3f); break;
-    case BuildingType::SHOP:        color = glm::vec3(0.2f, 0.8f, 0.2f); break;
-    case BuildingType::SKYSCRAPER:  color = glm::vec3(0.5f, 0.5f, 0.8f); break;
-    case BuildingType::TREE:        color = glm::vec3(0.0f, 0.6f, 0.0f); break;
-    case BuildingType::FIELD:       color = glm::vec3(0.3f, 0.7f, 0.3f); break;
-    case BuildingType::ROAD:        color = glm::vec3(0.15f, 0.15f, 0.17f); break;
-    case BuildingType::CAR:         color = glm::vec3(1.0f, 0.0f, 0.0f); break;
-    case BuildingType::MOUNTAIN:    color = glm::vec3(0.4f, 0.3f, 0.25f); break;
-    default:                        color = glm::vec3(1.0f); break;
+    case BuildingType::HOUSE:       return glm::vec3(0.8f, 0.5f, 0.3f);
+    case BuildingType::SHOP:        return glm::vec3(0.2f, 0.8f, 0.2f);
+    case BuildingType::SKYSCRAPER:  return glm::vec3(0.5f, 0.5f, 0.8f);
+    case BuildingType::TREE:        return glm::vec3(0.0f, 0.6f, 0.0f);
+    case BuildingType::FIELD:       return glm::vec3(0.3f, 0.7f, 0.3f);
+    case BuildingType::ROAD:        return glm::vec3(0.15f, 0.15f, 0.17f);
+    case BuildingType::CAR:         return glm::vec3(1.0f, 0.0f, 0.0f);
+    case BuildingType::MOUNTAIN:    return glm::vec3(0.4f, 0.3f, 0.25f);
+    case BuildingType::PROP:        return glm::vec3(0.7f, 0.7f, 0.72f);
+    default:                        return glm::vec3(1.0f);
     }
 }
 
-Building::~Building() {
-    // nothing to free here
+const char* buildingTypeName(BuildingType type) {
+    switch (type) {
+    case BuildingType::HOUSE:       return "house";
+    case BuildingType::SHOP:        return "shop";
+    case BuildingType::SKYSCRAPER:  return "skyscraper";
+    case BuildingType::TREE:        return "tree";
+    case BuildingType::FIELD:       return "field";
+    case BuildingType::ROAD:        return "road";
+    case BuildingType::CAR:         return "car";
+    case BuildingType::MOUNTAIN:    return "mountain";
+    case BuildingType::PROP:        return "prop";
+    default:                        return "unknown";
+    }
 }
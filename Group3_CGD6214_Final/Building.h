@@ -1,7 +1,6 @@
 #ifndef BUILDING_H
 #define BUILDING_H
 
-#include "Node.h"
 #include <glm/glm.hpp>
 
 enum class BuildingType {
@@ -12,17 +11,19 @@ enum class BuildingType {
     FIELD,
     ROAD,
     CAR,
-    MOUNTAIN
+    MOUNTAIN,
+    PROP        // small fixtures on other buildings, such as roof fans
 };
 
-class Building : public Node {
-public:
-    BuildingType type;
-    glm::vec3 color;
+const int BuildingTypeCount = 9;
 
-    Building();
-    Building(const glm::vec3& position, const glm::vec3& scale, BuildingType t);
-    virtual ~Building();
+// Component: what kind of city object an entity is. Buildings are plain
+// scene nodes plus components, see BuildingFactory.
+struct BuildingInfo {
+    BuildingType type;
 };
 
+glm::vec3 buildingColor(BuildingType type);
+const char* buildingTypeName(BuildingType type);
+
 #endif // BUILDING_H
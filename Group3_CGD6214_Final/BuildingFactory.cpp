@@ -0,0 +1,50 @@
+#include "BuildingFactory.h"
+
+BuildingFactory::BuildingFactory(Scene& scene, World& world) : scene(scene), world(world) {
+    for (int i = 0; i < BuildingTypeCount; i++) {
+        BuildingArchetype& a = archetypes[i];
+        BuildingType type = (BuildingType)i;
+        a.mesh = 0;
+        a.material = type == BuildingType::FIELD ? MaterialGrass : type == BuildingType::ROAD ? MaterialRoad : MaterialFacade;
+        // Ground, roads and landmarks are never dropped; props go first.
+        a.minPixels = type == BuildingType::PROP ? 3.0f :
+                      type == BuildingType::TREE || type == BuildingType::CAR ? 2.0f :
+                      type == BuildingType::HOUSE || type == BuildingType::SHOP ? 1.0f : 0.0f;
+        a.occluder = type == BuildingType::SKYSCRAPER || type == BuildingType::SHOP ||
+                     type == BuildingType::HOUSE || type == BuildingType::MOUNTAIN;
+        a.impostor = type == BuildingType::SKYSCRAPER;
+    }
+}
+
+Entity BuildingFactory::create(NodeHandle parent, const glm::dvec3& position, const glm::vec3& scale, BuildingType type) {
+    return create(parent, position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), scale, type);
+}
+
+Entity BuildingFactory::create(NodeHandle parent, const glm::dvec3& position, const glm::quat& rotation,
+    const glm::vec3& scale, BuildingType type) {
+    const BuildingArchetype& a = archetypes[(int)type];
+    Entity e = scene.create();
+    Node* node = scene.get(e);
+    node->setPosition(position);
+    node->setRotation(rotation);
+    node->setScale(scale);
+    scene.addChild(parent, e);
+
+    BuildingInfo info = { type };
+    Color color = { buildingColor(type) };
+    Renderable renderable = { a.mesh, a.material };
+    Bounds bounds = { AABB(), a.occluder, false };
+    world.buildings.add(e, info);
+    world.colors.add(e, color);
+    world.renderables.add(e, renderable);
+    world.bounds.add(e, bounds);
+    if (a.minPixels > 0.0f) {
+        ScreenSizeCull size = { a.minPixels };
+        world.screenSizes.add(e, size);
+    }
+    if (a.impostor) {
+        ImpostorProxy proxy = { -1 };
+        world.impostors.add(e, proxy);
+    }
+    return e;
+}
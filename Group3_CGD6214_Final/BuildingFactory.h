@@ -0,0 +1,42 @@
+#ifndef BUILDINGFACTORY_H
+#define BUILDINGFACTORY_H
+
+#include <glm/glm.hpp>
+#include "Building.h"
+#include "Scene.h"
+#include "World.h"
+
+// Per-type defaults the factory stamps onto new buildings.
+struct BuildingArchetype {
+    int mesh;
+    int material;
+    float minPixels;    // screen-size cull threshold, 0 = never dropped
+    bool occluder;
+    bool impostor;
+};
+
+// Builds city objects as a scene node plus BuildingInfo, Color, Renderable
+// and Bounds components (and ScreenSizeCull and ImpostorProxy where the
+// archetype asks for them).
+class BuildingFactory {
+public:
+    // Material slots used by the default archetypes.
+    static const int MaterialGrass = 0;
+    static const int MaterialRoad = 1;
+    static const int MaterialFacade = 2;
+    static const int MaterialCount = 3;
+
+    BuildingArchetype archetypes[BuildingTypeCount];
+
+    BuildingFactory(Scene& scene, World& world);
+
+    Entity create(NodeHandle parent, const glm::dvec3& position, const glm::vec3& scale, BuildingType type);
+    Entity create(NodeHandle parent, const glm::dvec3& position, const glm::quat& rotation,
+        const glm::vec3& scale, BuildingType type);
+
+private:
+    Scene& scene;
+    World& world;
+};
+
+#endif
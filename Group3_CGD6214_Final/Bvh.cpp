@@ -0,0 +1,114 @@
+#include "Bvh.h"
+#include <algorithm>
+
+void Bvh::build(const AABB* boxes, uint32_t count, uint32_t maxLeafSize) {
+    nodes.clear();
+    items.clear();
+
+    std::vector<glm::vec3> centroids(count);
+    for (uint32_t i = 0; i < count; i++) {
+        if (boxes[i].min.x > boxes[i].max.x) continue;
+        items.push_back(i);
+        centroids[i] = boxes[i].center();
+    }
+    if (items.empty()) return;
+
+    // Until a node is processed leftFirst/count describe its item range.
+    nodes.reserve(2 * (items.size() / maxLeafSize) + 1);
+    BvhNode root;
+    root.leftFirst = 0;
+    root.count = (uint32_t)items.size();
+    nodes.push_back(root);
+
+    std::vector<uint32_t> stack(1, 0);
+    while (!stack.empty()) {
+        uint32_t index = stack.back();
+        stack.pop_back();
+        uint32_t first = nodes[index].leftFirst;
+        uint32_t n = nodes[index].count;
+
+        glm::vec3 bmin = boxes[items[first]].min, bmax = boxes[items[first]].max;
+        glm::vec3 cmin = centroids[items[first]], cmax = cmin;
+        for (uint32_t i = first + 1; i < first + n; i++) {
+            const AABB& b = boxes[items[i]];
+            bmin = glm::min(bmin, b.min);
+            bmax = glm::max(bmax, b.max);
+            cmin = glm::min(cmin, centroids[items[i]]);
+            cmax = glm::max(cmax, centroids[items[i]]);
+        }
+        nodes[index].min = bmin;
+        nodes[index].max = bmax;
+
+        glm::vec3 spread = cmax - cmin;
+        int axis = spread.x > spread.y ? (spread.x > spread.z ? 0 : 2) : (spread.y > spread.z ? 1 : 2);
+        if (n <= maxLeafSize || spread[axis] <= 0.0f) continue;
+
+        // Split at the centroid median of the longest axis.
+        uint32_t half = n / 2;
+        std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + n,
+            [&](uint32_t a, uint32_t b) { return centroids[a][axis] < centroids[b][axis]; });
+
+        uint32_t left = (uint32_t)nodes.size();
+        BvhNode child;
+        child.leftFirst = first;
+        child.count = half;
+        nodes.push_back(child);
+        child.leftFirst = first + half;
+        child.count = n - half;
+        nodes.push_back(child);
+
+        nodes[index].leftFirst = left;
+        nodes[index].count = 0;
+        stack.push_back(left);
+        stack.push_back(left + 1);
+    }
+}
+
+void Bvh::refit(const AABB* boxes) {
+    // Children come after their parent, so walking back from the end
+    // finishes both children before the parent.
+    for (size_t k = nodes.size(); k-- > 0;) {
+        BvhNode& n = nodes[k];
+        if (n.count) {
+            n.min = boxes[items[n.leftFirst]].min;
+            n.max = boxes[items[n.leftFirst]].max;
+            for (uint32_t i = n.leftFirst + 1; i < n.leftFirst + n.count; i++) {
+                n.min = glm::min(n.min, boxes[items[i]].min);
+                n.max = glm::max(n.max, boxes[items[i]].max);
+            }
+        }
+        else {
+            n.min = glm::min(nodes[n.leftFirst].min, nodes[n.leftFirst + 1].min);
+            n.max = glm::max(nodes[n.leftFirst].max, nodes[n.leftFirst + 1].max);
+        }
+    }
+}
+
+bool BvhView::validate(uint32_t itemCount, uint32_t boxCount) const {
+    // Children come after their parent, so one pass in index order sees
+    // every parent's depth before its children's.
+    std::vector<uint8_t> depth(nodeCount, 0);
+    for (uint32_t i = 0; i < nodeCount; i++) {
+        const BvhNode& n = nodes[i];
+        if (n.count) {
+            if ((uint64_t)n.leftFirst + n.count > itemCount) return false;
+            continue;
+        }
+        if (n.leftFirst <= i || (uint64_t)n.leftFirst + 1 >= nodeCount || depth[i] >= MaxDepth) return false;
+        uint8_t d = (uint8_t)(depth[i] + 1);
+        depth[n.leftFirst] = std::max(depth[n.leftFirst], d);
+        depth[n.leftFirst + 1] = std::max(depth[n.leftFirst + 1], d);
+    }
+    for (uint32_t i = 0; i < itemCount; i++) {
+        if (items[i] >= boxCount) return false;
+    }
+    return true;
+}
+
+BvhView Bvh::view() const {
+    BvhView v;
+    v.nodes = nodes.data();
+    v.items = items.data();
+    v.nodeCount = (uint32_t)nodes.size();
+    return v;
+}
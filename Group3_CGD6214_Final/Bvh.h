@@ -0,0 +1,96 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Culling.h"
+
+// Flat bounding volume hierarchy node, 32 bytes. Siblings are stored next to
+// each other, so an inner node only needs the index of its first child.
+struct BvhNode {
+    glm::vec3 min;
+    uint32_t leftFirst;     // first child for inner nodes, first item for leaves
+    glm::vec3 max;
+    uint32_t count;         // number of items in a leaf, 0 for inner nodes
+};
+
+// Read-only traversal over BVH arrays; the arrays may live in a mapped file.
+// Traversal keeps at most one pending sibling per level, so a fixed stack
+// holds any tree up to MaxDepth; Bvh::build's median splits stay far below.
+struct BvhView {
+    static const int MaxDepth = 62;
+    static const int StackSize = MaxDepth + 2;
+
+    const BvhNode* nodes;
+    const uint32_t* items;
+    uint32_t nodeCount;
+
+    BvhView() : nodes(NULL), items(NULL), nodeCount(0) {}
+
+    // For arrays from outside (a file): every child and item range in
+    // bounds, children after their parent so there are no cycles, no path
+    // deeper than MaxDepth, and every item below boxCount. O(nodes + items).
+    bool validate(uint32_t itemCount, uint32_t boxCount) const;
+
+    // Calls fn(item) for every item whose leaf box touches the frustum.
+    template<typename Fn>
+    void queryFrustum(const Frustum& frustum, Fn fn) const {
+        if (!nodeCount) return;
+        uint32_t stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BvhNode& n = nodes[stack[--top]];
+            AABB box = { n.min, n.max };
+            if (!frustum.intersects(box)) continue;
+            if (n.count) {
+                for (uint32_t i = 0; i < n.count; i++) fn(items[n.leftFirst + i]);
+            }
+            else {
+                stack[top++] = n.leftFirst;
+                stack[top++] = n.leftFirst + 1;
+            }
+        }
+    }
+
+    // Calls fn(item) for every item in a leaf overlapping box.
+    template<typename Fn>
+    void queryBox(const AABB& box, Fn fn) const {
+        if (!nodeCount) return;
+        uint32_t stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BvhNode& n = nodes[stack[--top]];
+            if (n.min.x > box.max.x || n.max.x < box.min.x ||
+                n.min.y > box.max.y || n.max.y < box.min.y ||
+                n.min.z > box.max.z || n.max.z < box.min.z) continue;
+            if (n.count) {
+                for (uint32_t i = 0; i < n.count; i++) fn(items[n.leftFirst + i]);
+            }
+            else {
+                stack[top++] = n.leftFirst;
+                stack[top++] = n.leftFirst + 1;
+            }
+        }
+    }
+};
+
+// Median-split BVH over a set of boxes, built once for static geometry.
+class Bvh {
+public:
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> items;    // indices into the boxes passed to build
+
+    // Boxes with min > max (empty) are left out.
+    void build(const AABB* boxes, uint32_t count, uint32_t maxLeafSize = 4);
+    // Recomputes node bounds from the same boxes after they moved, keeping
+    // the tree. Cheaper than build() but the tree gets looser the farther
+    // things move from where they were built.
+    void refit(const AABB* boxes);
+
+    BvhView view() const;
+};
+
+#endif
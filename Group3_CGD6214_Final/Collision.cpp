@@ -0,0 +1,279 @@
+#include "Collision.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+bool boundsOverlap(const AABB& a, const AABB& b) {
+    return a.min.x <= b.max.x && a.max.x >= b.min.x &&
+           a.min.y <= b.max.y && a.max.y >= b.min.y &&
+           a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+// Kept between a box that was slid against and the mover.
+const double skin = 1e-3;
+
+}
+
+OBB OBB::fromTransform(const Affine3x4& m) {
+    OBB box;
+    box.center = m.translation();
+    for (int i = 0; i < 3; i++) {
+        glm::vec3 axis = m.axis(i);
+        float length = glm::length(axis);
+        box.axes[i] = length > 0.0f ? axis / length : glm::vec3(i == 0, i == 1, i == 2);
+        box.halfExtents[i] = length * 0.5f;
+    }
+    return box;
+}
+
+OBB OBB::fromAABB(const AABB& b) {
+    OBB box;
+    box.center = b.center();
+    box.axes[0] = glm::vec3(1.0f, 0.0f, 0.0f);
+    box.axes[1] = glm::vec3(0.0f, 1.0f, 0.0f);
+    box.axes[2] = glm::vec3(0.0f, 0.0f, 1.0f);
+    box.halfExtents = b.extent();
+    return box;
+}
+
+AABB OBB::bounds() const {
+    glm::vec3 extent = glm::abs(axes[0]) * halfExtents.x + glm::abs(axes[1]) * halfExtents.y +
+        glm::abs(axes[2]) * halfExtents.z;
+    AABB box;
+    box.min = center - extent;
+    box.max = center + extent;
+    return box;
+}
+
+// Gottschalk's test in a's frame. The epsilon keeps near-parallel edge
+// pairs, whose cross product is close to zero, from reporting a gap.
+bool overlaps(const OBB& a, const OBB& b) {
+    float r[3][3], absR[3][3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            r[i][j] = glm::dot(a.axes[i], b.axes[j]);
+            absR[i][j] = std::fabs(r[i][j]) + 1e-6f;
+        }
+    }
+    glm::vec3 d = b.center - a.center;
+    float t[3] = { glm::dot(d, a.axes[0]), glm::dot(d, a.axes[1]), glm::dot(d, a.axes[2]) };
+    const glm::vec3& ea = a.halfExtents;
+    const glm::vec3& eb = b.halfExtents;
+
+    for (int i = 0; i < 3; i++) {
+        float rb = eb.x * absR[i][0] + eb.y * absR[i][1] + eb.z * absR[i][2];
+        if (std::fabs(t[i]) > ea[i] + rb) return false;
+    }
+    for (int j = 0; j < 3; j++) {
+        float ra = ea.x * absR[0][j] + ea.y * absR[1][j] + ea.z * absR[2][j];
+        if (std::fabs(t[0] * r[0][j] + t[1] * r[1][j] + t[2] * r[2][j]) > ra + eb[j]) return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; j++) {
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            float ra = ea[i1] * absR[i2][j] + ea[i2] * absR[i1][j];
+            float rb = eb[j1] * absR[i][j2] + eb[j2] * absR[i][j1];
+            if (std::fabs(t[i2] * r[i1][j] - t[i1] * r[i2][j]) > ra + rb) return false;
+        }
+    }
+    return true;
+}
+
+CollisionWorld::CollisionWorld(ThreadPool& pool)
+    : pool(pool), cellSize(1.0f), cellMask(0), lastPairsMs(0.0) {}
+
+void CollisionWorld::setStatic(const std::vector<OBB>& boxes, const std::vector<uint32_t>& layers) {
+    staticBoxes = boxes;
+    staticLayers = layers;
+    staticLayers.resize(staticBoxes.size(), 0);
+    uint32_t used = 0;
+    for (uint32_t l : staticLayers) used |= l;
+    layerBvh.clear();
+    // Boxes outside a layer are left empty, which Bvh::build skips, so
+    // items stay indices into staticBoxes.
+    std::vector<AABB> bounds(staticBoxes.size());
+    for (int bit = 0; bit < 32 && (used >> bit); bit++) {
+        layerBvh.push_back(Bvh());
+        if (!(used & (1u << bit))) continue;
+        for (size_t i = 0; i < staticBoxes.size(); i++) {
+            if (staticLayers[i] & (1u << bit)) {
+                bounds[i] = staticBoxes[i].bounds();
+            }
+            else {
+                bounds[i].min = glm::vec3(1.0f);
+                bounds[i].max = glm::vec3(-1.0f);
+            }
+        }
+        layerBvh.back().build(bounds.data(), (uint32_t)bounds.size());
+    }
+}
+
+// Each static box in layers whose BVH leaf touches box, once even when it is
+// in several of them.
+template<typename Fn>
+void CollisionWorld::queryStatic(const AABB& box, uint32_t layers, Fn fn) const {
+    for (int bit = 0; bit < (int)layerBvh.size(); bit++) {
+        if (!(layers & (1u << bit))) continue;
+        uint32_t earlier = layers & ((1u << bit) - 1);
+        layerBvh[bit].view().queryBox(box, [&](uint32_t s) {
+            if (!(staticLayers[s] & earlier)) fn(s);
+        });
+    }
+}
+
+uint32_t CollisionWorld::cellKey(int cx, int cz) const {
+    return (((uint32_t)cx * 73856093u) ^ ((uint32_t)cz * 19349663u)) & cellMask;
+}
+
+void CollisionWorld::setDynamic(const std::vector<OBB>& boxes) {
+    dynamicBoxes = boxes;
+    size_t n = boxes.size();
+    dynamicBounds.resize(n);
+    float largest = 0.0f;
+    for (size_t i = 0; i < n; i++) {
+        dynamicBounds[i] = boxes[i].bounds();
+        largest = std::max(largest, glm::length(boxes[i].halfExtents));
+    }
+    cellSize = std::max(2.0f * largest, 1e-3f);
+
+    // Counting sort by cell, about two cells per box.
+    uint32_t cells = 64;
+    while (cells < n * 2) cells <<= 1;
+    cellMask = cells - 1;
+    cellStart.assign(cells + 1, 0);
+    std::vector<uint32_t> cellOf(n);
+    for (size_t i = 0; i < n; i++) {
+        const glm::vec3& c = boxes[i].center;
+        cellOf[i] = cellKey((int)std::floor(c.x / cellSize), (int)std::floor(c.z / cellSize));
+        cellStart[cellOf[i] + 1]++;
+    }
+    for (uint32_t c = 0; c < cells; c++) cellStart[c + 1] += cellStart[c];
+    std::vector<uint32_t> cursor(cellStart.begin(), cellStart.end() - 1);
+    cellItems.resize(n);
+    for (size_t i = 0; i < n; i++) cellItems[cursor[cellOf[i]]++] = (uint32_t)i;
+}
+
+void CollisionWorld::pairsFor(uint32_t i, uint32_t layers, std::vector<CollisionPair>& out) const {
+    const OBB& box = dynamicBoxes[i];
+    const AABB& bounds = dynamicBounds[i];
+    queryStatic(bounds, layers, [&](uint32_t s) {
+        if (overlaps(box, staticBoxes[s])) out.push_back(CollisionPair{ i, s, true });
+    });
+
+    // Only boxes after i, so each pair is found once.
+    int cx = (int)std::floor(box.center.x / cellSize), cz = (int)std::floor(box.center.z / cellSize);
+    uint32_t seen[9];
+    int seenCount = 0;
+    for (int dz = -1; dz <= 1; dz++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            uint32_t c = cellKey(cx + dx, cz + dz);
+            // Distant cells can hash to the same slot; visit it once.
+            if (std::find(seen, seen + seenCount, c) != seen + seenCount) continue;
+            seen[seenCount++] = c;
+            for (uint32_t k = cellStart[c]; k < cellStart[c + 1]; k++) {
+                uint32_t j = cellItems[k];
+                if (j <= i || !boundsOverlap(bounds, dynamicBounds[j])) continue;
+                if (overlaps(box, dynamicBoxes[j])) out.push_back(CollisionPair{ i, j, false });
+            }
+        }
+    }
+}
+
+void CollisionWorld::findPairs(uint32_t layers, std::vector<CollisionPair>& out) const {
+    auto start = std::chrono::high_resolution_clock::now();
+    out.clear();
+    size_t n = dynamicBoxes.size();
+    int chunks = (int)std::min(n, (size_t)pool.size() * 8);
+    if (chunks > 0) {
+        chunkPairs.resize(chunks);
+        pool.parallelFor(chunks, [&](int chunk) {
+            std::vector<CollisionPair>& pairs = chunkPairs[chunk];
+            pairs.clear();
+            size_t end = n * (chunk + 1) / chunks;
+            for (size_t i = n * chunk / chunks; i < end; i++) pairsFor((uint32_t)i, layers, pairs);
+        });
+        for (int c = 0; c < chunks; c++) out.insert(out.end(), chunkPairs[c].begin(), chunkPairs[c].end());
+    }
+    lastPairsMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool CollisionWorld::sweep(const glm::vec3& from, const glm::vec3& to, float radius, uint32_t layers, SweepHit& hit) const {
+    glm::vec3 move = to - from;
+    AABB swept;
+    swept.min = glm::min(from, to) - glm::vec3(radius);
+    swept.max = glm::max(from, to) + glm::vec3(radius);
+
+    hit.t = 2.0f;
+    queryStatic(swept, layers, [&](uint32_t s) {
+        // Slabs of the box grown by radius, with the move in its frame.
+        const OBB& box = staticBoxes[s];
+        glm::vec3 offset = from - box.center;
+        float origin[3], direction[3], half[3];
+        bool inside = true;
+        for (int k = 0; k < 3; k++) {
+            origin[k] = glm::dot(offset, box.axes[k]);
+            direction[k] = glm::dot(move, box.axes[k]);
+            half[k] = box.halfExtents[k] + radius;
+            inside = inside && std::fabs(origin[k]) < half[k];
+        }
+        if (inside) {
+            // Already closer than radius (a corner slide can leave it so):
+            // blocked at once unless moving out through the nearest face.
+            int face = 0;
+            for (int k = 1; k < 3; k++) {
+                if (half[k] - std::fabs(origin[k]) < half[face] - std::fabs(origin[face])) face = k;
+            }
+            float outward = origin[face] < 0.0f ? -1.0f : 1.0f;
+            if (direction[face] * outward >= -1e-6f || hit.t <= 0.0f) return;
+            hit.t = 0.0f;
+            hit.normal = box.axes[face] * outward;
+            hit.item = s;
+            return;
+        }
+        float enter = -1e30f, exit = 1e30f;
+        int enterAxis = -1;
+        float enterSign = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            if (std::fabs(direction[k]) < 1e-12f) {
+                if (std::fabs(origin[k]) > half[k]) return;
+                continue;
+            }
+            float t0 = (-half[k] - origin[k]) / direction[k], t1 = (half[k] - origin[k]) / direction[k];
+            if (t0 > t1) std::swap(t0, t1);
+            if (t0 > enter) {
+                enter = t0;
+                enterAxis = k;
+                enterSign = direction[k] > 0.0f ? -1.0f : 1.0f;
+            }
+            exit = std::min(exit, t1);
+            if (enter > exit) return;
+        }
+        if (enterAxis < 0 || enter < 0.0f || enter > 1.0f || enter >= hit.t) return;
+        hit.t = enter;
+        hit.normal = box.axes[enterAxis] * enterSign;
+        hit.item = s;
+    });
+    return hit.t <= 1.0f;
+}
+
+glm::dvec3 CollisionWorld::slide(const glm::dvec3& from, const glm::dvec3& to, float radius, uint32_t layers) const {
+    glm::dvec3 position = from;
+    glm::dvec3 remaining = to - from;
+    // Three is enough to settle into a corner between two walls and a floor.
+    for (int i = 0; i < 3; i++) {
+        if (glm::dot(remaining, remaining) <= 1e-12) break;
+        SweepHit hit;
+        if (!sweep(glm::vec3(position), glm::vec3(position + remaining), radius, layers, hit)) {
+            position += remaining;
+            break;
+        }
+        glm::dvec3 normal(hit.normal);
+        position += remaining * (double)hit.t + normal * skin;
+        remaining *= 1.0 - hit.t;
+        remaining -= normal * glm::dot(remaining, normal);
+    }
+    return position;
+}
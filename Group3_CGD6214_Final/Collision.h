@@ -0,0 +1,105 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Affine.h"
+#include "Bvh.h"
+#include "Culling.h"
+#include "ThreadPool.h"
+
+// Oriented box: unit axes and the half size along each.
+struct OBB {
+    glm::vec3 center;
+    glm::vec3 axes[3];
+    glm::vec3 halfExtents;
+
+    // The unit cube [-0.5, 0.5]^3 (the shared building mesh) after transform.
+    static OBB fromTransform(const Affine3x4& m);
+    static OBB fromAABB(const AABB& box);
+    AABB bounds() const;
+};
+
+// Separating axis test over the 15 candidate axes.
+bool overlaps(const OBB& a, const OBB& b);
+
+// a is always a dynamic box; b is another dynamic box or a static one.
+struct CollisionPair {
+    uint32_t a, b;
+    bool isStatic;
+};
+
+struct SweepHit {
+    float t;                // along the move, 0 to 1
+    glm::vec3 normal;       // of the face hit, pointing back at the mover
+    uint32_t item;
+};
+
+// Bits in a static box's layers; queries pass the bits they care about.
+enum CollisionLayer {
+    CollideGround = 1,      // fields and roads, which cars sit on
+    CollideSolid = 2        // buildings
+};
+
+// Collision between moving boxes and the static city. The static side is
+// an oriented box and layer bits per item, with a BVH per layer: the
+// culling BVH mixes buildings with roads spanning the whole city, whose
+// bounds make every query for buildings walk most of the tree. The dynamic
+// side is a loose grid rebuilt from scratch each time: every box goes into
+// the one cell holding its centre, and cells are twice the largest box's
+// bounding radius, so two boxes that touch are in the same or neighbouring
+// cells. Cells are hashed, as in Crowd.
+//
+// findPairs() is parallel over the dynamic boxes: each looks up static
+// boxes through the layers' BVHs and the dynamic ones after it in the
+// 3 x 3 cells around its own, rejects on bounds, then runs the oriented
+// test. Chunks are joined in order, so the pairs come out the same every
+// run.
+//
+// sweep() and slide() move a box of half size radius through the static
+// boxes for the camera: the move is a ray against each candidate grown by
+// radius, in the candidate's own frame.
+class CollisionWorld {
+public:
+    explicit CollisionWorld(ThreadPool& pool);
+
+    // Pairs and hits name static boxes by their index here.
+    void setStatic(const std::vector<OBB>& boxes, const std::vector<uint32_t>& layers);
+    void setDynamic(const std::vector<OBB>& boxes);
+
+    void findPairs(uint32_t staticLayers, std::vector<CollisionPair>& out) const;
+
+    // First static box in layers the move from..to runs into.
+    bool sweep(const glm::vec3& from, const glm::vec3& to, float radius, uint32_t layers, SweepHit& hit) const;
+    // Moves as far as it can, sliding along whatever it hits.
+    glm::dvec3 slide(const glm::dvec3& from, const glm::dvec3& to, float radius, uint32_t layers) const;
+
+    size_t staticCount() const { return staticBoxes.size(); }
+    size_t dynamicCount() const { return dynamicBoxes.size(); }
+    double pairsMs() const { return lastPairsMs; }
+
+private:
+    ThreadPool& pool;
+
+    std::vector<OBB> staticBoxes;
+    std::vector<uint32_t> staticLayers;
+    std::vector<Bvh> layerBvh;          // by layer bit
+
+    std::vector<OBB> dynamicBoxes;
+    std::vector<AABB> dynamicBounds;
+    float cellSize;
+    uint32_t cellMask;
+    std::vector<uint32_t> cellStart;    // one more than there are cells
+    std::vector<uint32_t> cellItems;
+
+    mutable std::vector<std::vector<CollisionPair>> chunkPairs;
+    mutable double lastPairsMs;
+
+    template<typename Fn>
+    void queryStatic(const AABB& box, uint32_t layers, Fn fn) const;
+    uint32_t cellKey(int cx, int cz) const;
+    void pairsFor(uint32_t i, uint32_t layers, std::vector<CollisionPair>& out) const;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "NodeHandle.h"
+
+// An entity is a scene node; components are attached to its handle.
+typedef NodeHandle Entity;
+
+// Sparse set keyed by entity. Components are packed densely (swap-remove on
+// delete) so systems iterate them as a plain array; entity lookups go through
+// a table indexed by the handle's slot.
+template<typename T>
+class ComponentArray {
+public:
+    T& add(Entity e, const T& value) {
+        uint32_t i = find(e);
+        if (i != Invalid) {
+            dense[i] = value;
+            return dense[i];
+        }
+        uint32_t slot = e.index();
+        if (slot >= sparse.size()) sparse.resize(slot + 1, Invalid);
+        sparse[slot] = (uint32_t)dense.size();
+        dense.push_back(value);
+        owners.push_back(e);
+        return dense.back();
+    }
+
+    void remove(Entity e) {
+        uint32_t i = find(e);
+        if (i == Invalid) return;
+        uint32_t last = (uint32_t)dense.size() - 1;
+        dense[i] = dense[last];
+        owners[i] = owners[last];
+        sparse[owners[i].index()] = i;
+        sparse[e.index()] = Invalid;
+        dense.pop_back();
+        owners.pop_back();
+    }
+
+    T* get(Entity e) {
+        uint32_t i = find(e);
+        return i == Invalid ? NULL : &dense[i];
+    }
+    const T* get(Entity e) const {
+        uint32_t i = find(e);
+        return i == Invalid ? NULL : &dense[i];
+    }
+    bool has(Entity e) const { return find(e) != Invalid; }
+
+    size_t size() const { return dense.size(); }
+    T& operator[](size_t i) { return dense[i]; }
+    const T& operator[](size_t i) const { return dense[i]; }
+    Entity entity(size_t i) const { return owners[i]; }
+    // Dense index of e's component, or size() if it has none.
+    size_t indexOf(Entity e) const {
+        uint32_t i = find(e);
+        return i == Invalid ? dense.size() : i;
+    }
+
+private:
+    static const uint32_t Invalid = 0xFFFFFFFFu;
+
+    std::vector<T> dense;
+    std::vector<Entity> owners;
+    std::vector<uint32_t> sparse;
+
+    uint32_t find(Entity e) const {
+        uint32_t slot = e.index();
+        if (e.isNull() || slot >= sparse.size()) return Invalid;
+        uint32_t i = sparse[slot];
+        return i != Invalid && owners[i] == e ? i : Invalid;
+    }
+};
+
+template<typename T>
+const uint32_t ComponentArray<T>::Invalid;
+
+struct Color {
+    glm::vec3 value;
+};
+
+// vao must have the renderer's InstanceBuffer attached (model rows at 3-5).
+struct Mesh {
+    unsigned int vao;
+    int vertexCount;
+};
+
+struct Material {
+    unsigned int texture;
+};
+
+// Indices into World::meshes and World::materials.
+struct Renderable {
+    int mesh;
+    int material;
+};
+
+// World-space box plus what the culling passes need to know about it.
+struct Bounds {
+    AABB box;
+    bool occluder;      // solid enough to hide what is behind it
+    bool streamed;      // part of a streamed tile, culled through its BVH
+};
+
+// Dropped by screen-size culling once it projects smaller than this; entities
+// without one are never dropped.
+struct ScreenSizeCull {
+    float minPixels;
+};
+
+// Drawn through the ImpostorSystem when far away.
+struct ImpostorProxy {
+    int archetype;
+};
+
+#endif
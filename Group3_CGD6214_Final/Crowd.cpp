@@ -0,0 +1,323 @@
+#include "Crowd.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CROWD_SSE2 1
+#endif
+
+namespace {
+
+struct Push {
+    float range;            // neighbourRadius
+    float range2;
+    float separation;       // over range
+    float contact2;         // (2 radius)^2
+    float avoidance;        // over horizon
+    float horizon;
+};
+
+// Separation from every neighbour within range, plus a push away from where
+// each one would be closest over the horizon if both kept their velocity.
+// The agent itself is among the neighbours and drops out at distance zero.
+void neighbourForces(const Push& p, float px, float pz, float pvx, float pvz,
+    const float* sx, const float* sz, const float* svx, const float* svz, size_t n, float& fx, float& fz) {
+    size_t j = 0;
+#ifdef CROWD_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 tiny = _mm_set1_ps(1e-6f);
+    const __m128 soft = _mm_set1_ps(1e-4f);
+    const __m128 range = _mm_set1_ps(p.range);
+    const __m128 range2 = _mm_set1_ps(p.range2);
+    const __m128 separation = _mm_set1_ps(p.separation);
+    const __m128 contact2 = _mm_set1_ps(p.contact2);
+    const __m128 avoidance = _mm_set1_ps(p.avoidance);
+    const __m128 horizon = _mm_set1_ps(p.horizon);
+    const __m128 x = _mm_set1_ps(px), z = _mm_set1_ps(pz);
+    const __m128 vx = _mm_set1_ps(pvx), vz = _mm_set1_ps(pvz);
+    __m128 sumX = zero, sumZ = zero;
+    for (; j + 4 <= n; j += 4) {
+        __m128 dx = _mm_sub_ps(x, _mm_loadu_ps(sx + j));
+        __m128 dz = _mm_sub_ps(z, _mm_loadu_ps(sz + j));
+        __m128 d2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz));
+        __m128 near = _mm_and_ps(_mm_cmpgt_ps(d2, tiny), _mm_cmplt_ps(d2, range2));
+        if (_mm_movemask_ps(near) == 0) continue;
+        __m128 invD = _mm_rsqrt_ps(_mm_max_ps(d2, tiny));
+        __m128 d = _mm_mul_ps(d2, invD);
+        __m128 w = _mm_and_ps(near, _mm_mul_ps(_mm_mul_ps(separation, _mm_sub_ps(range, d)), invD));
+        sumX = _mm_add_ps(sumX, _mm_mul_ps(dx, w));
+        sumZ = _mm_add_ps(sumZ, _mm_mul_ps(dz, w));
+
+        __m128 dvx = _mm_sub_ps(vx, _mm_loadu_ps(svx + j));
+        __m128 dvz = _mm_sub_ps(vz, _mm_loadu_ps(svz + j));
+        __m128 dvv = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dvx, dvx), _mm_mul_ps(dvz, dvz)), soft);
+        __m128 approach = _mm_add_ps(_mm_mul_ps(dx, dvx), _mm_mul_ps(dz, dvz));
+        __m128 t = _mm_min_ps(_mm_max_ps(_mm_div_ps(_mm_sub_ps(zero, approach), dvv), zero), horizon);
+        __m128 cx = _mm_add_ps(dx, _mm_mul_ps(dvx, t));
+        __m128 cz = _mm_add_ps(dz, _mm_mul_ps(dvz, t));
+        __m128 c2 = _mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cz, cz));
+        __m128 hit = _mm_and_ps(near, _mm_cmplt_ps(c2, contact2));
+        __m128 wa = _mm_mul_ps(_mm_mul_ps(avoidance, _mm_sub_ps(horizon, t)), _mm_rsqrt_ps(_mm_add_ps(c2, soft)));
+        wa = _mm_and_ps(hit, wa);
+        sumX = _mm_add_ps(sumX, _mm_mul_ps(cx, wa));
+        sumZ = _mm_add_ps(sumZ, _mm_mul_ps(cz, wa));
+    }
+    float lanesX[4], lanesZ[4];
+    _mm_storeu_ps(lanesX, sumX);
+    _mm_storeu_ps(lanesZ, sumZ);
+    fx += lanesX[0] + lanesX[1] + lanesX[2] + lanesX[3];
+    fz += lanesZ[0] + lanesZ[1] + lanesZ[2] + lanesZ[3];
+#endif
+    for (; j < n; j++) {
+        float dx = px - sx[j], dz = pz - sz[j];
+        float d2 = dx * dx + dz * dz;
+        if (d2 <= 1e-6f || d2 >= p.range2) continue;
+        float d = std::sqrt(d2);
+        float w = p.separation * (p.range - d) / d;
+        fx += dx * w;
+        fz += dz * w;
+
+        float dvx = pvx - svx[j], dvz = pvz - svz[j];
+        float dvv = dvx * dvx + dvz * dvz + 1e-4f;
+        float t = std::min(std::max(-(dx * dvx + dz * dvz) / dvv, 0.0f), p.horizon);
+        float cx = dx + dvx * t, cz = dz + dvz * t;
+        float c2 = cx * cx + cz * cz;
+        if (c2 >= p.contact2) continue;
+        float wa = p.avoidance * (p.horizon - t) / std::sqrt(c2 + 1e-4f);
+        fx += cx * wa;
+        fz += cz * wa;
+    }
+}
+
+uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+float unitRandom(uint32_t& state) {
+    return (nextRandom(state) >> 8) * (1.0f / 16777216.0f);
+}
+
+}
+
+Crowd::Crowd(const RoadNetwork& network, ThreadPool& pool)
+    : network(network), pool(pool), cellMask(0), lastTickMs(0.0) {}
+
+// Contiguous runs of [0, count), a few per thread.
+template<typename Fn>
+void Crowd::forEachChunk(size_t count, Fn fn) const {
+    int chunks = (int)std::min(count, (size_t)pool.size() * 8);
+    if (chunks <= 0) return;
+    pool.parallelFor(chunks, [&](int chunk) {
+        fn(count * chunk / chunks, count * (chunk + 1) / chunks);
+    });
+}
+
+uint32_t Crowd::cellKey(float px, float pz) const {
+    int cx = (int)std::floor(px / settings.neighbourRadius);
+    int cz = (int)std::floor(pz / settings.neighbourRadius);
+    return (((uint32_t)cx * 73856093u) ^ ((uint32_t)cz * 19349663u)) & cellMask;
+}
+
+void Crowd::spawn(int count, uint32_t seed) {
+    if (network.edges.empty() || count <= 0) return;
+    uint32_t state = seed * 0x9E3779B9u + 1;
+    for (int k = 0; k < count; k++) {
+        const RoadEdge& e = network.edges[k % network.edges.size()];
+        float side = e.lanes * e.laneWidth + settings.sidewalkOffset + (unitRandom(state) - 0.5f) * settings.sidewalkWidth;
+        glm::vec3 p = e.start + e.direction * (unitRandom(state) * e.length) + e.right * side;
+        float v = settings.walkingSpeed * (1.0f + settings.speedVariation * (unitRandom(state) * 2.0f - 1.0f));
+        x.push_back(p.x);
+        z.push_back(p.z);
+        vx.push_back(e.direction.x * v * 0.5f);
+        vz.push_back(e.direction.z * v * 0.5f);
+        y.push_back(e.start.y + settings.height * 0.5f);
+        speed.push_back(v);
+        lateral.push_back(side);
+        edge.push_back(k % (int)network.edges.size());
+        uint32_t r = state ^ ((uint32_t)k * 0x85EBCA6Bu);
+        random.push_back(r ? r : 1);
+    }
+    size_t n = x.size();
+    previousX = x;
+    previousZ = z;
+    ax.assign(n, 0.0f);
+    az.assign(n, 0.0f);
+
+    // About two cells per agent keeps most cells to one or two people.
+    uint32_t cells = 1024;
+    while (cells < n * 2) cells <<= 1;
+    cellMask = cells - 1;
+    cellCount.reset(new std::atomic<uint32_t>[cells]);
+    for (uint32_t c = 0; c < cells; c++) cellCount[c].store(0, std::memory_order_relaxed);
+    cellStart.assign(cells + 1, 0);
+    cellOf.resize(n);
+    sorted.resize(n);
+    sortedX.resize(n);
+    sortedZ.resize(n);
+    sortedVX.resize(n);
+    sortedVZ.resize(n);
+}
+
+void Crowd::buildGrid() {
+    size_t n = x.size();
+    forEachChunk(n, [this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t c = cellKey(x[i], z[i]);
+            cellOf[i] = c;
+            cellCount[c].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    // Offsets; the counts go back to zero and become the scatter cursors.
+    uint32_t cells = cellMask + 1, running = 0;
+    for (uint32_t c = 0; c < cells; c++) {
+        cellStart[c] = running;
+        running += cellCount[c].load(std::memory_order_relaxed);
+        cellCount[c].store(0, std::memory_order_relaxed);
+    }
+    cellStart[cells] = running;
+    forEachChunk(n, [this](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t c = cellOf[i];
+            sorted[cellStart[c] + cellCount[c].fetch_add(1, std::memory_order_relaxed)] = (uint32_t)i;
+        }
+    });
+    // Scatter order within a cell depends on the threads; sort it away, then
+    // lay the cell's agents out next to each other.
+    forEachChunk(cells, [this](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            cellCount[c].store(0, std::memory_order_relaxed);
+            uint32_t first = cellStart[c], last = cellStart[c + 1];
+            if (last - first > 1) std::sort(sorted.begin() + first, sorted.begin() + last);
+            for (uint32_t k = first; k < last; k++) {
+                uint32_t i = sorted[k];
+                sortedX[k] = x[i];
+                sortedZ[k] = z[i];
+                sortedVX[k] = vx[i];
+                sortedVZ[k] = vz[i];
+            }
+        }
+    });
+}
+
+void Crowd::steer(size_t begin, size_t end) {
+    Push push;
+    push.range = settings.neighbourRadius;
+    push.range2 = push.range * push.range;
+    push.separation = settings.separation / push.range;
+    push.contact2 = 4.0f * settings.radius * settings.radius;
+    push.avoidance = settings.avoidance / settings.avoidanceHorizon;
+    push.horizon = settings.avoidanceHorizon;
+    float invCell = 1.0f / settings.neighbourRadius;
+
+    for (size_t i = begin; i < end; i++) {
+        // Aim a little ahead along the sidewalk from the closest point on it.
+        const RoadEdge& e = network.edges[edge[i]];
+        float startX = e.start.x + e.right.x * lateral[i], startZ = e.start.z + e.right.z * lateral[i];
+        float s = (x[i] - startX) * e.direction.x + (z[i] - startZ) * e.direction.z;
+        float ahead = std::min(std::max(s, 0.0f) + settings.lookAhead, e.length);
+        float tx = startX + e.direction.x * ahead - x[i], tz = startZ + e.direction.z * ahead - z[i];
+        float length = std::sqrt(tx * tx + tz * tz);
+        float desired = length > 1e-3f ? speed[i] / length : 0.0f;
+        float fx = (tx * desired - vx[i]) / settings.relaxationTime;
+        float fz = (tz * desired - vz[i]) / settings.relaxationTime;
+
+        int cx = (int)std::floor(x[i] * invCell), cz = (int)std::floor(z[i] * invCell);
+        uint32_t seen[9];
+        int seenCount = 0;
+        for (int dz = -1; dz <= 1; dz++) {
+            for (int dx = -1; dx <= 1; dx++) {
+                uint32_t c = (((uint32_t)(cx + dx) * 73856093u) ^ ((uint32_t)(cz + dz) * 19349663u)) & cellMask;
+                // Distant cells can hash to the same slot; visit it once.
+                if (std::find(seen, seen + seenCount, c) != seen + seenCount) continue;
+                seen[seenCount++] = c;
+                uint32_t first = cellStart[c], count = cellStart[c + 1] - first;
+                if (count == 0) continue;
+                neighbourForces(push, x[i], z[i], vx[i], vz[i], &sortedX[first], &sortedZ[first],
+                    &sortedVX[first], &sortedVZ[first], count, fx, fz);
+            }
+        }
+        ax[i] = fx;
+        az[i] = fz;
+    }
+}
+
+void Crowd::move(size_t begin, size_t end, float dt) {
+    for (size_t i = begin; i < end; i++) {
+        previousX[i] = x[i];
+        previousZ[i] = z[i];
+        float nvx = vx[i] + ax[i] * dt, nvz = vz[i] + az[i] * dt;
+        float v2 = nvx * nvx + nvz * nvz;
+        if (v2 > settings.maxSpeed * settings.maxSpeed) {
+            float scale = settings.maxSpeed / std::sqrt(v2);
+            nvx *= scale;
+            nvz *= scale;
+        }
+        vx[i] = nvx;
+        vz[i] = nvz;
+        x[i] += nvx * dt;
+        z[i] += nvz * dt;
+
+        // Round the corner onto the next sidewalk once level with the
+        // crossing road's.
+        const RoadEdge& e = network.edges[edge[i]];
+        float s = (x[i] - e.start.x) * e.direction.x + (z[i] - e.start.z) * e.direction.z;
+        if (s < e.length - lateral[i]) continue;
+        const std::vector<int>& exits = network.nodes[e.to].outgoing;
+        int choices = (int)exits.size() - 1;
+        int next = e.reverse;
+        if (choices > 0) {
+            int k = (int)(nextRandom(random[i]) % (uint32_t)choices);
+            for (int exit : exits) {
+                if (exit == e.reverse) continue;
+                if (k-- == 0) {
+                    next = exit;
+                    break;
+                }
+            }
+        }
+        enterEdge(i, next);
+    }
+}
+
+void Crowd::enterEdge(size_t agent, int next) {
+    edge[agent] = next;
+    y[agent] = network.edges[next].start.y + settings.height * 0.5f;
+}
+
+void Crowd::tick(float dt) {
+    if (x.empty() || dt <= 0.0f) return;
+    auto start = std::chrono::high_resolution_clock::now();
+    buildGrid();
+    forEachChunk(x.size(), [this](size_t begin, size_t end) { steer(begin, end); });
+    forEachChunk(x.size(), [this, dt](size_t begin, size_t end) { move(begin, end, dt); });
+    lastTickMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void Crowd::gatherVisible(const Frustum& frustum, const glm::vec3& eye, float maxDistance, float alpha,
+    std::vector<glm::vec3>& out) const {
+    out.clear();
+    size_t n = x.size();
+    int chunks = (int)std::min(n, (size_t)pool.size() * 8);
+    if (chunks <= 0) return;
+    visibleChunks.resize(chunks);
+    glm::vec3 half(settings.radius, settings.height * 0.5f, settings.radius);
+    float max2 = maxDistance * maxDistance;
+    pool.parallelFor(chunks, [&](int chunk) {
+        std::vector<glm::vec3>& found = visibleChunks[chunk];
+        found.clear();
+        size_t end = n * (chunk + 1) / chunks;
+        for (size_t i = n * chunk / chunks; i < end; i++) {
+            glm::vec3 p(previousX[i] + (x[i] - previousX[i]) * alpha, y[i], previousZ[i] + (z[i] - previousZ[i]) * alpha);
+            float dx = p.x - eye.x, dz = p.z - eye.z;
+            if (dx * dx + dz * dz > max2) continue;
+            AABB box = { p - half, p + half };
+            if (frustum.intersects(box)) found.push_back(p);
+        }
+    });
+    for (const std::vector<glm::vec3>& found : visibleChunks)
+        out.insert(out.end(), found.begin(), found.end());
+}
@@ -0,0 +1,97 @@
+#ifndef CROWD_H
+#define CROWD_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "RoadNetwork.h"
+#include "ThreadPool.h"
+
+struct CrowdSettings {
+    float radius;               // personal space, people closer than twice this collide
+    float neighbourRadius;      // how far separation and avoidance look, also the grid cell size
+    float walkingSpeed;         // mean; each agent differs by up to speedVariation of it
+    float speedVariation;
+    float maxSpeed;
+    float sidewalkOffset;       // from the road's edge to the middle of the sidewalk
+    float sidewalkWidth;        // agents spread across this
+    float lookAhead;            // how far along the sidewalk agents aim
+    float relaxationTime;       // seconds to settle on the desired velocity
+    float separation;           // push at zero distance, fading out at neighbourRadius
+    float avoidance;            // push away from a predicted collision
+    float avoidanceHorizon;     // seconds of prediction
+    float height;
+
+    CrowdSettings() : radius(0.3f), neighbourRadius(1.5f), walkingSpeed(1.4f), speedVariation(0.2f), maxSpeed(2.5f),
+        sidewalkOffset(2.0f), sidewalkWidth(2.0f), lookAhead(2.0f), relaxationTime(0.5f), separation(4.0f),
+        avoidance(2.0f), avoidanceHorizon(2.0f), height(1.7f) {}
+};
+
+// Pedestrians walking the sidewalks beside a RoadNetwork's roads. Each walks
+// the right-hand side of an edge and at its end picks an exit at random,
+// like the cars do without a planner.
+//
+// Every tick the agents are hashed into a uniform grid with a parallel
+// counting sort: cells counted with atomics, offsets from a prefix sum, then
+// a scatter and a per-cell sort by index so the result does not depend on
+// the threads. Positions and velocities are copied in cell order, so the
+// neighbours in a cell are contiguous and separation plus avoidance run over
+// them four at a time with SSE. Steering and integration are parallel over
+// agents; each writes only its own state.
+class Crowd {
+public:
+    CrowdSettings settings;
+
+    Crowd(const RoadNetwork& network, ThreadPool& pool);
+
+    // Spreads count agents over the sidewalks; call once.
+    void spawn(int count, uint32_t seed);
+    void tick(float dt);
+
+    // Centres of the agents inside the frustum and within maxDistance of
+    // eye, blended from before to after the last tick by alpha.
+    void gatherVisible(const Frustum& frustum, const glm::vec3& eye, float maxDistance, float alpha,
+        std::vector<glm::vec3>& out) const;
+
+    int agentCount() const { return (int)x.size(); }
+    double tickMs() const { return lastTickMs; }
+
+private:
+    const RoadNetwork& network;
+    ThreadPool& pool;
+
+    // Per agent.
+    std::vector<float> x, z, vx, vz;
+    std::vector<float> previousX, previousZ;
+    std::vector<float> y;
+    std::vector<float> speed;
+    std::vector<float> lateral;     // distance from the edge's centreline
+    std::vector<float> ax, az;
+    std::vector<int> edge;
+    std::vector<uint32_t> random;
+
+    // Grid, rebuilt each tick. cellStart has one more entry than there are
+    // cells; agents of cell c are sorted[cellStart[c], cellStart[c + 1]).
+    uint32_t cellMask;
+    std::unique_ptr<std::atomic<uint32_t>[]> cellCount;
+    std::vector<uint32_t> cellStart;
+    std::vector<uint32_t> cellOf;
+    std::vector<uint32_t> sorted;
+    std::vector<float> sortedX, sortedZ, sortedVX, sortedVZ;
+
+    mutable std::vector<std::vector<glm::vec3>> visibleChunks;
+    double lastTickMs;
+
+    template<typename Fn>
+    void forEachChunk(size_t count, Fn fn) const;
+    uint32_t cellKey(float px, float pz) const;
+    void buildGrid();
+    void steer(size_t begin, size_t end);
+    void move(size_t begin, size_t end, float dt);
+    void enterEdge(size_t agent, int next);
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "Culling.h"
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+
+AABB transformUnitCube(const Affine3x4& m) {
+    glm::vec3 center = m.translation();
+    glm::vec3 extent(
+        0.5f * (std::fabs(m.rows[0].x) + std::fabs(m.rows[0].y) + std::fabs(m.rows[0].z)),
+        0.5f * (std::fabs(m.rows[1].x) + std::fabs(m.rows[1].y) + std::fabs(m.rows[1].z)),
+        0.5f * (std::fabs(m.rows[2].x) + std::fabs(m.rows[2].y) + std::fabs(m.rows[2].z)));
+    AABB box;
+    box.min = center - extent;
+    box.max = center + extent;
+    return box;
+}
+
+void Frustum::extract(const glm::mat4& m) {
+    // Gribb/Hartmann: rows of the combined matrix, glm is column-major.
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    planes[0] = row3 + row0;   // left
+    planes[1] = row3 - row0;   // right
+    planes[2] = row3 + row1;   // bottom
+    planes[3] = row3 - row1;   // top
+    planes[4] = row3 + row2;   // near
+    planes[5] = row3 - row2;   // far
+
+    for (int i = 0; i < 6; i++) {
+        float len = glm::length(glm::vec3(planes[i]));
+        if (len > 0.0f) planes[i] /= len;
+    }
+}
+
+bool Frustum::intersects(const AABB& box) const {
+    glm::vec3 c = box.center();
+    glm::vec3 e = box.extent();
+    for (int i = 0; i < 6; i++) {
+        glm::vec3 n(planes[i]);
+        float r = e.x * std::fabs(n.x) + e.y * std::fabs(n.y) + e.z * std::fabs(n.z);
+        if (glm::dot(n, c) + planes[i].w < -r)
+            return false;
+    }
+    return true;
+}
+
+ScreenSizeCuller::ScreenSizeCuller() : pixelScale(1.0f) {}
+
+void ScreenSizeCuller::setup(float fovYDegrees, float viewportHeight) {
+    pixelScale = viewportHeight / (2.0f * std::tan(glm::radians(fovYDegrees) * 0.5f));
+}
+
+float ScreenSizeCuller::projectedSize(const AABB& box, const glm::vec3& eye) const {
+    float radius = glm::length(box.extent());
+    float dist = glm::length(box.center() - eye);
+    if (dist <= radius) return 1e30f;
+    return 2.0f * radius * pixelScale / dist;
+}
+
+bool ScreenSizeCuller::isTooSmall(const AABB& box, float threshold, const glm::vec3& eye) const {
+    return threshold > 0.0f && projectedSize(box, eye) < threshold;
+}
+
+void CullStats::reset() {
+    tested = pvsCulled = frustumCulled = smallCulled = occluded = drawn = occluders = 0;
+    occluderMs = cullMs = 0.0;
+}
+
+void CullStats::print() const {
+    std::cout << std::fixed << std::setprecision(2)
+        << "cull: " << tested << " tested, " << pvsCulled << " pvs, " << frustumCulled << " frustum, " << smallCulled << " small, "
+        << occluded << " occluded, " << drawn << " drawn | "
+        << occluders << " occluders " << occluderMs << " ms, total " << cullMs << " ms" << std::endl;
+}
@@ -0,0 +1,57 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+#include "Affine.h"
+#include "Building.h"
+
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extent() const { return (max - min) * 0.5f; }
+};
+
+// Bounds of the unit cube [-0.5, 0.5]^3 (the shared building mesh) after transform.
+AABB transformUnitCube(const Affine3x4& m);
+
+struct Frustum {
+    glm::vec4 planes[6];
+
+    void extract(const glm::mat4& viewProjection);
+    bool intersects(const AABB& box) const;
+};
+
+// Drops objects whose bounding sphere projects smaller than a pixel
+// threshold, which entities carry in a ScreenSizeCull component. Call
+// setup() once per frame with the camera FOV.
+struct ScreenSizeCuller {
+    // viewportHeight / (2 tan(fovY / 2)), also fed to the GPU culler.
+    float pixelScale;
+
+    ScreenSizeCuller();
+    void setup(float fovYDegrees, float viewportHeight);
+    // Projected diameter of the box's bounding sphere in pixels.
+    float projectedSize(const AABB& box, const glm::vec3& eye) const;
+    bool isTooSmall(const AABB& box, float threshold, const glm::vec3& eye) const;
+};
+
+// Per-frame counters for the culling stages, printed once a second.
+struct CullStats {
+    int tested;
+    int pvsCulled;
+    int frustumCulled;
+    int smallCulled;
+    int occluded;
+    int drawn;
+    int occluders;
+    double occluderMs;      // software occlusion: occluder setup and rasterization
+    double cullMs;          // whole cull loop including occludee tests
+
+    CullStats() { reset(); }
+    void reset();
+    void print() const;
+};
+
+#endif
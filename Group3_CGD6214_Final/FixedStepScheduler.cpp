@@ -0,0 +1,24 @@
+#include "FixedStepScheduler.h"
+#include <algorithm>
+
+FixedStepScheduler::FixedStepScheduler(double ticksPerSecond, int maxTicksPerFrame)
+    : start(Clock::now()), maxTicks(std::max(maxTicksPerFrame, 1)), nowNs(0), frameNs(0),
+      accumulatorNs(0), ticks(0), dropped(0) {
+    stepNs = std::max((int64_t)(1e9 / std::max(ticksPerSecond, 1.0)), (int64_t)1);
+}
+
+int FixedStepScheduler::advance() {
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    frameNs = now - nowNs;
+    nowNs = now;
+    accumulatorNs += frameNs;
+
+    int64_t due = accumulatorNs / stepNs;
+    accumulatorNs -= due * stepNs;
+    if (due > maxTicks) {
+        dropped += (uint64_t)(due - maxTicks);
+        due = maxTicks;
+    }
+    ticks += (uint64_t)due;
+    return (int)due;
+}
@@ -0,0 +1,46 @@
+#ifndef FIXEDSTEPSCHEDULER_H
+#define FIXEDSTEPSCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+
+// Runs a simulation at a fixed rate however fast frames come. Time is read
+// from a monotonic clock as 64-bit nanoseconds and kept as integers, so the
+// tick boundaries do not drift however long the program runs.
+//
+// Call advance() once per frame and run the ticks it returns. When a frame
+// takes so long that more than maxTicksPerFrame are due, the rest are
+// dropped rather than carried over, so one slow frame cannot make the next
+// slower still. alpha() is how far the present lies past the last tick, as
+// a fraction of a step, for drawing between the last two ticks.
+class FixedStepScheduler {
+public:
+    FixedStepScheduler(double ticksPerSecond = 60.0, int maxTicksPerFrame = 8);
+
+    int advance();
+
+    float step() const { return (float)(stepNs * 1e-9); }
+    float alpha() const { return (float)((double)accumulatorNs / (double)stepNs); }
+    // Seconds of simulation run so far, ticks times step.
+    double simulatedTime() const { return (double)ticks * stepNs * 1e-9; }
+    // Seconds since construction.
+    double realTime() const { return (double)nowNs * 1e-9; }
+    // Real seconds between the last two calls to advance().
+    float frameTime() const { return (float)(frameNs * 1e-9); }
+    uint64_t tickCount() const { return ticks; }
+    uint64_t droppedTicks() const { return dropped; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point start;
+    int64_t stepNs;
+    int maxTicks;
+    int64_t nowNs;
+    int64_t frameNs;
+    int64_t accumulatorNs;
+    uint64_t ticks;
+    uint64_t dropped;
+};
+
+#endif
@@ -0,0 +1,270 @@
+#include "HiZCuller.h"
+#include <GL/glew.h>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <string>
+
+namespace {
+
+struct GpuBounds {
+    glm::vec4 min;      // w = group
+    glm::vec4 max;      // w = 1 when the instance has an impostor
+    glm::vec4 params;   // x = minimum projected size in pixels
+};
+
+struct GpuCounters {
+    unsigned int frustumCulled;
+    unsigned int smallCulled;
+    unsigned int occluded;
+    unsigned int impostors;
+};
+
+void pack(const HiZCuller::Instance& inst, int group, GpuBounds& bounds, Affine3x4& model, unsigned int& id) {
+    bounds.min = glm::vec4(inst.bounds.min, (float)group);
+    bounds.max = glm::vec4(inst.bounds.max, inst.hasImpostor ? 1.0f : 0.0f);
+    bounds.params = glm::vec4(inst.minPixels, 0.0f, 0.0f, 0.0f);
+    model = inst.model;
+    id = inst.pickId;
+}
+
+int clampGroup(int group) {
+    return std::min(std::max(group, 0), HiZCuller::MaxGroups - 1);
+}
+
+} // namespace
+
+HiZCuller::HiZCuller(unsigned int meshVBO, int vertexCount)
+    : impostorDistance(1e30f),
+    reduceShader("shaders/hizReduce.comp"),
+    cullShader("shaders/hizCull.comp"),
+    drawShader("shaders/instanced.vs", "shaders/fragmentShader.fs"),
+    vertexCount(vertexCount), totalInstances(0), movingFirst(0), groupCount(0),
+    pyramid(0), pyramidWidth(0), pyramidHeight(0), pyramidLevels(0),
+    pyramidValid(false), pyramidViewProj(1.0f) {
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &boundsSSBO);
+    glGenBuffers(1, &modelSSBO);
+    glGenBuffers(1, &idSSBO);
+    glGenBuffers(1, &visibleBuffer);
+    glGenBuffers(1, &commandBuffer);
+    glGenBuffers(1, &counterSSBO);
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+
+    // Compacted instance ids, fetched per instance starting at each
+    // command's baseInstance.
+    glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+    glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)0);
+    glEnableVertexAttribArray(3);
+    glVertexAttribDivisor(3, 1);
+    glBindVertexArray(0);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(commands), NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GpuCounters), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    drawShader.use();
+    drawShader.setInt("texture1", 0);
+}
+
+void HiZCuller::setInstances(const std::vector<Instance>& instances, const std::vector<Instance>& moving) {
+    std::vector<int> order(instances.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+    std::stable_sort(order.begin(), order.end(),
+        [&](int a, int b) { return instances[a].group < instances[b].group; });
+
+    // The cull shader files each instance under its own group, so the
+    // moving tail needs no sorting; only the per-group counts matter.
+    size_t total = instances.size() + moving.size();
+    std::vector<GpuBounds> bounds(total);
+    std::vector<Affine3x4> models(total);
+    std::vector<unsigned int> ids(total);
+    int counts[MaxGroups] = {};
+    for (size_t i = 0; i < total; i++) {
+        const Instance& inst = i < order.size() ? instances[order[i]] : moving[i - order.size()];
+        int group = clampGroup(inst.group);
+        pack(inst, group, bounds[i], models[i], ids[i]);
+        counts[group]++;
+    }
+
+    totalInstances = (int)total;
+    movingFirst = (int)instances.size();
+    groupCount = 0;
+    unsigned int offset = 0;
+    for (int g = 0; g < MaxGroups; g++) {
+        commands[g].count = vertexCount;
+        commands[g].instanceCount = 0;
+        commands[g].first = 0;
+        commands[g].baseInstance = offset;
+        offset += counts[g];
+        if (counts[g] > 0) groupCount = g + 1;
+    }
+
+    GLenum usage = moving.empty() ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW;
+    size_t n = std::max<size_t>(total, 1);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, n * sizeof(GpuBounds), bounds.data(), usage);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, modelSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, n * sizeof(Affine3x4), models.data(), usage);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, idSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, n * sizeof(unsigned int), ids.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, n * sizeof(unsigned int), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void HiZCuller::updateMoving(const std::vector<Instance>& moving) {
+    // A different set of movers changes the group counts: setInstances().
+    if (moving.empty() || (int)moving.size() != totalInstances - movingFirst) return;
+    std::vector<GpuBounds> bounds(moving.size());
+    std::vector<Affine3x4> models(moving.size());
+    std::vector<unsigned int> ids(moving.size());
+    for (size_t i = 0; i < moving.size(); i++)
+        pack(moving[i], clampGroup(moving[i].group), bounds[i], models[i], ids[i]);
+
+    // Ids stay with their entities, so only bounds and models are written.
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, movingFirst * sizeof(GpuBounds), moving.size() * sizeof(GpuBounds),
+        bounds.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, modelSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, movingFirst * sizeof(Affine3x4), moving.size() * sizeof(Affine3x4),
+        models.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void HiZCuller::buildPyramid(unsigned int depthTexture, int width, int height, const glm::mat4& viewProjection) {
+    if (width != pyramidWidth || height != pyramidHeight || !pyramid) {
+        if (pyramid) glDeleteTextures(1, &pyramid);
+        pyramidWidth = width;
+        pyramidHeight = height;
+        pyramidLevels = 1;
+        while ((std::max(width, height) >> pyramidLevels) > 0) pyramidLevels++;
+
+        glGenTextures(1, &pyramid);
+        glBindTexture(GL_TEXTURE_2D, pyramid);
+        glTexStorage2D(GL_TEXTURE_2D, pyramidLevels, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    reduceShader.use();
+
+    // Level 0 is a straight copy of the depth buffer.
+    reduceShader.setInt("copyDepth", 1);
+    reduceShader.setInt("depthTex", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    glBindImageTexture(1, pyramid, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+
+    reduceShader.setInt("copyDepth", 0);
+    int w = width, h = height;
+    for (int level = 1; level < pyramidLevels; level++) {
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        reduceShader.setVec2("srcSize", glm::vec2((float)w, (float)h));
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+        glBindImageTexture(0, pyramid, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((w + 7) / 8, (h + 7) / 8, 1);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    pyramidViewProj = viewProjection;
+    pyramidValid = true;
+}
+
+void HiZCuller::cull(const glm::mat4& viewProjection, const glm::vec3& cameraPos, float pixelScale) {
+    if (totalInstances == 0) return;
+
+    // The only per-frame CPU writes besides the moving range: zero the
+    // instance counts and counters.
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(commands), commands);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    GpuCounters zero = {};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    Frustum frustum;
+    frustum.extract(viewProjection);
+
+    cullShader.use();
+    cullShader.setInt("instanceCount", totalInstances);
+    for (int i = 0; i < 6; i++)
+        cullShader.setVec4("frustumPlanes[" + std::to_string(i) + "]", frustum.planes[i]);
+    cullShader.setVec3("cameraPos", cameraPos);
+    cullShader.setFloat("impostorDistance", impostorDistance);
+    cullShader.setFloat("pixelScale", pixelScale);
+    cullShader.setBool("useHiZ", pyramidValid);
+    cullShader.setMat4("hiZViewProj", pyramidViewProj);
+    cullShader.setVec2("hiZSize", glm::vec2((float)pyramidWidth, (float)pyramidHeight));
+    cullShader.setInt("hiZLevels", pyramidLevels);
+    cullShader.setInt("hiZ", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, pyramid);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, boundsSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, commandBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, counterSSBO);
+    glDispatchCompute((totalInstances + 63) / 64, 1, 1);
+
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void HiZCuller::draw(int group) const {
+    if (group < 0 || group >= groupCount) return;
+    glBindVertexArray(vao);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, modelSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, idSSBO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glDrawArraysIndirect(GL_TRIANGLES, (void*)(group * sizeof(DrawCommand)));
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void HiZCuller::readStats(CullStats& stats) const {
+    DrawCommand result[MaxGroups];
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(result), result);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    GpuCounters counters;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterSSBO);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), &counters);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    stats.reset();
+    stats.tested = totalInstances;
+    stats.frustumCulled = (int)counters.frustumCulled;
+    stats.smallCulled = (int)counters.smallCulled;
+    stats.occluded = (int)counters.occluded;
+    for (int g = 0; g < groupCount; g++)
+        stats.drawn += (int)result[g].instanceCount;
+    stats.drawn += (int)counters.impostors;
+}
+
+void HiZCuller::destroy() {
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &boundsSSBO);
+    glDeleteBuffers(1, &modelSSBO);
+    glDeleteBuffers(1, &idSSBO);
+    glDeleteBuffers(1, &visibleBuffer);
+    glDeleteBuffers(1, &commandBuffer);
+    glDeleteBuffers(1, &counterSSBO);
+    if (pyramid) glDeleteTextures(1, &pyramid);
+    pyramid = 0;
+    pyramidValid = false;
+}
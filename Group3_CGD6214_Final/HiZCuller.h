@@ -0,0 +1,86 @@
+#ifndef HIZCULLER_H
+#define HIZCULLER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "shader.h"
+
+// GPU culling for GL 4.5 contexts. A farthest-depth pyramid is built from the
+// previous frame's reversed-Z depth texture (see Camera::GetProjectionMatrix), then a compute shader tests every instance
+// against the frustum and the pyramid and appends the survivors to per-group
+// instance lists, bumping the instanceCount of that group's indirect draw.
+// Instances are grouped by texture so each group is one indirect draw.
+//
+// Instances that move every frame sit in a tail range after the static ones,
+// so a frame only rewrites that range; the static ones are uploaded once.
+class HiZCuller {
+public:
+    struct Instance {
+        Affine3x4 model;    // relative to the origin the draw view was made for
+        AABB bounds;        // world space, as is everything passed to cull()
+        int group;
+        bool hasImpostor;   // skipped beyond impostorDistance, drawn as impostor instead
+        float minPixels;    // screen-size threshold, 0 = never dropped
+        unsigned int pickId;    // written to the ID attachment, 0 = nothing
+    };
+
+    static const int MaxGroups = 4;
+
+    float impostorDistance;
+
+    HiZCuller(unsigned int meshVBO, int vertexCount);
+
+    // Uploads all instances, the moving ones last; call again whenever the
+    // static set or which entities move changes.
+    void setInstances(const std::vector<Instance>& instances, const std::vector<Instance>& moving);
+    // Rewrites the moving range from the same entities, in the same order,
+    // at their current transforms.
+    void updateMoving(const std::vector<Instance>& moving);
+
+    // viewProjection is the one the depth texture was rendered with, taking
+    // world space rather than camera-relative positions.
+    void buildPyramid(unsigned int depthTexture, int width, int height, const glm::mat4& viewProjection);
+    // Drops the pyramid from occlusion tests until the next buildPyramid();
+    // for frames drawn without it, after which its depth is out of date.
+    void invalidatePyramid() { pyramidValid = false; }
+    // pixelScale comes from ScreenSizeCuller::setup.
+    void cull(const glm::mat4& viewProjection, const glm::vec3& cameraPos, float pixelScale);
+
+    // The draw shader takes the usual view/projection uniforms and texture1.
+    const Shader& shader() const { return drawShader; }
+    void draw(int group) const;
+
+    // Reads back the frame's counters. Stalls on the GPU; for stats only.
+    void readStats(CullStats& stats) const;
+    int instanceCount() const { return totalInstances; }
+
+    void destroy();
+
+private:
+    struct DrawCommand {
+        unsigned int count;
+        unsigned int instanceCount;
+        unsigned int first;
+        unsigned int baseInstance;
+    };
+
+    Shader reduceShader;
+    Shader cullShader;
+    Shader drawShader;
+
+    int vertexCount;
+    int totalInstances;
+    int movingFirst;
+    int groupCount;
+    DrawCommand commands[MaxGroups];
+
+    unsigned int vao;
+    unsigned int boundsSSBO, modelSSBO, idSSBO, visibleBuffer, commandBuffer, counterSSBO;
+    unsigned int pyramid;
+    int pyramidWidth, pyramidHeight, pyramidLevels;
+    bool pyramidValid;
+    glm::mat4 pyramidViewProj;
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include "Impostor.h"
+#include <GL/glew.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+
+namespace {
+
+// Maps an octahedral uv in [0,1]^2 back to a unit direction (Y up).
+// Must match octDecode in impostor.vs.
+glm::vec3 octDecode(glm::vec2 uv) {
+    glm::vec2 p = uv * 2.0f - glm::vec2(1.0f);
+    glm::vec3 d(p.x, 1.0f - std::fabs(p.x) - std::fabs(p.y), p.y);
+    if (d.y < 0.0f) {
+        float x = (1.0f - std::fabs(d.z)) * (d.x >= 0.0f ? 1.0f : -1.0f);
+        float z = (1.0f - std::fabs(d.x)) * (d.z >= 0.0f ? 1.0f : -1.0f);
+        d.x = x;
+        d.z = z;
+    }
+    return glm::normalize(d);
+}
+
+glm::vec3 frameUp(const glm::vec3& dir) {
+    return std::fabs(dir.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+}
+
+} // namespace
+
+ImpostorSystem::ImpostorSystem(int framesPerSide, int frameSize, float distance)
+    : framesPerSide(framesPerSide), frameSize(frameSize), distance(distance), zeroToOneDepth(false),
+    colorArray(0), depthArray(0),
+    shader("shaders/impostor.vs", "shaders/impostor.fs"),
+    quadVAO(0), quadVBO(0), instanceVBO(0), instanceCapacity(0), baked(false) {
+    float quad[] = {
+        -1.0f, -1.0f,  1.0f, -1.0f,  1.0f,  1.0f,
+         1.0f,  1.0f, -1.0f,  1.0f, -1.0f, -1.0f
+    };
+
+    glGenVertexArrays(1, &quadVAO);
+    glGenBuffers(1, &quadVBO);
+    glGenBuffers(1, &instanceVBO);
+    glBindVertexArray(quadVAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, centerRadius));
+    glEnableVertexAttribArray(1);
+    glVertexAttribDivisor(1, 1);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Instance), (void*)offsetof(Instance, layer));
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    glBindVertexArray(0);
+
+    shader.use();
+    shader.setInt("colorAtlas", 0);
+    shader.setInt("depthAtlas", 1);
+    shader.setInt("framesPerSide", framesPerSide);
+}
+
+void ImpostorSystem::destroy() {
+    glDeleteVertexArrays(1, &quadVAO);
+    glDeleteBuffers(1, &quadVBO);
+    glDeleteBuffers(1, &instanceVBO);
+    if (colorArray) glDeleteTextures(1, &colorArray);
+    if (depthArray) glDeleteTextures(1, &depthArray);
+    colorArray = depthArray = 0;
+    baked = false;
+}
+
+int ImpostorSystem::addArchetype(const glm::vec3& scale, unsigned int texture) {
+    for (size_t i = 0; i < archetypes.size(); i++) {
+        if (archetypes[i].texture == texture && glm::length(archetypes[i].scale - scale) < 0.01f)
+            return (int)i;
+    }
+    Archetype a;
+    a.scale = scale;
+    a.texture = texture;
+    a.radius = 0.5f * glm::length(scale);
+    archetypes.push_back(a);
+    baked = false;
+    return (int)archetypes.size() - 1;
+}
+
+void ImpostorSystem::bake(const Shader& bakeShader, unsigned int meshVAO, int vertexCount, InstanceBuffer& meshInstances) {
+    if (archetypes.empty()) return;
+
+    int atlasSize = framesPerSide * frameSize;
+    int layers = (int)archetypes.size();
+
+    if (colorArray) glDeleteTextures(1, &colorArray);
+    if (depthArray) glDeleteTextures(1, &depthArray);
+
+    glGenTextures(1, &colorArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, colorArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, atlasSize, atlasSize, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    glGenTextures(1, &depthArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16F, atlasSize, atlasSize, layers, 0, GL_RED, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    unsigned int fbo, depthRBO;
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &depthRBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlasSize, atlasSize);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+
+    GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+
+    GLint oldViewport[4];
+    glGetIntegerv(GL_VIEWPORT, oldViewport);
+
+    bakeShader.use();
+    glBindVertexArray(meshVAO);
+    glActiveTexture(GL_TEXTURE0);
+
+    for (int layer = 0; layer < layers; layer++) {
+        const Archetype& a = archetypes[layer];
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, colorArray, 0, layer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, depthArray, 0, layer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cout << "Impostor bake framebuffer incomplete" << std::endl;
+            break;
+        }
+
+        glViewport(0, 0, atlasSize, atlasSize);
+        float clearColor[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float clearDepth[] = { 1.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, clearColor);
+        glClearBufferfv(GL_COLOR, 1, clearDepth);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        float r = a.radius;
+        glm::mat4 projection = glm::ortho(-r, r, -r, r, r, 3.0f * r);
+        std::vector<Affine3x4> model(1, Affine3x4(glm::scale(glm::mat4(1.0f), a.scale)));
+        bakeShader.setMat4("projection", projection);
+        glBindTexture(GL_TEXTURE_2D, a.texture);
+
+        for (int j = 0; j < framesPerSide; j++) {
+            for (int i = 0; i < framesPerSide; i++) {
+                glm::vec2 uv((i + 0.5f) / framesPerSide, (j + 0.5f) / framesPerSide);
+                glm::vec3 dir = octDecode(uv);
+                glm::mat4 view = glm::lookAt(dir * (2.0f * r), glm::vec3(0.0f), frameUp(dir));
+                bakeShader.setMat4("view", view);
+                glViewport(i * frameSize, j * frameSize, frameSize, frameSize);
+                meshInstances.draw(meshVAO, vertexCount, model);
+            }
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteRenderbuffers(1, &depthRBO);
+    glViewport(oldViewport[0], oldViewport[1], oldViewport[2], oldViewport[3]);
+    baked = true;
+}
+
+void ImpostorSystem::clear() {
+    instances.clear();
+}
+
+void ImpostorSystem::addInstance(const glm::vec3& center, int archetype) {
+    Instance inst;
+    inst.centerRadius = glm::vec4(center, archetypes[archetype].radius);
+    inst.layer = (float)archetype;
+    instances.push_back(inst);
+}
+
+void ImpostorSystem::draw(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos) {
+    if (!baked || instances.empty()) return;
+
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    size_t bytes = instances.size() * sizeof(Instance);
+    if (instances.size() > instanceCapacity) {
+        instanceCapacity = instances.size() * 2;
+        glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(Instance), NULL, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+
+    shader.use();
+    shader.setMat4("view", view);
+    shader.setMat4("projection", projection);
+    shader.setVec3("cameraPos", cameraPos);
+    shader.setBool("zeroToOneDepth", zeroToOneDepth);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, colorArray);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthArray);
+
+    glBindVertexArray(quadVAO);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, (GLsizei)instances.size());
+
+    glActiveTexture(GL_TEXTURE0);
+}
@@ -0,0 +1,65 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "shader.h"
+#include "InstanceBuffer.h"
+
+// Octahedral impostors: each archetype (a box of a given size and texture) is
+// rendered from framesPerSide x framesPerSide directions spread over an
+// octahedron and stored as one layer of a colour + depth texture array.
+// Distant instances are then drawn as camera-facing quads sampling that layer.
+class ImpostorSystem {
+public:
+    int framesPerSide;
+    int frameSize;
+    float distance;         // instances farther than this use the impostor
+    bool zeroToOneDepth;    // depth is written as clip z / w, for glClipControl(..., GL_ZERO_TO_ONE)
+
+    unsigned int colorArray;
+    unsigned int depthArray;
+
+    ImpostorSystem(int framesPerSide = 8, int frameSize = 128, float distance = 80.0f);
+
+    // Returns the archetype index for a box of this size and texture,
+    // reusing an existing one if it matches.
+    int addArchetype(const glm::vec3& scale, unsigned int texture);
+
+    // Renders every archetype into the atlas. bakeShader must take per-instance
+    // model rows (fed through meshInstances, attached to meshVAO) plus view and
+    // projection uniforms, and write colour to output 0 and depth to output 1.
+    // Call once after all archetypes are added.
+    void bake(const Shader& bakeShader, unsigned int meshVAO, int vertexCount, InstanceBuffer& meshInstances);
+
+    void clear();
+    void addInstance(const glm::vec3& center, int archetype);
+    void draw(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos);
+
+    // Frees GL objects; call before the context is destroyed.
+    void destroy();
+
+    int instanceCount() const { return (int)instances.size(); }
+
+private:
+    struct Archetype {
+        glm::vec3 scale;
+        unsigned int texture;
+        float radius;
+    };
+
+    struct Instance {
+        glm::vec4 centerRadius;
+        float layer;
+    };
+
+    std::vector<Archetype> archetypes;
+    std::vector<Instance> instances;
+
+    Shader shader;
+    unsigned int quadVAO, quadVBO, instanceVBO;
+    size_t instanceCapacity;
+    bool baked;
+};
+
+#endif
@@ -0,0 +1,52 @@
+#include <GL/glew.h>
+#include "InstanceBuffer.h"
+
+InstanceBuffer::InstanceBuffer() : vbo(0), idVbo(0), capacity(0), idCapacity(0) {
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &idVbo);
+}
+
+void InstanceBuffer::attach(unsigned int vao) {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    for (unsigned int i = 0; i < 3; i++) {
+        glVertexAttribPointer(FirstAttribute + i, 4, GL_FLOAT, GL_FALSE, sizeof(Affine3x4), (void*)(i * sizeof(glm::vec4)));
+        glEnableVertexAttribArray(FirstAttribute + i);
+        glVertexAttribDivisor(FirstAttribute + i, 1);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, idVbo);
+    glVertexAttribIPointer(IdAttribute, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void*)0);
+    glVertexAttribDivisor(IdAttribute, 1);
+}
+
+void InstanceBuffer::draw(unsigned int vao, int vertexCount, const std::vector<Affine3x4>& instances,
+    const std::vector<uint32_t>* ids) {
+    if (instances.empty()) return;
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (instances.size() > capacity) capacity = instances.size() * 2;
+    // Reallocating every draw orphans the old storage, so the driver does not
+    // stall on a previous draw still reading it.
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Affine3x4), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(Affine3x4), instances.data());
+
+    glBindVertexArray(vao);
+    if (ids && ids->size() == instances.size()) {
+        glBindBuffer(GL_ARRAY_BUFFER, idVbo);
+        if (ids->size() > idCapacity) idCapacity = ids->size() * 2;
+        glBufferData(GL_ARRAY_BUFFER, idCapacity * sizeof(uint32_t), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, ids->size() * sizeof(uint32_t), ids->data());
+        glEnableVertexAttribArray(IdAttribute);
+    }
+    else {
+        glDisableVertexAttribArray(IdAttribute);
+        glVertexAttribI4ui(IdAttribute, 0, 0, 0, 0);
+    }
+    glDrawArraysInstanced(GL_TRIANGLES, 0, vertexCount, (GLsizei)instances.size());
+}
+
+void InstanceBuffer::destroy() {
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &idVbo);
+    vbo = idVbo = 0;
+    capacity = idCapacity = 0;
+}
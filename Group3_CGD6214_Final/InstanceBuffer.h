@@ -0,0 +1,33 @@
+#ifndef INSTANCEBUFFER_H
+#define INSTANCEBUFFER_H
+
+#include <cstdint>
+#include <vector>
+#include "Affine.h"
+
+// Streams per-instance model matrices as three vec4 rows (attribute
+// locations 3-5, see vertexShader.vs) and issues instanced draws. Pick IDs,
+// when given, stream from a second buffer to location 6; without them every
+// instance reads 0.
+class InstanceBuffer {
+public:
+    static const unsigned int FirstAttribute = 3;
+    static const unsigned int IdAttribute = 6;
+
+    InstanceBuffer();
+
+    // Points the instance attributes of vao at this buffer.
+    void attach(unsigned int vao);
+    // One instanced draw of the first vertexCount vertices of vao.
+    void draw(unsigned int vao, int vertexCount, const std::vector<Affine3x4>& instances,
+        const std::vector<uint32_t>* ids = NULL);
+    void destroy();
+
+private:
+    unsigned int vbo;
+    unsigned int idVbo;
+    size_t capacity;
+    size_t idCapacity;
+};
+
+#endif
@@ -1,21 +1,62 @@
 #ifndef NODE_H
 #define NODE_H
 
-#include <vector>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "Affine.h"
+#include "NodeHandle.h"
 
-class Node {
+// Nodes live in a Scene's NodePool and refer to each other by handle; the
+// pool owns them, so destroying a node never touches its neighbours.
+// Children form an intrusive doubly linked list so attaching, detaching and
+// moving a node are constant time. Edit links through Scene only.
+//
+// The local transform is kept as translation, rotation and scale and only
+// turned into a matrix by Scene::update, for nodes whose local transform or
+// an ancestor's changed. Write it through the setters (or call markDirty
+// after touching the members directly).
+//
+// Node is the only pooled type: what an entity is lives in World components,
+// so nodes carry no vtable and are never cast.
+//
+// Translations are doubles so the city can extend far from the origin. The
+// float worldTransform is exact enough for bounds and culling; rendering
+// goes through relativeTransform() so vertices never see large numbers.
+class Node final {
 public:
-    glm::mat4 localTransform;
-    glm::mat4 worldTransform;
-    std::vector<Node*> children;
+    glm::dvec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+    Affine3x4 worldTransform;   // translation rounded to float
+    glm::dvec3 worldPosition;   // exact world translation
+    bool dirty;             // local TRS changed since the last update
+    bool worldChanged;      // worldTransform was rewritten by the last update
+
+    NodeHandle handle;
+    NodeHandle parent;
+    NodeHandle firstChild;
+    NodeHandle lastChild;
+    NodeHandle prevSibling;
+    NodeHandle nextSibling;
 
     Node();
-    virtual ~Node();
+    ~Node();
+
+    void setPosition(const glm::dvec3& p) { position = p; dirty = true; }
+    void setRotation(const glm::quat& r) { rotation = r; dirty = true; }
+    void setScale(const glm::vec3& s) { scale = s; dirty = true; }
+    void markDirty() { dirty = true; }
 
-    void addChild(Node* child);
-    virtual void update(const glm::mat4& parentTransform = glm::mat4(1.0f));
+    // translate * rotate * scale, built straight from the TRS fields.
+    Affine3x4 localMatrix() const { return Affine3x4::fromTRS(glm::vec3(position), rotation, scale); }
+    // worldTransform with the translation taken relative to origin, the
+    // subtraction done in double.
+    Affine3x4 relativeTransform(const glm::dvec3& origin) const {
+        Affine3x4 m = worldTransform;
+        m.setTranslation(glm::vec3(worldPosition - origin));
+        return m;
+    }
 };
 
 #endif
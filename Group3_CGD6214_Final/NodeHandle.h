@@ -0,0 +1,29 @@
+#ifndef NODEHANDLE_H
+#define NODEHANDLE_H
+
+#include <cstdint>
+
+// 32-bit reference to a pooled node: 22 bits of slot index and 10 bits of
+// generation. The generation is bumped every time a slot is freed, so a
+// handle to a destroyed node no longer resolves; a slot whose generation
+// would wrap is retired instead, so it never does again.
+struct NodeHandle {
+    static const uint32_t IndexBits = 22;
+    static const uint32_t IndexMask = (1u << IndexBits) - 1;
+    static const uint32_t GenerationMask = (1u << (32 - IndexBits)) - 1;
+
+    uint32_t value;
+
+    NodeHandle() : value(0xFFFFFFFFu) {}
+    NodeHandle(uint32_t index, uint32_t generation)
+        : value(((generation & GenerationMask) << IndexBits) | (index & IndexMask)) {}
+
+    uint32_t index() const { return value & IndexMask; }
+    uint32_t generation() const { return value >> IndexBits; }
+    bool isNull() const { return value == 0xFFFFFFFFu; }
+
+    bool operator==(const NodeHandle& o) const { return value == o.value; }
+    bool operator!=(const NodeHandle& o) const { return value != o.value; }
+};
+
+#endif
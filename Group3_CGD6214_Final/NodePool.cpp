@@ -0,0 +1,70 @@
+#include "NodePool.h"
+#include "Node.h"
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+NodePool::NodePool() : liveCount(0) {}
+
+NodePool::~NodePool() {
+    for (uint32_t index = 0; index < alive.size(); index++) {
+        if (alive[index]) slot(index)->~Node();
+    }
+    for (Node* chunk : chunks)
+        ::operator delete(chunk);
+}
+
+uint32_t NodePool::allocateSlot() {
+    if (freeSlots.empty()) {
+        uint32_t first = (uint32_t)capacity();
+        if (first + SlotsPerChunk > NodeHandle::IndexMask) {
+            std::cout << "ERROR::NODEPOOL::OUT_OF_HANDLES" << std::endl;
+            std::abort();
+        }
+        chunks.push_back((Node*)::operator new(sizeof(Node) * SlotsPerChunk));
+        generations.resize(capacity(), 0);
+        alive.resize(capacity(), 0);
+        for (uint32_t i = 0; i < (uint32_t)SlotsPerChunk; i++)
+            freeSlots.push_back(first + i);
+    }
+    uint32_t index = freeSlots.front();
+    freeSlots.pop_front();
+    return index;
+}
+
+NodeHandle NodePool::create() {
+    uint32_t index = allocateSlot();
+    new (slot(index)) Node();
+    alive[index] = 1;
+    liveCount++;
+    return NodeHandle(index, generations[index]);
+}
+
+Node* NodePool::get(NodeHandle handle) const {
+    if (handle.isNull()) return NULL;
+    uint32_t index = handle.index();
+    if (index >= alive.size() || !alive[index] || generations[index] != handle.generation()) return NULL;
+    return slot(index);
+}
+
+void NodePool::destroy(NodeHandle handle) {
+    Node* node = get(handle);
+    if (!node) return;
+    uint32_t index = handle.index();
+    node->~Node();
+    alive[index] = 0;
+    liveCount--;
+    // The last generation is never handed out, so a retired slot matches no
+    // handle at all.
+    generations[index]++;
+    if (generations[index] < NodeHandle::GenerationMask)
+        freeSlots.push_back(index);
+}
+
+size_t NodePool::memoryBytes() const {
+    return chunks.size() * sizeof(Node) * SlotsPerChunk
+        + chunks.capacity() * sizeof(Node*)
+        + generations.capacity() * sizeof(uint16_t)
+        + alive.capacity()
+        + freeSlots.size() * sizeof(uint32_t);
+}
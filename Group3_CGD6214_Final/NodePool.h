@@ -0,0 +1,59 @@
+#ifndef NODEPOOL_H
+#define NODEPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "Node.h"
+
+// Slab allocator for Node. Slots are one Node each and come in chunks, so
+// nodes never move and creating or destroying one is a free list push/pop.
+// The free list is first in, first out: churn cycles through every free slot
+// instead of wearing out the generations of the few freed last. forEach()
+// walks the slabs in memory order, skipping free slots.
+class NodePool {
+public:
+    static const size_t SlotsPerChunk = 1024;
+
+    NodePool();
+    ~NodePool();
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    NodeHandle create();
+    void destroy(NodeHandle handle);
+    // NULL for null or stale handles.
+    Node* get(NodeHandle handle) const;
+    bool isValid(NodeHandle handle) const { return get(handle) != NULL; }
+
+    size_t size() const { return liveCount; }
+    size_t capacity() const { return chunks.size() * SlotsPerChunk; }
+    // Slab plus bookkeeping, for profiling.
+    size_t memoryBytes() const;
+
+    // Live nodes in slot order; do not create/destroy inside.
+    template<typename Fn>
+    void forEach(Fn fn) const {
+        for (size_t c = 0; c < chunks.size(); c++) {
+            Node* slab = chunks[c];
+            const unsigned char* used = alive.data() + c * SlotsPerChunk;
+            for (size_t i = 0; i < SlotsPerChunk; i++) {
+                if (used[i]) fn(slab[i]);
+            }
+        }
+    }
+
+private:
+    std::vector<Node*> chunks;
+    std::vector<uint16_t> generations;  // per slot
+    std::vector<unsigned char> alive;   // per slot
+    std::deque<uint32_t> freeSlots;
+    size_t liveCount;
+
+    uint32_t allocateSlot();
+    Node* slot(uint32_t index) const { return chunks[index / SlotsPerChunk] + index % SlotsPerChunk; }
+};
+
+#endif
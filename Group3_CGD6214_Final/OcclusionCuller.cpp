@@ -0,0 +1,323 @@
+#include "OcclusionCuller.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define OC_TARGET_AVX2
+#else
+#define OC_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace {
+
+// Corners are indexed by bit 0 = +x, bit 1 = +y, bit 2 = +z. Triangles wind
+// counter-clockwise seen from outside, so front faces have positive area.
+const int BoxTriangles[12][3] = {
+    { 0, 2, 3 }, { 0, 3, 1 },   // -z
+    { 4, 5, 7 }, { 4, 7, 6 },   // +z
+    { 0, 4, 6 }, { 0, 6, 2 },   // -x
+    { 1, 3, 7 }, { 1, 7, 5 },   // +x
+    { 0, 1, 5 }, { 0, 5, 4 },   // -y
+    { 2, 6, 7 }, { 2, 7, 3 }    // +y
+};
+
+bool cpuHasAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx) return false;
+    if ((_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+void boxCorners(const AABB& box, const glm::mat4& viewProj, glm::vec4 out[8]) {
+    for (int i = 0; i < 8; i++) {
+        glm::vec3 p((i & 1) ? box.max.x : box.min.x,
+                    (i & 2) ? box.max.y : box.min.y,
+                    (i & 4) ? box.max.z : box.min.z);
+        out[i] = viewProj * glm::vec4(p, 1.0f);
+    }
+}
+
+struct RasterParams {
+    float* depth;
+    int width;
+    int x0, x1, y0, y1;     // inclusive pixel range inside one tile
+};
+
+OC_TARGET_AVX2 void rasterAvx2(const RasterParams& p, const float* a, const float* b, const float* c,
+    float zdx, float zdy, float z0) {
+    const __m256 laneOffset = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 a0 = _mm256_set1_ps(a[0]), a1 = _mm256_set1_ps(a[1]), a2 = _mm256_set1_ps(a[2]);
+    const __m256 dz = _mm256_set1_ps(zdx);
+
+    int xStart = p.x0 & ~7;
+    for (int y = p.y0; y <= p.y1; y++) {
+        float fy = y + 0.5f;
+        __m256 r0 = _mm256_set1_ps(b[0] * fy + c[0]);
+        __m256 r1 = _mm256_set1_ps(b[1] * fy + c[1]);
+        __m256 r2 = _mm256_set1_ps(b[2] * fy + c[2]);
+        __m256 rz = _mm256_set1_ps(zdy * fy + z0);
+        float* row = p.depth + (size_t)y * p.width;
+
+        for (int x = xStart; x <= p.x1; x += 8) {
+            __m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), laneOffset);
+            __m256 e0 = _mm256_fmadd_ps(a0, px, r0);
+            __m256 e1 = _mm256_fmadd_ps(a1, px, r1);
+            __m256 e2 = _mm256_fmadd_ps(a2, px, r2);
+            __m256 inside = _mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+                _mm256_and_ps(_mm256_cmp_ps(e1, zero, _CMP_GE_OQ), _mm256_cmp_ps(e2, zero, _CMP_GE_OQ)));
+            if (_mm256_movemask_ps(inside) == 0) continue;
+
+            __m256 z = _mm256_fmadd_ps(dz, px, rz);
+            __m256 d = _mm256_loadu_ps(row + x);
+            d = _mm256_blendv_ps(d, _mm256_min_ps(d, z), inside);
+            _mm256_storeu_ps(row + x, d);
+        }
+    }
+}
+
+void rasterScalar(const RasterParams& p, const float* a, const float* b, const float* c,
+    float zdx, float zdy, float z0) {
+    for (int y = p.y0; y <= p.y1; y++) {
+        float fy = y + 0.5f;
+        float* row = p.depth + (size_t)y * p.width;
+        for (int x = p.x0; x <= p.x1; x++) {
+            float fx = x + 0.5f;
+            if (a[0] * fx + b[0] * fy + c[0] < 0.0f) continue;
+            if (a[1] * fx + b[1] * fy + c[1] < 0.0f) continue;
+            if (a[2] * fx + b[2] * fy + c[2] < 0.0f) continue;
+            float z = zdx * fx + zdy * fy + z0;
+            if (z < row[x]) row[x] = z;
+        }
+    }
+}
+
+} // namespace
+
+OcclusionCuller::OcclusionCuller(ThreadPool& pool, int width, int height)
+    : width(width), height(height), maxOccluders(32), occluderDistance(150.0f),
+    pool(pool), viewProj(1.0f), eye(0.0f), triangles(0), lastRasterMs(0.0) {
+    tilesX = (width + TileWidth - 1) / TileWidth;
+    tilesY = (height + TileHeight - 1) / TileHeight;
+    // Rows are padded to whole tiles so 8-wide spans never leave the buffer.
+    this->width = tilesX * TileWidth;
+    this->height = tilesY * TileHeight;
+    depth.assign((size_t)this->width * this->height, 1.0f);
+    tileMaxDepth.assign(tilesX * tilesY, 1.0f);
+    tileBins.resize(tilesX * tilesY);
+    useAvx2 = cpuHasAvx2();
+}
+
+void OcclusionCuller::begin(const glm::mat4& viewProjection, const glm::vec3& cameraPos) {
+    viewProj = viewProjection;
+    eye = cameraPos;
+    candidates.clear();
+    for (int id : selected)
+        occluderFlags[id] = 0;
+    selected.clear();
+}
+
+void OcclusionCuller::addOccluder(const AABB& box, int id) {
+    glm::vec3 toBox = box.center() - eye;
+    float dist2 = glm::dot(toBox, toBox);
+    if (dist2 > occluderDistance * occluderDistance) return;
+
+    // Rough solid angle: bigger and closer boxes hide more of the scene.
+    glm::vec3 e = box.extent();
+    Candidate c;
+    c.box = box;
+    c.id = id;
+    c.score = glm::dot(e, e) / std::max(dist2, 1.0f);
+    candidates.push_back(c);
+}
+
+void OcclusionCuller::rasterize() {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    size_t count = std::min(candidates.size(), (size_t)maxOccluders);
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end(),
+        [](const Candidate& l, const Candidate& r) { return l.score > r.score; });
+
+    tris.clear();
+    for (size_t i = 0; i < count; i++) {
+        int id = candidates[i].id;
+        if (id >= (int)occluderFlags.size()) occluderFlags.resize(id + 1, 0);
+        occluderFlags[id] = 1;
+        selected.push_back(id);
+        setupBox(candidates[i].box);
+    }
+    triangles = (int)tris.size();
+
+    for (std::vector<int>& bin : tileBins)
+        bin.clear();
+    for (int t = 0; t < (int)tris.size(); t++) {
+        const Triangle& tri = tris[t];
+        for (int ty = tri.minY / TileHeight; ty <= tri.maxY / TileHeight; ty++)
+            for (int tx = tri.minX / TileWidth; tx <= tri.maxX / TileWidth; tx++)
+                tileBins[ty * tilesX + tx].push_back(t);
+    }
+
+    pool.parallelFor(tilesX * tilesY, [this](int tile) { rasterTile(tile); });
+
+    auto end = std::chrono::high_resolution_clock::now();
+    lastRasterMs = std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void OcclusionCuller::setupBox(const AABB& box) {
+    glm::vec4 clip[8];
+    boxCorners(box, viewProj, clip);
+
+    for (const int* t : BoxTriangles) {
+        // Clip against the near plane (z >= -w); the rest is handled by
+        // the tile bounds and edge functions.
+        glm::vec4 in[3] = { clip[t[0]], clip[t[1]], clip[t[2]] };
+        glm::vec4 poly[4];
+        int n = 0;
+        for (int i = 0; i < 3; i++) {
+            const glm::vec4& a = in[i];
+            const glm::vec4& b = in[(i + 1) % 3];
+            float da = a.z + a.w;
+            float db = b.z + b.w;
+            if (da >= 0.0f) poly[n++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                poly[n++] = a + (b - a) * (da / (da - db));
+        }
+        if (n < 3) continue;
+
+        glm::vec3 screen[4];
+        for (int i = 0; i < n; i++) {
+            float invW = 1.0f / poly[i].w;
+            screen[i] = glm::vec3((poly[i].x * invW * 0.5f + 0.5f) * width,
+                                  (poly[i].y * invW * 0.5f + 0.5f) * height,
+                                  poly[i].z * invW * 0.5f + 0.5f);
+        }
+        for (int i = 1; i + 1 < n; i++)
+            setupTriangle(screen[0], screen[i], screen[i + 1]);
+    }
+}
+
+void OcclusionCuller::setupTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2) {
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+    if (area <= 0.0f) return;   // back-facing or degenerate
+
+    float minX = std::min(v0.x, std::min(v1.x, v2.x));
+    float maxX = std::max(v0.x, std::max(v1.x, v2.x));
+    float minY = std::min(v0.y, std::min(v1.y, v2.y));
+    float maxY = std::max(v0.y, std::max(v1.y, v2.y));
+
+    Triangle t;
+    t.minX = std::max(0, (int)std::ceil(minX - 0.5f));
+    t.maxX = std::min(width - 1, (int)std::floor(maxX - 0.5f));
+    t.minY = std::max(0, (int)std::ceil(minY - 0.5f));
+    t.maxY = std::min(height - 1, (int)std::floor(maxY - 0.5f));
+    if (t.minX > t.maxX || t.minY > t.maxY) return;
+
+    const glm::vec3* v[3] = { &v0, &v1, &v2 };
+    for (int i = 0; i < 3; i++) {
+        const glm::vec3& p = *v[i];
+        const glm::vec3& q = *v[(i + 1) % 3];
+        t.a[i] = -(q.y - p.y);
+        t.b[i] = q.x - p.x;
+        t.c[i] = -(t.a[i] * p.x + t.b[i] * p.y);
+    }
+
+    t.zdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+    t.zdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+    t.z0 = v0.z - t.zdx * v0.x - t.zdy * v0.y;
+    tris.push_back(t);
+}
+
+void OcclusionCuller::rasterTile(int tile) {
+    int tx = tile % tilesX;
+    int ty = tile / tilesX;
+    int x0 = tx * TileWidth, x1 = x0 + TileWidth - 1;
+    int y0 = ty * TileHeight, y1 = y0 + TileHeight - 1;
+
+    for (int y = y0; y <= y1; y++)
+        std::fill(depth.begin() + (size_t)y * width + x0, depth.begin() + (size_t)y * width + x1 + 1, 1.0f);
+
+    for (int index : tileBins[tile]) {
+        const Triangle& t = tris[index];
+        RasterParams p;
+        p.depth = depth.data();
+        p.width = width;
+        p.x0 = std::max(x0, t.minX);
+        p.x1 = std::min(x1, t.maxX);
+        p.y0 = std::max(y0, t.minY);
+        p.y1 = std::min(y1, t.maxY);
+        if (p.x0 > p.x1 || p.y0 > p.y1) continue;
+        if (useAvx2)
+            rasterAvx2(p, t.a, t.b, t.c, t.zdx, t.zdy, t.z0);
+        else
+            rasterScalar(p, t.a, t.b, t.c, t.zdx, t.zdy, t.z0);
+    }
+
+    float maxDepth = 0.0f;
+    for (int y = y0; y <= y1; y++) {
+        const float* row = depth.data() + (size_t)y * width;
+        for (int x = x0; x <= x1; x++)
+            maxDepth = std::max(maxDepth, row[x]);
+    }
+    tileMaxDepth[tile] = maxDepth;
+}
+
+bool OcclusionCuller::isOccluder(int id) const {
+    return id < (int)occluderFlags.size() && occluderFlags[id] != 0;
+}
+
+bool OcclusionCuller::isVisible(const AABB& box) const {
+    if (selected.empty()) return true;
+
+    glm::vec4 clip[8];
+    boxCorners(box, viewProj, clip);
+
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1.0f;
+    for (int i = 0; i < 8; i++) {
+        // Anything reaching the near plane is too close to test safely.
+        if (clip[i].w <= 1e-4f || clip[i].z < -clip[i].w) return true;
+        float invW = 1.0f / clip[i].w;
+        float sx = (clip[i].x * invW * 0.5f + 0.5f) * width;
+        float sy = (clip[i].y * invW * 0.5f + 0.5f) * height;
+        float sz = clip[i].z * invW * 0.5f + 0.5f;
+        minX = std::min(minX, sx);
+        maxX = std::max(maxX, sx);
+        minY = std::min(minY, sy);
+        maxY = std::max(maxY, sy);
+        minZ = std::min(minZ, sz);
+    }
+
+    int x0 = std::max(0, (int)std::floor(minX));
+    int x1 = std::min(width - 1, (int)std::floor(maxX));
+    int y0 = std::max(0, (int)std::floor(minY));
+    int y1 = std::min(height - 1, (int)std::floor(maxY));
+    if (x0 > x1 || y0 > y1) return true;
+
+    for (int ty = y0 / TileHeight; ty <= y1 / TileHeight; ty++) {
+        for (int tx = x0 / TileWidth; tx <= x1 / TileWidth; tx++) {
+            // Whole tile already nearer than the box: nothing to see here.
+            if (tileMaxDepth[ty * tilesX + tx] < minZ) continue;
+
+            int px0 = std::max(x0, tx * TileWidth), px1 = std::min(x1, tx * TileWidth + TileWidth - 1);
+            int py0 = std::max(y0, ty * TileHeight), py1 = std::min(y1, ty * TileHeight + TileHeight - 1);
+            for (int y = py0; y <= py1; y++) {
+                const float* row = depth.data() + (size_t)y * width;
+                for (int x = px0; x <= px1; x++)
+                    if (row[x] >= minZ) return true;
+            }
+        }
+    }
+    return false;
+}
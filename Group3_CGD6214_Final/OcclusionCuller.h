@@ -0,0 +1,71 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "ThreadPool.h"
+
+// CPU software occlusion culling. The biggest nearby boxes are rasterized as
+// occluders into a small depth buffer, split into tiles that are filled in
+// parallel (AVX2 when the CPU has it). Other boxes are then tested against
+// that buffer using the nearest depth of their projected bounds.
+class OcclusionCuller {
+public:
+    int width;
+    int height;
+    int maxOccluders;
+    float occluderDistance;
+
+    OcclusionCuller(ThreadPool& pool, int width = 256, int height = 128);
+
+    void begin(const glm::mat4& viewProjection, const glm::vec3& eye);
+    // id is the caller's index for the box, used by isOccluder().
+    void addOccluder(const AABB& box, int id);
+    void rasterize();
+
+    bool isOccluder(int id) const;
+    bool isVisible(const AABB& box) const;
+
+    int occluderCount() const { return (int)selected.size(); }
+    int triangleCount() const { return triangles; }
+    double rasterMs() const { return lastRasterMs; }
+
+private:
+    static const int TileWidth = 32;
+    static const int TileHeight = 32;
+
+    struct Candidate {
+        AABB box;
+        int id;
+        float score;
+    };
+
+    struct Triangle {
+        float a[3], b[3], c[3];     // edge functions, inside when all >= 0
+        float zdx, zdy, z0;         // depth plane
+        int minX, minY, maxX, maxY;
+    };
+
+    ThreadPool& pool;
+    glm::mat4 viewProj;
+    glm::vec3 eye;
+    int tilesX, tilesY;
+    bool useAvx2;
+
+    std::vector<float> depth;
+    std::vector<float> tileMaxDepth;
+    std::vector<Candidate> candidates;
+    std::vector<int> selected;
+    std::vector<char> occluderFlags;
+    std::vector<Triangle> tris;
+    std::vector<std::vector<int>> tileBins;
+    int triangles;
+    double lastRasterMs;
+
+    void setupBox(const AABB& box);
+    void setupTriangle(const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+    void rasterTile(int tile);
+};
+
+#endif
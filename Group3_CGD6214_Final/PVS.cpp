@@ -0,0 +1,364 @@
+#include "PVS.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+
+namespace {
+
+const char PvsMagic[4] = { 'P', 'V', 'S', '1' };
+
+// Occluders bucketed on a 2D grid so a sight line only tests boxes in the
+// cells it crosses.
+struct OccluderGrid {
+    glm::vec2 origin;
+    float cell;
+    int nx, nz;
+    std::vector<std::vector<int>> cells;
+
+    void build(const std::vector<AABB>& objects, const std::vector<char>& occluders,
+        glm::vec2 lo, glm::vec2 hi, float cellSize) {
+        origin = lo;
+        cell = cellSize;
+        nx = std::max(1, (int)std::ceil((hi.x - lo.x) / cell));
+        nz = std::max(1, (int)std::ceil((hi.y - lo.y) / cell));
+        cells.assign(nx * nz, std::vector<int>());
+        for (size_t i = 0; i < objects.size(); i++) {
+            if (!occluders[i]) continue;
+            int x0 = clampX((int)std::floor((objects[i].min.x - origin.x) / cell));
+            int x1 = clampX((int)std::floor((objects[i].max.x - origin.x) / cell));
+            int z0 = clampZ((int)std::floor((objects[i].min.z - origin.y) / cell));
+            int z1 = clampZ((int)std::floor((objects[i].max.z - origin.y) / cell));
+            for (int z = z0; z <= z1; z++)
+                for (int x = x0; x <= x1; x++)
+                    cells[z * nx + x].push_back((int)i);
+        }
+    }
+
+    int clampX(int x) const { return std::min(std::max(x, 0), nx - 1); }
+    int clampZ(int z) const { return std::min(std::max(z, 0), nz - 1); }
+
+    const std::vector<int>& at(const glm::vec3& p) const {
+        int x = clampX((int)std::floor((p.x - origin.x) / cell));
+        int z = clampZ((int)std::floor((p.z - origin.y) / cell));
+        return cells[z * nx + x];
+    }
+};
+
+bool contains(const AABB& box, const glm::vec3& p) {
+    return p.x >= box.min.x && p.x <= box.max.x &&
+           p.y >= box.min.y && p.y <= box.max.y &&
+           p.z >= box.min.z && p.z <= box.max.z;
+}
+
+// Does the open segment from + t * dir, t in (0, 1), pass through the box?
+bool segmentHits(const glm::vec3& from, const glm::vec3& dir, const AABB& box) {
+    float t0 = 1e-4f, t1 = 1.0f - 1e-4f;
+    for (int axis = 0; axis < 3; axis++) {
+        if (std::fabs(dir[axis]) < 1e-8f) {
+            if (from[axis] < box.min[axis] || from[axis] > box.max[axis]) return false;
+            continue;
+        }
+        float inv = 1.0f / dir[axis];
+        float ta = (box.min[axis] - from[axis]) * inv;
+        float tb = (box.max[axis] - from[axis]) * inv;
+        if (ta > tb) std::swap(ta, tb);
+        t0 = std::max(t0, ta);
+        t1 = std::min(t1, tb);
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+struct RayContext {
+    std::vector<uint32_t> stamp;    // mailbox so a box spanning cells is tested once per ray
+    uint32_t ray;
+};
+
+bool sightBlocked(const glm::vec3& from, const glm::vec3& to, int target,
+    const OccluderGrid& grid, const std::vector<AABB>& objects, RayContext& ctx) {
+    ctx.ray++;
+    glm::vec3 dir = to - from;
+
+    // Amanatides-Woo walk over the grid cells the segment crosses in XZ.
+    float gx = (from.x - grid.origin.x) / grid.cell;
+    float gz = (from.z - grid.origin.y) / grid.cell;
+    float dx = dir.x / grid.cell;
+    float dz = dir.z / grid.cell;
+    int ix = (int)std::floor(gx), iz = (int)std::floor(gz);
+    int stepX = dx > 0.0f ? 1 : -1, stepZ = dz > 0.0f ? 1 : -1;
+    float tMaxX = dx != 0.0f ? ((ix + (stepX > 0 ? 1 : 0)) - gx) / dx : 1e30f;
+    float tMaxZ = dz != 0.0f ? ((iz + (stepZ > 0 ? 1 : 0)) - gz) / dz : 1e30f;
+    float tDeltaX = dx != 0.0f ? std::fabs(1.0f / dx) : 1e30f;
+    float tDeltaZ = dz != 0.0f ? std::fabs(1.0f / dz) : 1e30f;
+
+    for (;;) {
+        if (ix >= 0 && ix < grid.nx && iz >= 0 && iz < grid.nz) {
+            for (int i : grid.cells[iz * grid.nx + ix]) {
+                if (i == target || ctx.stamp[i] == ctx.ray) continue;
+                ctx.stamp[i] = ctx.ray;
+                if (segmentHits(from, dir, objects[i])) return true;
+            }
+        }
+        if (tMaxX > 1.0f && tMaxZ > 1.0f) break;
+        if (tMaxX < tMaxZ) {
+            ix += stepX;
+            tMaxX += tDeltaX;
+        }
+        else {
+            iz += stepZ;
+            tMaxZ += tDeltaZ;
+        }
+    }
+    return false;
+}
+
+void appendVarint(std::vector<unsigned char>& out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((unsigned char)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((unsigned char)v);
+}
+
+// False when the varint runs past end or beyond 32 bits.
+bool readVarint(const unsigned char*& p, const unsigned char* end, uint32_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 32; shift += 7) {
+        if (p == end) return false;
+        unsigned char byte = *p++;
+        v |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+// Bitsets are mostly zero bytes: store (zero run, literal count, literals)*.
+void compressBits(const std::vector<unsigned char>& bits, std::vector<unsigned char>& out) {
+    size_t i = 0, n = bits.size();
+    while (i < n) {
+        size_t zeros = 0;
+        while (i + zeros < n && bits[i + zeros] == 0) zeros++;
+        i += zeros;
+        size_t literals = 0;
+        while (i + literals < n && bits[i + literals] != 0) literals++;
+        appendVarint(out, (uint32_t)zeros);
+        appendVarint(out, (uint32_t)literals);
+        out.insert(out.end(), bits.begin() + i, bits.begin() + i + literals);
+        i += literals;
+    }
+}
+
+// False on a run that reaches past end or past the bitset, as in a damaged
+// file; bits is then incomplete.
+bool decompressBits(const unsigned char* p, const unsigned char* end, std::vector<unsigned char>& bits) {
+    std::fill(bits.begin(), bits.end(), 0);
+    size_t pos = 0;
+    while (p < end) {
+        uint32_t zeros, literals;
+        if (!readVarint(p, end, zeros) || !readVarint(p, end, literals)) return false;
+        pos += zeros;
+        if (pos > bits.size() || literals > bits.size() - pos || literals > (size_t)(end - p)) return false;
+        std::memcpy(bits.data() + pos, p, literals);
+        p += literals;
+        pos += literals;
+    }
+    return true;
+}
+
+} // namespace
+
+PotentiallyVisibleSet::PotentiallyVisibleSet()
+    : origin(0.0f), cellSize(1.0f), maxHeight(0.0f), cellsX(0), cellsZ(0),
+    objects(0), hash(0), cachedCell(-1) {}
+
+uint32_t PotentiallyVisibleSet::hashScene(const std::vector<AABB>& boxes) {
+    uint32_t h = 2166136261u;
+    auto mix = [&h](const void* bytes, size_t size) {
+        const unsigned char* p = (const unsigned char*)bytes;
+        for (size_t i = 0; i < size; i++) {
+            h ^= p[i];
+            h *= 16777619u;
+        }
+    };
+    uint32_t count = (uint32_t)boxes.size();
+    mix(&count, sizeof(count));
+    for (const AABB& box : boxes) {
+        float v[6] = { box.min.x, box.min.y, box.min.z, box.max.x, box.max.y, box.max.z };
+        mix(v, sizeof(v));
+    }
+    return h;
+}
+
+void PotentiallyVisibleSet::bake(const std::vector<AABB>& boxes, const std::vector<char>& occluders,
+    const PvsBakeSettings& settings, ThreadPool& pool) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    objects = (int)boxes.size();
+    hash = hashScene(boxes);
+    cellSize = settings.cellSize;
+    maxHeight = settings.eyeMax;
+    cachedCell = -1;
+
+    glm::vec2 lo(1e30f), hi(-1e30f);
+    for (const AABB& box : boxes) {
+        lo = glm::min(lo, glm::vec2(box.min.x, box.min.z));
+        hi = glm::max(hi, glm::vec2(box.max.x, box.max.z));
+    }
+    if (boxes.empty()) lo = hi = glm::vec2(0.0f);
+    origin = lo;
+    cellsX = std::max(1, (int)std::ceil((hi.x - lo.x) / cellSize));
+    cellsZ = std::max(1, (int)std::ceil((hi.y - lo.y) / cellSize));
+    int cellCount = cellsX * cellsZ;
+
+    OccluderGrid grid;
+    grid.build(boxes, occluders, lo, hi, std::max(cellSize * 2.0f, 8.0f));
+
+    // Targets: centre, face centres and corners, pulled slightly inside.
+    std::vector<glm::vec3> targetOffsets;
+    for (int z = -1; z <= 1; z++)
+        for (int y = -1; y <= 1; y++)
+            for (int x = -1; x <= 1; x++) {
+                int nonZero = (x != 0) + (y != 0) + (z != 0);
+                if (nonZero == 0 || nonZero == 1 || nonZero == 3)
+                    targetOffsets.push_back(glm::vec3((float)x, (float)y, (float)z) * 0.9f);
+            }
+
+    size_t bitBytes = (objects + 7) / 8;
+    std::vector<std::vector<unsigned char>> cellStreams(cellCount);
+
+    int chunks = std::min(cellCount, (int)pool.size() * 8);
+    pool.parallelFor(chunks, [&](int chunk) {
+        RayContext ctx;
+        ctx.stamp.assign(objects, 0);
+        ctx.ray = 0;
+        std::vector<unsigned char> bits(bitBytes);
+
+        for (int cell = chunk; cell < cellCount; cell += chunks) {
+            int cx = cell % cellsX, cz = cell / cellsX;
+            glm::vec2 c0 = origin + glm::vec2((float)cx, (float)cz) * cellSize;
+
+            std::vector<glm::vec3> samples;
+            glm::vec2 corners[5] = { c0, c0 + glm::vec2(cellSize, 0.0f), c0 + glm::vec2(0.0f, cellSize),
+                                     c0 + glm::vec2(cellSize), c0 + glm::vec2(cellSize * 0.5f) };
+            for (const glm::vec2& xz : corners) {
+                for (float y : { settings.eyeMin, settings.eyeMax }) {
+                    glm::vec3 p(xz.x, y, xz.y);
+                    bool inside = false;
+                    for (int i : grid.at(p))
+                        if (contains(boxes[i], p)) { inside = true; break; }
+                    if (!inside) samples.push_back(p);
+                }
+            }
+            // Entirely inside buildings: not walkable, leave the cell empty.
+            if (samples.empty()) continue;
+
+            std::fill(bits.begin(), bits.end(), 0);
+            for (int obj = 0; obj < objects; obj++) {
+                const AABB& box = boxes[obj];
+                glm::vec3 center = box.center(), extent = box.extent();
+                bool seen = false;
+                for (size_t s = 0; s < samples.size() && !seen; s++) {
+                    if (contains(box, samples[s])) { seen = true; break; }
+                    for (const glm::vec3& offset : targetOffsets) {
+                        if (!sightBlocked(samples[s], center + offset * extent, obj, grid, boxes, ctx)) {
+                            seen = true;
+                            break;
+                        }
+                    }
+                }
+                if (seen) bits[obj >> 3] |= (unsigned char)(1 << (obj & 7));
+            }
+            compressBits(bits, cellStreams[cell]);
+        }
+    });
+
+    offsets.assign(cellCount + 1, 0);
+    data.clear();
+    for (int cell = 0; cell < cellCount; cell++) {
+        offsets[cell] = (uint32_t)data.size();
+        data.insert(data.end(), cellStreams[cell].begin(), cellStreams[cell].end());
+    }
+    offsets[cellCount] = (uint32_t)data.size();
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "PVS baked: " << cellsX << "x" << cellsZ << " cells, " << objects << " objects, "
+        << data.size() << " bytes (" << bitBytes * cellCount << " uncompressed) in " << ms << " ms" << std::endl;
+}
+
+const unsigned char* PotentiallyVisibleSet::lookup(const glm::vec3& position) {
+    if (!isValid() || position.y > maxHeight) return NULL;
+    int cx = (int)std::floor((position.x - origin.x) / cellSize);
+    int cz = (int)std::floor((position.z - origin.y) / cellSize);
+    if (cx < 0 || cz < 0 || cx >= cellsX || cz >= cellsZ) return NULL;
+
+    int cell = cz * cellsX + cx;
+    if (offsets[cell] == offsets[cell + 1]) return NULL;
+    if (cell != cachedCell) {
+        cachedBits.resize((objects + 7) / 8);
+        if (!decompressBits(data.data() + offsets[cell], data.data() + offsets[cell + 1], cachedBits)) {
+            cachedCell = -1;
+            return NULL;
+        }
+        cachedCell = cell;
+    }
+    return cachedBits.data();
+}
+
+bool PotentiallyVisibleSet::save(const char* path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out) return false;
+    uint32_t header[5] = { hash, (uint32_t)objects, (uint32_t)cellsX, (uint32_t)cellsZ, (uint32_t)data.size() };
+    float params[4] = { origin.x, origin.y, cellSize, maxHeight };
+    out.write(PvsMagic, sizeof(PvsMagic));
+    out.write((const char*)header, sizeof(header));
+    out.write((const char*)params, sizeof(params));
+    out.write((const char*)offsets.data(), offsets.size() * sizeof(uint32_t));
+    out.write((const char*)data.data(), data.size());
+    return (bool)out;
+}
+
+bool PotentiallyVisibleSet::load(const char* path, uint32_t sceneHash) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    uint64_t fileSize = (uint64_t)in.tellg();
+    in.seekg(0);
+    char magic[4];
+    uint32_t header[5];
+    float params[4];
+    in.read(magic, sizeof(magic));
+    in.read((char*)header, sizeof(header));
+    in.read((char*)params, sizeof(params));
+    if (!in || std::memcmp(magic, PvsMagic, sizeof(magic)) != 0 || header[0] != sceneHash)
+        return false;
+    // The counts must account for the rest of the file exactly, before
+    // anything is sized from them.
+    uint64_t cells = (uint64_t)header[2] * header[3];
+    uint64_t expected = sizeof(magic) + sizeof(header) + sizeof(params) + (cells + 1) * sizeof(uint32_t) + header[4];
+    if (expected != fileSize || !(params[2] > 0.0f)) return false;
+
+    hash = header[0];
+    objects = (int)header[1];
+    origin = glm::vec2(params[0], params[1]);
+    cellSize = params[2];
+    maxHeight = params[3];
+    offsets.resize((size_t)header[2] * header[3] + 1);
+    data.resize(header[4]);
+    in.read((char*)offsets.data(), offsets.size() * sizeof(uint32_t));
+    in.read((char*)data.data(), data.size());
+    // Each cell's range must lie inside data; lookup() then bounds every
+    // run within it.
+    bool ordered = (bool)in && offsets.back() <= data.size();
+    for (size_t i = 0; ordered && i + 1 < offsets.size(); i++) ordered = offsets[i] <= offsets[i + 1];
+    if (!ordered) {
+        cellsX = cellsZ = 0;
+        return false;
+    }
+    cellsX = (int)header[2];
+    cellsZ = (int)header[3];
+    cachedCell = -1;
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Culling.h"
+#include "ThreadPool.h"
+
+struct PvsBakeSettings {
+    float cellSize;
+    float eyeMin;       // height band the street-level camera moves in
+    float eyeMax;
+
+    PvsBakeSettings() : cellSize(4.0f), eyeMin(1.0f), eyeMax(8.0f) {}
+};
+
+// Precomputed visibility for a street-level camera. The XZ extent of the
+// scene is split into square cells; for each cell a bitset records which
+// objects can be seen from anywhere in it. Bitsets are stored run-length
+// compressed and expanded for the camera's cell on lookup.
+class PotentiallyVisibleSet {
+public:
+    PotentiallyVisibleSet();
+
+    // objects are indexed exactly as they will be at runtime; occluders[i]
+    // marks objects that block sight (solid buildings).
+    void bake(const std::vector<AABB>& objects, const std::vector<char>& occluders,
+        const PvsBakeSettings& settings, ThreadPool& pool);
+
+    bool save(const char* path) const;
+    // Fails if the file is missing or was baked for a different scene.
+    bool load(const char* path, uint32_t sceneHash);
+    static uint32_t hashScene(const std::vector<AABB>& objects);
+
+    bool isValid() const { return cellsX > 0; }
+
+    // Visibility bits for the cell under position, or NULL outside the baked
+    // volume (then everything should be considered visible).
+    const unsigned char* lookup(const glm::vec3& position);
+    static bool test(const unsigned char* bits, int index) {
+        return (bits[index >> 3] & (1 << (index & 7))) != 0;
+    }
+
+    int objectCount() const { return objects; }
+    size_t compressedBytes() const { return data.size(); }
+
+private:
+    glm::vec2 origin;
+    float cellSize;
+    float maxHeight;
+    int cellsX, cellsZ;
+    int objects;
+    uint32_t hash;
+
+    std::vector<uint32_t> offsets;      // cellsX * cellsZ + 1, into data
+    std::vector<unsigned char> data;
+
+    int cachedCell;
+    std::vector<unsigned char> cachedBits;
+};
+
+#endif
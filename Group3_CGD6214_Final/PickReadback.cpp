@@ -0,0 +1,64 @@
+#include <cstddef>
+#include <GL/glew.h>
+#include "PickReadback.h"
+
+PickReadback::PickReadback() : oldest(0), inFlight(0) {
+    glGenBuffers(Slots, pbo);
+    for (int i = 0; i < Slots; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(uint32_t), NULL, GL_STREAM_READ);
+        fences[i] = NULL;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void PickReadback::request(const RenderTarget& target, int x, int y, uint64_t frame) {
+    if (!target.idTexture || x < 0 || y < 0 || x >= target.width || y >= target.height) return;
+    if (inFlight == Slots) {
+        release(oldest);
+        oldest = (oldest + 1) % Slots;
+        inFlight--;
+    }
+    int slot = (oldest + inFlight) % Slots;
+
+    // With a pack buffer bound the read goes into it, and glReadPixels
+    // returns once the copy is queued.
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[slot]);
+    glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    requests[slot] = Result{ 0, x, y, frame };
+    inFlight++;
+}
+
+bool PickReadback::poll(Result& result) {
+    if (inFlight == 0) return false;
+    GLint status = GL_UNSIGNALED;
+    glGetSynciv((GLsync)fences[oldest], GL_SYNC_STATUS, 1, NULL, &status);
+    if (status != GL_SIGNALED) return false;
+
+    result = requests[oldest];
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[oldest]);
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(uint32_t), &result.id);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    release(oldest);
+    oldest = (oldest + 1) % Slots;
+    inFlight--;
+    return true;
+}
+
+void PickReadback::release(int slot) {
+    if (fences[slot]) glDeleteSync((GLsync)fences[slot]);
+    fences[slot] = NULL;
+}
+
+void PickReadback::destroy() {
+    for (int i = 0; i < Slots; i++) release(i);
+    glDeleteBuffers(Slots, pbo);
+    oldest = inFlight = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef PICKREADBACK_H
+#define PICKREADBACK_H
+
+#include <cstdint>
+#include "RenderTarget.h"
+
+// Reads single pixels of a RenderTarget's ID attachment without stalling.
+// request() only queues a copy of the pixel into a pixel pack buffer and
+// drops a fence after it; poll() checks the oldest fence without waiting
+// and, once the GPU is past it, reads the four bytes back, which by then
+// costs nothing. Results usually arrive one or two frames after the request.
+// A ring of Slots requests can be in flight; a request made while all of
+// them are busy replaces the oldest.
+class PickReadback {
+public:
+    static const int Slots = 3;
+
+    struct Result {
+        uint32_t id;        // entity handle + 1, 0 = nothing
+        int x, y;
+        uint64_t frame;     // as passed to request()
+    };
+
+    PickReadback();
+
+    void request(const RenderTarget& target, int x, int y, uint64_t frame);
+    // The oldest finished request, if any. Never waits on the GPU.
+    bool poll(Result& result);
+    int pending() const { return inFlight; }
+    void destroy();
+
+private:
+    unsigned int pbo[Slots];
+    void* fences[Slots];        // GLsync
+    Result requests[Slots];
+    int oldest;
+    int inFlight;
+
+    void release(int slot);
+};
+
+#endif
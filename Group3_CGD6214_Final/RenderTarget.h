@@ -0,0 +1,38 @@
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+// Off-screen framebuffer the scene is drawn into, so later passes can read
+// its depth. Blitted to the window at the end of the frame.
+//
+// With ids enabled a second, R32UI colour attachment takes what the scene
+// shaders write to output location 1: the entity under each pixel, for
+// picking (see PickReadback).
+class RenderTarget {
+public:
+    unsigned int fbo;
+    unsigned int colorTexture;
+    unsigned int depthTexture;
+    unsigned int idTexture;     // 0 unless ids are enabled
+    int width;
+    int height;
+
+    RenderTarget();
+
+    // Takes effect on the next resize().
+    void enableIds(bool enable);
+    bool hasIds() const { return ids; }
+
+    // (Re)allocates attachments when the size or the attachments change.
+    void resize(int width, int height);
+    void bind() const;
+    // Clears each attachment on its own, ids to 0 (nothing): a blanket
+    // glClear would write the float clear colour into the integer one too.
+    void clear(const float color[4], float depth) const;
+    void blitToScreen() const;
+    void destroy();
+
+private:
+    bool ids;
+};
+
+#endif
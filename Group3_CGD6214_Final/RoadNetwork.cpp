@@ -0,0 +1,173 @@
+#include "RoadNetwork.h"
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+namespace {
+
+float cross2(const glm::vec3& a, const glm::vec3& b) {
+    return a.x * b.z - a.z * b.x;
+}
+
+uint64_t cellKey(int x, int z) {
+    return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z;
+}
+
+// Merges points closer than the snap distance into one node.
+class NodeSnapper {
+public:
+    NodeSnapper(std::vector<RoadNode>& nodes, float distance) : nodes(nodes), distance(distance) {}
+
+    int find(const glm::vec3& p) {
+        int cx = (int)std::floor(p.x / distance), cz = (int)std::floor(p.z / distance);
+        for (int z = cz - 1; z <= cz + 1; z++) {
+            for (int x = cx - 1; x <= cx + 1; x++) {
+                auto it = cells.find(cellKey(x, z));
+                if (it == cells.end()) continue;
+                for (int n : it->second) {
+                    glm::vec3 d = nodes[n].position - p;
+                    if (d.x * d.x + d.z * d.z <= distance * distance) return n;
+                }
+            }
+        }
+        RoadNode node;
+        node.position = p;
+        nodes.push_back(node);
+        cells[cellKey(cx, cz)].push_back((int)nodes.size() - 1);
+        return (int)nodes.size() - 1;
+    }
+
+private:
+    std::vector<RoadNode>& nodes;
+    float distance;
+    std::unordered_map<uint64_t, std::vector<int>> cells;
+};
+
+}
+
+void RoadNetwork::clear() {
+    roads.clear();
+    nodes.clear();
+    edges.clear();
+}
+
+void RoadNetwork::addRoad(const glm::vec3& a, const glm::vec3& b, float width) {
+    Road road = { a, b, width };
+    roads.push_back(road);
+}
+
+void RoadNetwork::addRoads(const Scene& scene, const World& world) {
+    for (size_t i = 0; i < world.buildings.size(); i++) {
+        if (world.buildings[i].type != BuildingType::ROAD) continue;
+        const Node* node = scene.get(world.buildings.entity(i));
+        if (!node) continue;
+        // The mesh is a unit cube, so each axis is a full side of the box.
+        const Affine3x4& m = node->worldTransform;
+        glm::vec3 x = m.axis(0), z = m.axis(2);
+        bool alongX = glm::length(x) >= glm::length(z);
+        glm::vec3 half = (alongX ? x : z) * 0.5f;
+        glm::vec3 center(node->worldPosition);
+        center.y += glm::length(m.axis(1)) * 0.5f;
+        half.y = 0.0f;
+        addRoad(center - half, center + half, glm::length(alongX ? z : x));
+    }
+}
+
+void RoadNetwork::build() {
+    nodes.clear();
+    edges.clear();
+
+    // Where each road gets cut: its two ends, moved onto a crossing road's
+    // centreline when they stop inside it, plus every crossing in between.
+    struct Cut {
+        float t;
+        glm::vec3 point;
+        bool operator<(const Cut& o) const { return t < o.t; }
+    };
+    std::vector<glm::vec3> starts(roads.size()), ends(roads.size());
+    std::vector<std::vector<Cut>> cuts(roads.size());
+    for (size_t i = 0; i < roads.size(); i++) {
+        starts[i] = roads[i].a;
+        ends[i] = roads[i].b;
+    }
+    for (size_t i = 0; i < roads.size(); i++) {
+        const Road& r = roads[i];
+        glm::vec3 d1 = r.b - r.a;
+        float len1 = std::sqrt(d1.x * d1.x + d1.z * d1.z);
+        for (size_t j = i + 1; j < roads.size(); j++) {
+            const Road& o = roads[j];
+            glm::vec3 d2 = o.b - o.a;
+            float len2 = std::sqrt(d2.x * d2.x + d2.z * d2.z);
+            float denom = cross2(d1, d2);
+            if (std::fabs(denom) <= 1e-4f * len1 * len2) continue;
+            glm::vec3 ab = o.a - r.a;
+            float t = cross2(ab, d2) / denom;
+            float u = cross2(ab, d1) / denom;
+            // An end may stop anywhere inside the other road's width.
+            float reach1 = (o.width * 0.5f + settings.snapDistance) / len1;
+            float reach2 = (r.width * 0.5f + settings.snapDistance) / len2;
+            if (t < -reach1 || t > 1.0f + reach1 || u < -reach2 || u > 1.0f + reach2) continue;
+            // Surface height from this road, clamped to its ends.
+            glm::vec3 point = r.a + d1 * std::min(std::max(t, 0.0f), 1.0f);
+            point.x = r.a.x + d1.x * t;
+            point.z = r.a.z + d1.z * t;
+
+            if (t <= reach1) starts[i] = point;
+            else if (t >= 1.0f - reach1) ends[i] = point;
+            else cuts[i].push_back(Cut{ t, point });
+            if (u <= reach2) starts[j] = point;
+            else if (u >= 1.0f - reach2) ends[j] = point;
+            else cuts[j].push_back(Cut{ u, point });
+        }
+    }
+
+    NodeSnapper snapper(nodes, settings.snapDistance);
+    std::vector<int> path;
+    for (size_t i = 0; i < roads.size(); i++) {
+        std::sort(cuts[i].begin(), cuts[i].end());
+        path.clear();
+        path.push_back(snapper.find(starts[i]));
+        for (const Cut& c : cuts[i]) path.push_back(snapper.find(c.point));
+        path.push_back(snapper.find(ends[i]));
+
+        int lanes = std::max(1, (int)(roads[i].width * 0.5f / settings.laneWidth));
+        float laneWidth = roads[i].width * 0.5f / lanes;
+        for (size_t k = 0; k + 1 < path.size(); k++) {
+            int a = path[k], b = path[k + 1];
+            if (a == b) continue;
+            glm::vec3 d = nodes[b].position - nodes[a].position;
+            float length = glm::length(d);
+            if (length <= settings.snapDistance) continue;
+
+            int forward = (int)edges.size();
+            for (int side = 0; side < 2; side++) {
+                RoadEdge e;
+                e.from = side == 0 ? a : b;
+                e.to = side == 0 ? b : a;
+                e.reverse = side == 0 ? forward + 1 : forward;
+                e.lanes = lanes;
+                e.laneWidth = laneWidth;
+                e.length = length;
+                e.start = nodes[e.from].position;
+                e.direction = (side == 0 ? d : -d) / length;
+                e.right = glm::normalize(glm::cross(e.direction, glm::vec3(0.0f, 1.0f, 0.0f)));
+                e.rotation = glm::angleAxis(std::atan2(e.direction.x, e.direction.z), glm::vec3(0.0f, 1.0f, 0.0f));
+                nodes[e.from].outgoing.push_back((int)edges.size());
+                nodes[e.to].incoming.push_back((int)edges.size());
+                edges.push_back(e);
+            }
+        }
+    }
+}
+
+int RoadNetwork::laneCount() const {
+    int count = 0;
+    for (const RoadEdge& e : edges) count += e.lanes;
+    return count;
+}
+
+int RoadNetwork::intersectionCount() const {
+    int count = 0;
+    for (const RoadNode& n : nodes) count += n.incoming.size() >= 3;
+    return count;
+}
@@ -0,0 +1,67 @@
+#ifndef ROADNETWORK_H
+#define ROADNETWORK_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "Scene.h"
+#include "World.h"
+
+struct RoadSettings {
+    float laneWidth;        // lanes per direction = half the road width / this, at least one
+    float snapDistance;     // road ends closer than this meet at one node
+
+    RoadSettings() : laneWidth(3.0f), snapDistance(0.5f) {}
+};
+
+struct RoadNode {
+    glm::vec3 position;         // on the road surface
+    std::vector<int> outgoing;  // edge indices
+    std::vector<int> incoming;
+};
+
+// One direction of the road between two nodes. Lanes are numbered from the
+// centreline outwards, on the right of the direction of travel.
+struct RoadEdge {
+    int from, to;
+    int reverse;            // the same road driven the other way
+    int lanes;
+    float laneWidth;
+    float length;
+    glm::vec3 start;        // centreline at from
+    glm::vec3 direction;    // unit
+    glm::vec3 right;        // unit
+    glm::quat rotation;     // turns +z onto direction
+};
+
+// Directed graph of the city's roads. Every ROAD box becomes a centreline
+// along its long side. Where two centrelines cross, or one road ends inside
+// another, both are split at one shared intersection node, and each piece
+// becomes a pair of opposite edges.
+class RoadNetwork {
+public:
+    RoadSettings settings;
+    std::vector<RoadNode> nodes;
+    std::vector<RoadEdge> edges;
+
+    void clear();
+    // Collects a road running from a to b (y is the surface height); the
+    // graph is made by build() once all roads are in.
+    void addRoad(const glm::vec3& a, const glm::vec3& b, float width);
+    // Every ROAD entity of world, read from its node's world transform.
+    void addRoads(const Scene& scene, const World& world);
+    void build();
+
+    int laneCount() const;
+    // Nodes where three or more roads meet.
+    int intersectionCount() const;
+
+private:
+    struct Road {
+        glm::vec3 a, b;
+        float width;
+    };
+    std::vector<Road> roads;
+};
+
+#endif
@@ -0,0 +1,247 @@
+#include "RoutePlanner.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+namespace {
+
+typedef std::chrono::high_resolution_clock Clock;
+
+const float Unreachable = 3.0e38f;
+
+typedef std::pair<float, int> HeapEntry;
+
+// Distances from source to every node. Edges come in opposite pairs of the
+// same length, so these are also the distances back to source.
+void dijkstra(const RoadNetwork& network, int source, std::vector<float>& distance) {
+    distance.assign(network.nodes.size(), Unreachable);
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> open;
+    distance[source] = 0.0f;
+    open.push(HeapEntry(0.0f, source));
+    while (!open.empty()) {
+        HeapEntry top = open.top();
+        open.pop();
+        if (top.first > distance[top.second]) continue;
+        for (int e : network.nodes[top.second].outgoing) {
+            const RoadEdge& edge = network.edges[e];
+            float d = top.first + edge.length;
+            if (d < distance[edge.to]) {
+                distance[edge.to] = d;
+                open.push(HeapEntry(d, edge.to));
+            }
+        }
+    }
+}
+
+uint64_t pairKey(const RouteRequest& r) {
+    return ((uint64_t)(uint32_t)r.from << 32) | (uint32_t)r.to;
+}
+
+}
+
+RoutePlanner::RoutePlanner(const RoadNetwork& network, ThreadPool& pool)
+    : network(network), pool(pool), landmarks(0) {}
+
+void RoutePlanner::preprocess() {
+    auto start = Clock::now();
+    clearCache();
+    landmarks = 0;
+    landmarkDistance.clear();
+    size_t nodeCount = network.nodes.size();
+    if (nodeCount == 0 || settings.landmarks <= 0) {
+        counters.preprocessMs = 0.0;
+        return;
+    }
+
+    // Landmarks on the rim work best: split the plane into sectors around
+    // the middle of the network and take the farthest node in each.
+    glm::vec3 lo = network.nodes[0].position, hi = lo;
+    for (const RoadNode& n : network.nodes) {
+        lo = glm::min(lo, n.position);
+        hi = glm::max(hi, n.position);
+    }
+    glm::vec3 center = (lo + hi) * 0.5f;
+    int sectors = settings.landmarks;
+    std::vector<int> chosen(sectors, -1);
+    std::vector<float> farthest(sectors, -1.0f);
+    for (size_t i = 0; i < nodeCount; i++) {
+        glm::vec3 d = network.nodes[i].position - center;
+        float angle = std::atan2(d.z, d.x) + 3.14159265f;
+        int sector = std::min((int)(angle / 6.2831853f * sectors), sectors - 1);
+        float r = d.x * d.x + d.z * d.z;
+        if (r > farthest[sector]) {
+            farthest[sector] = r;
+            chosen[sector] = (int)i;
+        }
+    }
+    chosen.erase(std::remove(chosen.begin(), chosen.end(), -1), chosen.end());
+    landmarks = (int)chosen.size();
+
+    std::vector<std::vector<float>> distances(landmarks);
+    pool.parallelFor(landmarks, [&](int k) { dijkstra(network, chosen[k], distances[k]); });
+    landmarkDistance.resize(nodeCount * landmarks);
+    for (size_t i = 0; i < nodeCount; i++) {
+        for (int k = 0; k < landmarks; k++)
+            landmarkDistance[i * landmarks + k] = distances[k][i];
+    }
+    counters.preprocessMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+float RoutePlanner::heuristic(int node, int target) const {
+    const float* a = &landmarkDistance[(size_t)node * landmarks];
+    const float* b = &landmarkDistance[(size_t)target * landmarks];
+    float h = 0.0f;
+    for (int k = 0; k < landmarks; k++) {
+        if (a[k] < Unreachable && b[k] < Unreachable)
+            h = std::max(h, std::fabs(b[k] - a[k]));
+    }
+    return h;
+}
+
+bool RoutePlanner::findRoute(int from, int to, Search& search, Route& route) const {
+    route.edges.clear();
+    route.length = 0.0f;
+    route.found = false;
+    size_t nodeCount = network.nodes.size();
+    if (from < 0 || to < 0 || (size_t)from >= nodeCount || (size_t)to >= nodeCount) return false;
+
+    if (search.g.size() != nodeCount) {
+        search.g.assign(nodeCount, 0.0f);
+        search.parentEdge.assign(nodeCount, -1);
+        search.seen.assign(nodeCount, 0);
+        search.closed.assign(nodeCount, 0);
+        search.stamp = 0;
+    }
+    if (++search.stamp == 0) {
+        std::fill(search.seen.begin(), search.seen.end(), 0);
+        std::fill(search.closed.begin(), search.closed.end(), 0);
+        search.stamp = 1;
+    }
+    uint32_t stamp = search.stamp;
+    std::vector<HeapEntry>& heap = search.heap;
+    std::greater<HeapEntry> later;
+    heap.clear();
+    search.settled = 0;
+
+    bool useHeuristic = landmarks > 0;
+    search.g[from] = 0.0f;
+    search.parentEdge[from] = -1;
+    search.seen[from] = stamp;
+    heap.push_back(HeapEntry(useHeuristic ? heuristic(from, to) : 0.0f, from));
+    bool reached = false;
+    while (!heap.empty()) {
+        std::pop_heap(heap.begin(), heap.end(), later);
+        int u = heap.back().second;
+        heap.pop_back();
+        if (search.closed[u] == stamp) continue;
+        search.closed[u] = stamp;
+        search.settled++;
+        if (u == to) {
+            reached = true;
+            break;
+        }
+        for (int e : network.nodes[u].outgoing) {
+            const RoadEdge& edge = network.edges[e];
+            int v = edge.to;
+            if (search.closed[v] == stamp) continue;
+            float g = search.g[u] + edge.length;
+            if (search.seen[v] == stamp && g >= search.g[v]) continue;
+            search.seen[v] = stamp;
+            search.g[v] = g;
+            search.parentEdge[v] = e;
+            heap.push_back(HeapEntry(g + (useHeuristic ? heuristic(v, to) : 0.0f), v));
+            std::push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+    if (!reached) return false;
+
+    for (int u = to; u != from; u = network.edges[search.parentEdge[u]].from)
+        route.edges.push_back(search.parentEdge[u]);
+    std::reverse(route.edges.begin(), route.edges.end());
+    route.length = search.g[to];
+    route.found = true;
+    return true;
+}
+
+void RoutePlanner::route(const std::vector<RouteRequest>& requests, std::vector<Route>& routes,
+    std::vector<float>* latencyUs) {
+    size_t count = requests.size();
+    routes.resize(count);
+    if (latencyUs) latencyUs->assign(count, 0.0f);
+
+    // Cache hits and repeats within the batch are answered here; the rest
+    // are searched for once each.
+    std::vector<size_t> pending;
+    std::vector<std::pair<size_t, size_t>> repeats;     // request, the one it repeats
+    std::unordered_map<uint64_t, size_t> firstOf;
+    for (size_t i = 0; i < count; i++) {
+        auto start = Clock::now();
+        uint64_t key = pairKey(requests[i]);
+        if (cacheGet(key, routes[i])) {
+            counters.cacheHits++;
+            if (latencyUs) (*latencyUs)[i] = std::chrono::duration<float, std::micro>(Clock::now() - start).count();
+            continue;
+        }
+        auto it = firstOf.find(key);
+        if (it != firstOf.end()) {
+            repeats.push_back(std::make_pair(i, it->second));
+            continue;
+        }
+        firstOf[key] = i;
+        pending.push_back(i);
+    }
+    counters.queries += (int)count;
+
+    int chunks = (int)std::min(pending.size(), (size_t)pool.size() * 4);
+    if (searches.size() < (size_t)chunks) searches.resize(chunks);
+    std::vector<int64_t> settled(chunks, 0);
+    pool.parallelFor(chunks, [&](int chunk) {
+        Search& search = searches[chunk];
+        size_t end = pending.size() * (chunk + 1) / chunks;
+        for (size_t j = pending.size() * chunk / chunks; j < end; j++) {
+            size_t i = pending[j];
+            auto start = Clock::now();
+            findRoute(requests[i].from, requests[i].to, search, routes[i]);
+            settled[chunk] += search.settled;
+            if (latencyUs) (*latencyUs)[i] = std::chrono::duration<float, std::micro>(Clock::now() - start).count();
+        }
+    });
+
+    for (int chunk = 0; chunk < chunks; chunk++) counters.settledNodes += settled[chunk];
+    for (size_t i : pending) cachePut(pairKey(requests[i]), routes[i]);
+    for (const std::pair<size_t, size_t>& r : repeats) {
+        routes[r.first] = routes[r.second];
+        if (latencyUs) (*latencyUs)[r.first] = (*latencyUs)[r.second];
+    }
+}
+
+void RoutePlanner::clearCache() {
+    cache.clear();
+    cacheIndex.clear();
+}
+
+bool RoutePlanner::cacheGet(uint64_t key, Route& route) {
+    auto it = cacheIndex.find(key);
+    if (it == cacheIndex.end()) return false;
+    cache.splice(cache.begin(), cache, it->second);
+    route = it->second->second;
+    return true;
+}
+
+void RoutePlanner::cachePut(uint64_t key, const Route& route) {
+    if (settings.cacheSize == 0) return;
+    auto it = cacheIndex.find(key);
+    if (it != cacheIndex.end()) {
+        it->second->second = route;
+        cache.splice(cache.begin(), cache, it->second);
+        return;
+    }
+    cache.push_front(std::make_pair(key, route));
+    cacheIndex[key] = cache.begin();
+    if (cache.size() > settings.cacheSize) {
+        cacheIndex.erase(cache.back().first);
+        cache.pop_back();
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef ROUTEPLANNER_H
+#define ROUTEPLANNER_H
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "RoadNetwork.h"
+#include "ThreadPool.h"
+
+struct RoutingSettings {
+    int landmarks;          // 0 turns the heuristic off (plain Dijkstra)
+    size_t cacheSize;       // routes kept, least recently used dropped first
+
+    RoutingSettings() : landmarks(16), cacheSize(4096) {}
+};
+
+struct RouteRequest {
+    int from, to;           // node indices
+};
+
+struct Route {
+    std::vector<int> edges; // in driving order, empty if from == to or unreachable
+    float length;
+    bool found;
+};
+
+struct RoutingStats {
+    int queries;
+    int cacheHits;
+    int64_t settledNodes;   // summed over searches that ran
+    double preprocessMs;
+
+    RoutingStats() : queries(0), cacheHits(0), settledNodes(0), preprocessMs(0.0) {}
+};
+
+// Shortest paths over a RoadNetwork with A*, landmarks and the triangle
+// inequality (ALT). preprocess() picks landmarks around the edge of the
+// network and stores every node's distance to each; the largest
+// |d(L, target) - d(L, node)| is then a lower bound that steers the search
+// far better than straight-line distance does on a street grid.
+//
+// route() answers a batch: cached pairs first, then the rest spread over the
+// pool, each thread with its own scratch space. Call it from one thread.
+class RoutePlanner {
+public:
+    // Scratch space for one search; reuse it, clearing is free.
+    struct Search {
+        std::vector<float> g;
+        std::vector<int> parentEdge;
+        std::vector<uint32_t> seen;     // g and parentEdge valid when == stamp
+        std::vector<uint32_t> closed;
+        std::vector<std::pair<float, int>> heap;
+        uint32_t stamp;
+        int settled;                    // by the last findRoute
+
+        Search() : stamp(0), settled(0) {}
+    };
+
+    RoutingSettings settings;
+
+    RoutePlanner(const RoadNetwork& network, ThreadPool& pool);
+
+    // Picks the landmarks and runs one Dijkstra from each, on the pool.
+    // Call again after the network or settings.landmarks change.
+    void preprocess();
+
+    // One query on the calling thread, not cached.
+    bool findRoute(int from, int to, Search& search, Route& route) const;
+    // latencyUs, if given, gets each request's time in microseconds.
+    void route(const std::vector<RouteRequest>& requests, std::vector<Route>& routes,
+        std::vector<float>* latencyUs = NULL);
+
+    void clearCache();
+    const RoutingStats& stats() const { return counters; }
+    int landmarkCount() const { return landmarks; }
+
+private:
+    typedef std::list<std::pair<uint64_t, Route>> CacheList;
+
+    const RoadNetwork& network;
+    ThreadPool& pool;
+    int landmarks;
+    std::vector<float> landmarkDistance;    // node-major: [node * landmarks + k]
+    std::vector<Search> searches;           // one per batch chunk
+    CacheList cache;                        // most recently used first
+    std::unordered_map<uint64_t, CacheList::iterator> cacheIndex;
+    RoutingStats counters;
+
+    float heuristic(int node, int target) const;
+    bool cacheGet(uint64_t key, Route& route);
+    void cachePut(uint64_t key, const Route& route);
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include "Scene.h"
+
+void SceneCommandBuffer::push(Type type, NodeHandle parent, NodeHandle node) {
+    commands.push_back(Command());
+    Command& c = commands.back();
+    c.type = type;
+    c.fields = 0;
+    c.parent = parent;
+    c.node = node;
+    c.spawn = 0;
+}
+
+void SceneCommandBuffer::spawn(NodeHandle parent, const glm::dvec3& position, const glm::quat& rotation,
+    const glm::vec3& scale, SpawnCallback onSpawned) {
+    spawns.push_back(std::move(onSpawned));
+    push(Type::Spawn, parent, NodeHandle());
+    Command& c = commands.back();
+    c.spawn = (uint32_t)spawns.size() - 1;
+    c.position = position;
+    c.rotation = rotation;
+    c.scale = scale;
+}
+
+void SceneCommandBuffer::destroySubtree(NodeHandle node) {
+    push(Type::DestroySubtree, NodeHandle(), node);
+}
+
+void SceneCommandBuffer::addChild(NodeHandle parent, NodeHandle child) {
+    push(Type::AddChild, parent, child);
+}
+
+void SceneCommandBuffer::removeChild(NodeHandle parent, NodeHandle child) {
+    push(Type::RemoveChild, parent, child);
+}
+
+void SceneCommandBuffer::setTransform(NodeHandle node, const glm::dvec3& position, const glm::quat& rotation,
+    const glm::vec3& scale) {
+    push(Type::SetTransform, NodeHandle(), node);
+    Command& c = commands.back();
+    c.fields = SetPosition | SetRotation | SetScale;
+    c.position = position;
+    c.rotation = rotation;
+    c.scale = scale;
+}
+
+void SceneCommandBuffer::setPosition(NodeHandle node, const glm::dvec3& position) {
+    push(Type::SetTransform, NodeHandle(), node);
+    commands.back().fields = SetPosition;
+    commands.back().position = position;
+}
+
+void SceneCommandBuffer::setRotation(NodeHandle node, const glm::quat& rotation) {
+    push(Type::SetTransform, NodeHandle(), node);
+    commands.back().fields = SetRotation;
+    commands.back().rotation = rotation;
+}
+
+void SceneCommandBuffer::clear() {
+    commands.clear();
+    spawns.clear();
+}
+
+Scene::Scene() : buffersInUse(0) {
+    rootHandle = create();
+}
+
+void Scene::detach(Node* node) {
+    Node* p = pool.get(node->parent);
+    if (!p) return;
+    if (Node* prev = pool.get(node->prevSibling)) prev->nextSibling = node->nextSibling;
+    else p->firstChild = node->nextSibling;
+    if (Node* next = pool.get(node->nextSibling)) next->prevSibling = node->prevSibling;
+    else p->lastChild = node->prevSibling;
+    node->parent = NodeHandle();
+    node->prevSibling = NodeHandle();
+    node->nextSibling = NodeHandle();
+}
+
+bool Scene::isAncestor(NodeHandle ancestor, NodeHandle node) const {
+    for (Node* n = pool.get(node); n; n = pool.get(n->parent)) {
+        if (n->handle == ancestor) return true;
+    }
+    return false;
+}
+
+void Scene::addChild(NodeHandle parent, NodeHandle child) {
+    Node* p = pool.get(parent);
+    Node* c = pool.get(child);
+    // Refuse edits that would make a cycle.
+    if (!p || !c || isAncestor(child, parent)) return;
+    detach(c);
+
+    c->parent = parent;
+    c->prevSibling = p->lastChild;
+    if (Node* last = pool.get(p->lastChild)) last->nextSibling = child;
+    else p->firstChild = child;
+    p->lastChild = child;
+    c->dirty = true;
+}
+
+void Scene::removeChild(NodeHandle parent, NodeHandle child) {
+    Node* c = pool.get(child);
+    if (c && c->parent == parent) detach(c);
+}
+
+void Scene::destroySubtree(NodeHandle handle) {
+    Node* node = pool.get(handle);
+    if (!node) return;
+    detach(node);
+
+    // Post-order walk over the links, so each node is destroyed after its
+    // children and before its next sibling is visited.
+    Node* n = node;
+    while (true) {
+        while (Node* child = pool.get(n->firstChild)) n = child;
+        Node* next = n->handle == handle ? NULL : pool.get(n->nextSibling);
+        Node* up = n->handle == handle ? NULL : pool.get(n->parent);
+        if (up) up->firstChild = n->nextSibling;
+        pool.destroy(n->handle);
+        if (next) n = next;
+        else if (up) n = up;
+        else break;
+    }
+    if (handle == rootHandle) rootHandle = NodeHandle();
+}
+
+void Scene::queueAddChild(NodeHandle parent, NodeHandle child) {
+    pending.addChild(parent, child);
+}
+
+void Scene::queueRemoveChild(NodeHandle parent, NodeHandle child) {
+    pending.removeChild(parent, child);
+}
+
+void Scene::queueDestroySubtree(NodeHandle handle) {
+    pending.destroySubtree(handle);
+}
+
+int Scene::reserveCommandBuffers(int count) {
+    int first = buffersInUse;
+    buffersInUse += count;
+    while ((int)buffers.size() < buffersInUse)
+        buffers.push_back(std::unique_ptr<SceneCommandBuffer>(new SceneCommandBuffer()));
+    for (int i = first; i < buffersInUse; i++) buffers[i]->clear();
+    return first;
+}
+
+size_t Scene::pendingEdits() const {
+    size_t count = pending.size();
+    for (int i = 0; i < buffersInUse; i++) count += buffers[i]->size();
+    return count;
+}
+
+void Scene::flush() {
+    apply(pending);
+    for (int i = 0; i < buffersInUse; i++) apply(*buffers[i]);
+    buffersInUse = 0;
+}
+
+void Scene::apply(SceneCommandBuffer& buffer) {
+    typedef SceneCommandBuffer::Type Type;
+    // Stale handles resolve to NULL, which every edit already ignores.
+    for (const SceneCommandBuffer::Command& c : buffer.commands) {
+        switch (c.type) {
+        case Type::Spawn: {
+            if (!pool.get(c.parent)) break;
+            const SceneCommandBuffer::SpawnCallback& onSpawned = buffer.spawns[c.spawn];
+            NodeHandle handle = create();
+            Node* node = pool.get(handle);
+            node->position = c.position;
+            node->rotation = c.rotation;
+            node->scale = c.scale;
+            addChild(c.parent, handle);
+            if (onSpawned) onSpawned(handle);
+            break;
+        }
+        case Type::AddChild:       addChild(c.parent, c.node); break;
+        case Type::RemoveChild:    removeChild(c.parent, c.node); break;
+        case Type::DestroySubtree: destroySubtree(c.node); break;
+        case Type::SetTransform:
+            if (Node* node = pool.get(c.node)) {
+                if (c.fields & SceneCommandBuffer::SetPosition) node->position = c.position;
+                if (c.fields & SceneCommandBuffer::SetRotation) node->rotation = c.rotation;
+                if (c.fields & SceneCommandBuffer::SetScale) node->scale = c.scale;
+                node->dirty = true;
+            }
+            break;
+        }
+    }
+    buffer.clear();
+}
+
+void Scene::getChildren(NodeHandle parent, std::vector<NodeHandle>& out) const {
+    Node* p = pool.get(parent);
+    if (!p) return;
+    for (Node* c = pool.get(p->firstChild); c; c = pool.get(c->nextSibling))
+        out.push_back(c->handle);
+}
+
+void Scene::update() {
+    Node* root = pool.get(rootHandle);
+    if (!root) return;
+    root->worldChanged = root->dirty;
+    if (root->dirty) {
+        root->worldTransform = root->localMatrix();
+        root->worldPosition = root->position;
+    }
+    root->dirty = false;
+
+    // Pre-order walk over the sibling links; no stack needed. A node's matrix
+    // is rebuilt only if its own TRS or some ancestor's world changed.
+    Node* n = pool.get(root->firstChild);
+    while (n) {
+        Node* p = pool.get(n->parent);
+        n->worldChanged = n->dirty || p->worldChanged;
+        if (n->worldChanged) {
+            n->worldTransform = p->worldTransform * n->localMatrix();
+            n->worldPosition = p->worldPosition + p->worldTransform.transformVector(n->position);
+            n->worldTransform.setTranslation(glm::vec3(n->worldPosition));
+        }
+        n->dirty = false;
+        if (Node* child = pool.get(n->firstChild)) {
+            n = child;
+            continue;
+        }
+        while (n != root && !pool.get(n->nextSibling)) n = pool.get(n->parent);
+        n = n == root ? NULL : pool.get(n->nextSibling);
+    }
+}
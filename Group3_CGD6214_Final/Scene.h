@@ -0,0 +1,132 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+#include "Node.h"
+#include "NodePool.h"
+
+class Scene;
+
+// Edits recorded for Scene::flush() to apply. A buffer has one writer at a
+// time and recording is a plain append, so threads that each record into
+// their own never wait on one another or on a lock.
+class SceneCommandBuffer {
+public:
+    // Called by flush() with the new node, on the flushing thread; it may
+    // use the Scene directly but not record into buffers being flushed.
+    typedef std::function<void(NodeHandle)> SpawnCallback;
+
+    // Creates a node with the given local transform under parent.
+    void spawn(NodeHandle parent, const glm::dvec3& position, const glm::quat& rotation, const glm::vec3& scale,
+        SpawnCallback onSpawned = SpawnCallback());
+    void destroySubtree(NodeHandle node);
+    void addChild(NodeHandle parent, NodeHandle child);
+    void reparent(NodeHandle child, NodeHandle newParent) { addChild(newParent, child); }
+    void removeChild(NodeHandle parent, NodeHandle child);
+    void setTransform(NodeHandle node, const glm::dvec3& position, const glm::quat& rotation, const glm::vec3& scale);
+    void setPosition(NodeHandle node, const glm::dvec3& position);
+    void setRotation(NodeHandle node, const glm::quat& rotation);
+
+    size_t size() const { return commands.size(); }
+    bool empty() const { return commands.empty(); }
+    // Keeps the memory for the next frame.
+    void clear();
+
+private:
+    friend class Scene;
+
+    enum class Type { Spawn, AddChild, RemoveChild, DestroySubtree, SetTransform };
+    enum { SetPosition = 1, SetRotation = 2, SetScale = 4 };
+    struct Command {
+        Type type;
+        int fields;             // SetTransform: which of the three to write
+        NodeHandle parent;
+        NodeHandle node;
+        uint32_t spawn;         // Spawn: index into spawns
+        glm::dvec3 position;
+        glm::quat rotation;
+        glm::vec3 scale;
+    };
+    std::vector<Command> commands;
+    std::vector<SpawnCallback> spawns;
+
+    void push(Type type, NodeHandle parent, NodeHandle node);
+};
+
+// Owns every node of a hierarchy. Nodes are created in place in the pool and
+// handed out as handles; a destroyed node's handle simply stops resolving.
+//
+// Structural edits come in two flavours: the immediate ones below, for setup
+// code, and queue* versions that are recorded and applied by flush(). Game
+// code running while the hierarchy is being walked should use the queue and
+// flush once per frame at a point where nothing is iterating. Work spread
+// over threads records into command buffers of its own instead, handed out
+// by reserveCommandBuffers(); flush() applies the queue first and then the
+// buffers in slot order, so the outcome never depends on which thread got
+// there first.
+class Scene {
+public:
+    Scene();
+
+    // Creating is always safe: the node is not linked anywhere until added.
+    NodeHandle create() {
+        NodeHandle handle = pool.create();
+        pool.get(handle)->handle = handle;
+        return handle;
+    }
+
+    // Appends child to parent, detaching it from its old parent first.
+    // The child's world transform is recomputed on the next update.
+    void addChild(NodeHandle parent, NodeHandle child);
+    void reparent(NodeHandle child, NodeHandle newParent) { addChild(newParent, child); }
+    // Detaches child; it stays alive, unparented and not updated, until it is
+    // added again or destroyed (or the scene goes away).
+    void removeChild(NodeHandle parent, NodeHandle child);
+    // Destroys the node and everything below it.
+    void destroySubtree(NodeHandle handle);
+
+    void queueAddChild(NodeHandle parent, NodeHandle child);
+    void queueReparent(NodeHandle child, NodeHandle newParent) { queueAddChild(newParent, child); }
+    void queueRemoveChild(NodeHandle parent, NodeHandle child);
+    void queueDestroySubtree(NodeHandle handle);
+
+    // count empty buffers for the next flush, one per worker or parallelFor
+    // chunk; returns the slot of the first. Call from the thread that calls
+    // flush, before the workers start; commandBuffer() is then safe from any
+    // thread.
+    int reserveCommandBuffers(int count);
+    SceneCommandBuffer& commandBuffer(int slot) const { return *buffers[slot]; }
+
+    // Applies queued edits in the order they were recorded, then each
+    // reserved buffer in slot order. Edits on handles that went stale in
+    // the meantime are dropped.
+    void flush();
+    size_t pendingEdits() const;
+
+    Node* get(NodeHandle handle) const { return pool.get(handle); }
+
+    NodeHandle root() const { return rootHandle; }
+    NodePool& nodes() { return pool; }
+
+    // Direct children in order, appended to out.
+    void getChildren(NodeHandle parent, std::vector<NodeHandle>& out) const;
+
+    // Recomputes world transforms top-down from the root, skipping subtrees
+    // where nothing moved.
+    void update();
+
+private:
+    NodePool pool;
+    NodeHandle rootHandle;
+    SceneCommandBuffer pending;
+    std::vector<std::unique_ptr<SceneCommandBuffer>> buffers;  // kept across frames for their memory
+    int buffersInUse;
+
+    void apply(SceneCommandBuffer& buffer);
+    void detach(Node* node);
+    bool isAncestor(NodeHandle ancestor, NodeHandle node) const;
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include "SceneFile.h"
+#include <cfloat>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static_assert(sizeof(SceneTransform) == 56, "SceneTransform must match the file layout");
+static_assert(sizeof(Renderable) == 8, "Renderable must match the file layout");
+static_assert(sizeof(AABB) == 24, "AABB must match the file layout");
+static_assert(sizeof(BvhNode) == 32, "BvhNode must match the file layout");
+
+static const char SceneMagic[4] = { 'C', 'S', 'C', 'N' };
+
+static uint64_t alignUp(uint64_t v) {
+    return (v + 15) & ~(uint64_t)15;
+}
+
+void SceneData::clear() {
+    parents.clear();
+    transforms.clear();
+    types.clear();
+    colors.clear();
+    renderables.clear();
+}
+
+int32_t SceneData::add(int32_t parent, const glm::dvec3& position, const glm::vec3& scale, BuildingType type,
+    const Renderable& renderable) {
+    SceneTransform t = { position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), scale, 0.0f };
+    parents.push_back(parent);
+    transforms.push_back(t);
+    types.push_back((uint8_t)type);
+    colors.push_back(buildingColor(type));
+    renderables.push_back(renderable);
+    return (int32_t)parents.size() - 1;
+}
+
+int32_t SceneData::addGroup(int32_t parent, const glm::dvec3& position) {
+    SceneTransform t = { position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f), 0.0f };
+    Renderable none = { -1, -1 };
+    parents.push_back(parent);
+    transforms.push_back(t);
+    types.push_back(SceneFile::GroupNode);
+    colors.push_back(glm::vec3(1.0f));
+    renderables.push_back(none);
+    return (int32_t)parents.size() - 1;
+}
+
+SceneData SceneData::capture(const Scene& scene, const World& world) {
+    SceneData data;
+    // (handle, parent index) pairs; children pushed in reverse to keep order.
+    std::vector<std::pair<NodeHandle, int32_t> > stack;
+    std::vector<NodeHandle> children;
+    scene.getChildren(scene.root(), children);
+    for (size_t i = children.size(); i > 0; i--)
+        stack.push_back(std::make_pair(children[i - 1], -1));
+
+    while (!stack.empty()) {
+        NodeHandle h = stack.back().first;
+        int32_t parent = stack.back().second;
+        stack.pop_back();
+        const Node* node = scene.get(h);
+        if (!node) continue;
+
+        SceneTransform t = { node->position, node->rotation, node->scale, 0.0f };
+        const BuildingInfo* info = world.buildings.get(h);
+        const Color* color = world.colors.get(h);
+        const Renderable* renderable = world.renderables.get(h);
+        Renderable none = { -1, -1 };
+        data.parents.push_back(parent);
+        data.transforms.push_back(t);
+        data.types.push_back(info ? (uint8_t)info->type : SceneFile::GroupNode);
+        data.colors.push_back(color ? color->value : glm::vec3(1.0f));
+        data.renderables.push_back(renderable ? *renderable : none);
+
+        int32_t index = (int32_t)data.parents.size() - 1;
+        children.clear();
+        scene.getChildren(h, children);
+        for (size_t i = children.size(); i > 0; i--)
+            stack.push_back(std::make_pair(children[i - 1], index));
+    }
+    return data;
+}
+
+uint64_t SceneFile::sectionBytes(const Header& h, SectionId id) {
+    switch (id) {
+    case SectionParents:     return (uint64_t)h.nodeCount * sizeof(int32_t);
+    case SectionTransforms:  return (uint64_t)h.nodeCount * sizeof(SceneTransform);
+    case SectionTypes:       return (uint64_t)h.nodeCount * sizeof(uint8_t);
+    case SectionColors:      return (uint64_t)h.nodeCount * sizeof(glm::vec3);
+    case SectionRenderables: return (uint64_t)h.nodeCount * sizeof(Renderable);
+    case SectionBounds:      return (uint64_t)h.buildingCount * sizeof(AABB);
+    case SectionBvhNodes:    return (uint64_t)h.bvhNodeCount * sizeof(BvhNode);
+    case SectionBvhItems:    return (uint64_t)h.bvhItemCount * sizeof(uint32_t);
+    default:                 return 0;
+    }
+}
+
+bool SceneFile::build(const SceneData& data, std::vector<unsigned char>& image) {
+    size_t n = data.size();
+
+    // World transforms in file order; parents are always already done.
+    std::vector<Affine3x4> world(n);
+    std::vector<AABB> bounds;
+    bounds.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        const SceneTransform& t = data.transforms[i];
+        Affine3x4 local = Affine3x4::fromTRS(glm::vec3(t.position), t.rotation, t.scale);
+        int32_t p = data.parents[i];
+        if (p >= (int32_t)i) {
+            std::cout << "ERROR::SCENEFILE::PARENT_AFTER_CHILD " << i << std::endl;
+            return false;
+        }
+        world[i] = p >= 0 ? world[p] * local : local;
+        if (data.types[i] < BuildingTypeCount) bounds.push_back(transformUnitCube(world[i]));
+    }
+
+    Bvh bvh;
+    bvh.build(bounds.data(), (uint32_t)bounds.size());
+
+    Header h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, SceneMagic, 4);
+    h.version = Version;
+    h.nodeCount = (uint32_t)n;
+    h.buildingCount = (uint32_t)bounds.size();
+    h.bvhNodeCount = (uint32_t)bvh.nodes.size();
+    h.bvhItemCount = (uint32_t)bvh.items.size();
+    uint64_t offset = alignUp(sizeof(Header));
+    for (int s = 0; s < SectionCount; s++) {
+        h.offsets[s] = offset;
+        offset = alignUp(offset + sectionBytes(h, (SectionId)s));
+    }
+    h.fileSize = offset;
+
+    const void* sources[SectionCount] = {
+        data.parents.data(), data.transforms.data(), data.types.data(), data.colors.data(),
+        data.renderables.data(), bounds.data(), bvh.nodes.data(), bvh.items.data()
+    };
+
+    image.assign((size_t)h.fileSize, 0);
+    std::memcpy(image.data(), &h, sizeof(h));
+    for (int s = 0; s < SectionCount; s++) {
+        uint64_t bytes = sectionBytes(h, (SectionId)s);
+        if (bytes) std::memcpy(image.data() + h.offsets[s], sources[s], (size_t)bytes);
+    }
+    return true;
+}
+
+bool SceneFile::write(const char* path, const SceneData& data) {
+    std::vector<unsigned char> image;
+    return build(data, image) && writeImage(path, image);
+}
+
+bool SceneFile::writeImage(const char* path, const std::vector<unsigned char>& image) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        std::cout << "ERROR::SCENEFILE::CANNOT_WRITE " << path << std::endl;
+        return false;
+    }
+    out.write((const char*)image.data(), (std::streamsize)image.size());
+    return (bool)out;
+}
+
+SceneFile::SceneFile() : base(NULL), header(NULL) {}
+
+bool SceneFile::open(const char* path) {
+    close();
+    if (!file.open(path)) return false;
+    if (!attach(file.data(), file.size())) {
+        std::cout << "ERROR::SCENEFILE::INVALID " << path << std::endl;
+        file.close();
+        return false;
+    }
+    return true;
+}
+
+bool SceneFile::openImage(std::vector<unsigned char>& image) {
+    close();
+    ownedImage.swap(image);
+    if (!attach(ownedImage.data(), ownedImage.size())) {
+        std::cout << "ERROR::SCENEFILE::INVALID image" << std::endl;
+        ownedImage.clear();
+        return false;
+    }
+    return true;
+}
+
+bool SceneFile::attach(const unsigned char* bytes, size_t size) {
+    const Header* h = (const Header*)bytes;
+    if (size < sizeof(Header) || std::memcmp(h->magic, SceneMagic, 4) != 0) return false;
+    if (h->version != Version) {
+        std::cout << "ERROR::SCENEFILE::VERSION " << h->version << " (expected " << Version << ")" << std::endl;
+        return false;
+    }
+    if (h->fileSize != size || h->buildingCount > h->nodeCount) return false;
+    for (int s = 0; s < SectionCount; s++) {
+        if (h->offsets[s] % 16 != 0 || h->offsets[s] + sectionBytes(*h, (SectionId)s) > size) return false;
+    }
+    // instantiate() takes one bounds entry per building-typed node.
+    const uint8_t* type = bytes + h->offsets[SectionTypes];
+    uint32_t typed = 0;
+    for (uint32_t i = 0; i < h->nodeCount; i++) typed += type[i] < BuildingTypeCount;
+    if (typed != h->buildingCount) return false;
+    // Traversal trusts the BVH, so a corrupt one must not get that far.
+    BvhView v;
+    v.nodes = (const BvhNode*)(bytes + h->offsets[SectionBvhNodes]);
+    v.items = (const uint32_t*)(bytes + h->offsets[SectionBvhItems]);
+    v.nodeCount = h->bvhNodeCount;
+    if (!v.validate(h->bvhItemCount, h->buildingCount)) {
+        std::cout << "ERROR::SCENEFILE::BVH" << std::endl;
+        return false;
+    }
+    base = bytes;
+    header = h;
+    return true;
+}
+
+void SceneFile::close() {
+    header = NULL;
+    base = NULL;
+    file.close();
+    ownedImage.clear();
+}
+
+uint32_t SceneFile::nodeCount() const {
+    return header ? header->nodeCount : 0;
+}
+
+uint32_t SceneFile::buildingCount() const {
+    return header ? header->buildingCount : 0;
+}
+
+BvhView SceneFile::bvh() const {
+    BvhView v;
+    if (!header) return v;
+    v.nodes = (const BvhNode*)section(SectionBvhNodes);
+    v.items = (const uint32_t*)section(SectionBvhItems);
+    v.nodeCount = header->bvhNodeCount;
+    return v;
+}
+
+void SceneFile::prefetch() const {
+    if (!header) return;
+    const size_t page = 4096;
+    volatile unsigned char sink = 0;
+    for (size_t offset = 0; offset < header->fileSize; offset += page)
+        sink = sink + base[offset];
+}
+
+void SceneFile::instantiate(Scene& scene, BuildingFactory& factory, World& world) const {
+    SceneInstantiation progress;
+    instantiate(scene, factory, world, progress, nodeCount());
+}
+
+bool SceneFile::instantiate(Scene& scene, BuildingFactory& factory, World& world,
+    SceneInstantiation& progress, uint32_t maxNodes) const {
+    uint32_t n = nodeCount();
+    const int32_t* parent = parents();
+    const SceneTransform* transform = transforms();
+    const uint8_t* type = types();
+    const AABB* box = bounds();
+
+    NodeHandle top = progress.parent.isNull() ? scene.root() : progress.parent;
+    std::vector<Entity>& entities = progress.entities;
+    entities.resize(n);
+    uint32_t end = n - progress.next > maxNodes ? progress.next + maxNodes : n;
+    for (uint32_t i = progress.next; i < end; i++) {
+        NodeHandle p = parent[i] >= 0 && (uint32_t)parent[i] < i ? entities[parent[i]] : top;
+        const SceneTransform& t = transform[i];
+        if (type[i] >= BuildingTypeCount) {
+            Entity e = scene.create();
+            Node* node = scene.get(e);
+            node->setPosition(t.position);
+            node->setRotation(t.rotation);
+            node->setScale(t.scale);
+            scene.addChild(p, e);
+            entities[i] = e;
+            continue;
+        }
+        Entity e = factory.create(p, t.position, t.rotation, t.scale, (BuildingType)type[i]);
+        world.colors.get(e)->value = colors()[i];
+        const Renderable& r = renderables()[i];
+        if (r.mesh >= 0 && r.mesh < (int)world.meshes.size() && r.material >= 0 && r.material < (int)world.materials.size())
+            *world.renderables.get(e) = r;
+        world.bounds.get(e)->box = box[progress.buildings.size()];
+        progress.buildings.push_back(e);
+        entities[i] = e;
+    }
+    progress.next = end;
+    return end == n;
+}
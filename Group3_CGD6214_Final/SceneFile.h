@@ -0,0 +1,134 @@
+#ifndef SCENEFILE_H
+#define SCENEFILE_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "Bvh.h"
+#include "BuildingFactory.h"
+#include "Components.h"
+#include "Culling.h"
+#include "MappedFile.h"
+#include "Scene.h"
+#include "World.h"
+
+// Local transform as stored on disk, the Node TRS fields (56 bytes).
+struct SceneTransform {
+    glm::dvec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+    float padding;
+};
+
+// A scene as flat arrays, in file order. Parents come before their children;
+// parent -1 means the scene root. Nodes whose type is not a BuildingType
+// (SceneFile::GroupNode) only carry a transform.
+struct SceneData {
+    std::vector<int32_t> parents;
+    std::vector<SceneTransform> transforms;
+    std::vector<uint8_t> types;
+    std::vector<glm::vec3> colors;
+    std::vector<Renderable> renderables;
+
+    size_t size() const { return parents.size(); }
+    void clear();
+    // Appends a building with its type's default colour; returns its index.
+    int32_t add(int32_t parent, const glm::dvec3& position, const glm::vec3& scale, BuildingType type,
+        const Renderable& renderable);
+    int32_t addGroup(int32_t parent, const glm::dvec3& position);
+
+    // Flattens everything under the scene root, depth first.
+    static SceneData capture(const Scene& scene, const World& world);
+};
+
+// Progress of an incremental SceneFile::instantiate(). Root-level nodes of
+// the file go under parent (the scene root when null).
+struct SceneInstantiation {
+    NodeHandle parent;
+    std::vector<Entity> entities;   // per file node, filled up to next
+    std::vector<Entity> buildings;  // per building, in bounds()/BVH item order
+    uint32_t next;
+
+    SceneInstantiation() : next(0) {}
+};
+
+// Versioned binary scene ("CSCN"). A header is followed by 16-byte aligned
+// arrays: parents, transforms, types, colours and renderables per node, then
+// world-space bounds per building (in file order, group nodes skipped) and a
+// BVH over those bounds. open() maps the file, checks the header and every
+// BVH node and item against the counts, and then uses the arrays in place.
+// Little-endian, as written. Culling runs off the mapped bounds and BVH;
+// drawing still needs runtime nodes, which instantiate() creates through
+// the factory, one pooled node per file node.
+class SceneFile {
+public:
+    static const uint32_t Version = 2;
+    static const uint8_t GroupNode = 0xFF;
+
+    // Lays out the file image: computes world bounds and the BVH.
+    static bool build(const SceneData& data, std::vector<unsigned char>& image);
+    static bool write(const char* path, const SceneData& data);
+    static bool writeImage(const char* path, const std::vector<unsigned char>& image);
+
+    SceneFile();
+
+    bool open(const char* path);
+    // Uses an image from build() held in memory instead of a mapping; takes
+    // the vector's contents.
+    bool openImage(std::vector<unsigned char>& image);
+    void close();
+    bool isOpen() const { return header != NULL; }
+    // Reads one byte per page so later accesses do not fault; meant for
+    // loader threads.
+    void prefetch() const;
+    size_t sizeBytes() const { return header ? (size_t)header->fileSize : 0; }
+
+    uint32_t nodeCount() const;
+    uint32_t buildingCount() const;
+    const int32_t* parents() const { return (const int32_t*)section(SectionParents); }
+    const SceneTransform* transforms() const { return (const SceneTransform*)section(SectionTransforms); }
+    const uint8_t* types() const { return section(SectionTypes); }
+    const glm::vec3* colors() const { return (const glm::vec3*)section(SectionColors); }
+    const Renderable* renderables() const { return (const Renderable*)section(SectionRenderables); }
+    const AABB* bounds() const { return (const AABB*)section(SectionBounds); }
+    // Items index bounds(), which is also the order buildings get their
+    // Bounds components in instantiate().
+    BvhView bvh() const;
+
+    // Creates the runtime nodes and components, in file order, under the
+    // scene root. Into an empty World, bvh() items then match the indices of
+    // World::bounds. The file can be closed afterwards unless bvh() is kept.
+    void instantiate(Scene& scene, BuildingFactory& factory, World& world) const;
+    // Creates at most maxNodes more nodes; true once the whole file is in.
+    bool instantiate(Scene& scene, BuildingFactory& factory, World& world,
+        SceneInstantiation& progress, uint32_t maxNodes) const;
+
+private:
+    enum SectionId {
+        SectionParents, SectionTransforms, SectionTypes, SectionColors, SectionRenderables,
+        SectionBounds, SectionBvhNodes, SectionBvhItems, SectionCount
+    };
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t nodeCount;
+        uint32_t buildingCount;
+        uint32_t bvhNodeCount;
+        uint32_t bvhItemCount;
+        uint64_t offsets[SectionCount];
+        uint64_t fileSize;
+    };
+
+    MappedFile file;
+    std::vector<unsigned char> ownedImage;
+    const unsigned char* base;
+    const Header* header;
+
+    bool attach(const unsigned char* bytes, size_t size);
+    const unsigned char* section(SectionId id) const { return header ? base + header->offsets[id] : NULL; }
+    static uint64_t sectionBytes(const Header& h, SectionId id);
+};
+
+#endif
@@ -0,0 +1,378 @@
+#include "SceneQuery.h"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENEQUERY_SSE2 1
+#endif
+
+namespace {
+
+// Reciprocal that stays finite, so slab distances never come out as
+// 0 * infinity for rays parallel to a face.
+float safeInverse(float d) {
+    if (std::fabs(d) < 1e-20f) d = d < 0.0f ? -1e-20f : 1e-20f;
+    return 1.0f / d;
+}
+
+struct SlabRay {
+#ifdef SCENEQUERY_SSE2
+    __m128 origin, inverse;
+#else
+    glm::vec3 origin, inverse;
+#endif
+    SlabRay(const Ray& ray) {
+        glm::vec3 inv(safeInverse(ray.direction.x), safeInverse(ray.direction.y), safeInverse(ray.direction.z));
+#ifdef SCENEQUERY_SSE2
+        origin = _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, 0.0f);
+        inverse = _mm_setr_ps(inv.x, inv.y, inv.z, 0.0f);
+#else
+        origin = ray.origin;
+        inverse = inv;
+#endif
+    }
+};
+
+// Whether the ray meets the node's box before maxDistance, and where it
+// enters it (0 if it starts inside).
+bool slab(const SlabRay& r, const BvhNode& n, float maxDistance, float& enter) {
+#ifdef SCENEQUERY_SSE2
+    // The fourth lane loads leftFirst and count, and is never read back.
+    __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&n.min.x), r.origin), r.inverse);
+    __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&n.max.x), r.origin), r.inverse);
+    __m128 near = _mm_min_ps(t0, t1), far = _mm_max_ps(t0, t1);
+    __m128 tNear = _mm_max_ss(_mm_max_ss(near, _mm_shuffle_ps(near, near, 1)),
+        _mm_max_ss(_mm_shuffle_ps(near, near, 2), _mm_setzero_ps()));
+    __m128 tFar = _mm_min_ss(_mm_min_ss(far, _mm_shuffle_ps(far, far, 1)),
+        _mm_min_ss(_mm_shuffle_ps(far, far, 2), _mm_set_ss(maxDistance)));
+    enter = _mm_cvtss_f32(tNear);
+    return _mm_comile_ss(tNear, tFar) != 0;
+#else
+    glm::vec3 t0 = (n.min - r.origin) * r.inverse, t1 = (n.max - r.origin) * r.inverse;
+    glm::vec3 near = glm::min(t0, t1), far = glm::max(t0, t1);
+    enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+    return enter <= std::min(std::min(far.x, far.y), std::min(far.z, maxDistance));
+#endif
+}
+
+}
+
+SceneQuery::SceneQuery(ThreadPool& pool) : pool(pool), staticCount(0) {}
+
+void SceneQuery::setDynamic(const std::vector<Entity>& list) {
+    dynamicEntities = list;
+    dynamicKeys.resize(list.size());
+    for (size_t i = 0; i < list.size(); i++) dynamicKeys[i] = list[i].value;
+    std::sort(dynamicKeys.begin(), dynamicKeys.end());
+}
+
+void SceneQuery::build(const Scene& scene, const World& world) {
+    // Static slots follow world.bounds; dynamic entities keep theirs, left
+    // empty so the static BVH skips them, and come again after.
+    size_t count = world.bounds.size();
+    staticCount = (uint32_t)count;
+    size_t total = count + dynamicEntities.size();
+    entities.resize(total);
+    boxes.resize(total);
+    worldToLocal.resize(total);
+    std::vector<AABB> bounds(count);
+    for (size_t i = 0; i < count; i++) {
+        entities[i] = world.bounds.entity(i);
+        bounds[i] = world.bounds[i].box;
+        const Node* node = scene.get(entities[i]);
+        if (node && !std::binary_search(dynamicKeys.begin(), dynamicKeys.end(), entities[i].value)) {
+            boxes[i] = OBB::fromTransform(node->worldTransform);
+            worldToLocal[i] = affineInverse(node->worldTransform);
+        }
+        else {
+            bounds[i].min = glm::vec3(1.0f);
+            bounds[i].max = glm::vec3(-1.0f);
+        }
+    }
+    bvh.build(bounds.data(), (uint32_t)count);
+
+    std::copy(dynamicEntities.begin(), dynamicEntities.end(), entities.begin() + count);
+    AABB empty;
+    empty.min = glm::vec3(1.0f);
+    empty.max = glm::vec3(-1.0f);
+    dynamicBounds.assign(dynamicEntities.size(), empty);
+    takeDynamicTransforms(scene);
+    dynamicBvh.build(dynamicBounds.data(), (uint32_t)dynamicBounds.size());
+}
+
+void SceneQuery::updateDynamic(const Scene& scene) {
+    takeDynamicTransforms(scene);
+    dynamicBvh.refit(dynamicBounds.data());
+}
+
+void SceneQuery::takeDynamicTransforms(const Scene& scene) {
+    size_t count = dynamicBounds.size();
+    int chunks = (int)std::min(count, (size_t)pool.size() * 8);
+    if (chunks <= 0) return;
+    pool.parallelFor(chunks, [&](int chunk) {
+        size_t end = count * (chunk + 1) / chunks;
+        for (size_t d = count * chunk / chunks; d < end; d++) {
+            size_t i = staticCount + d;
+            const Node* node = entities[i].isNull() ? NULL : scene.get(entities[i]);
+            // A removed entity keeps its last box, so the tree stays valid,
+            // and never hits again.
+            if (!node) {
+                entities[i] = Entity();
+                continue;
+            }
+            boxes[i] = OBB::fromTransform(node->worldTransform);
+            worldToLocal[i] = affineInverse(node->worldTransform);
+            dynamicBounds[d] = boxes[i].bounds();
+        }
+    });
+}
+
+// Slab test against the unit cube in the entity's own frame. The map there
+// is affine, so distances along the local ray are the world ones. The origin
+// is taken relative to the box centre before the inverse's linear part, which
+// keeps the precision the inverse's large translation would lose.
+bool SceneQuery::intersect(uint32_t item, const Ray& ray, float maxDistance, RayHit& hit) const {
+    if (entities[item].isNull()) return false;
+    const Affine3x4& toLocal = worldToLocal[item];
+    glm::vec3 origin = toLocal.transformVector(ray.origin - boxes[item].center);
+    glm::vec3 direction = toLocal.transformVector(ray.direction);
+    float enter = 0.0f, exit = maxDistance;
+    int enterAxis = -1;
+    float enterSign = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        if (std::fabs(direction[k]) < 1e-12f) {
+            if (std::fabs(origin[k]) > 0.5f) return false;
+            continue;
+        }
+        float t0 = (-0.5f - origin[k]) / direction[k], t1 = (0.5f - origin[k]) / direction[k];
+        if (t0 > t1) std::swap(t0, t1);
+        if (t0 > enter) {
+            enter = t0;
+            enterAxis = k;
+            enterSign = direction[k] > 0.0f ? -1.0f : 1.0f;
+        }
+        exit = std::min(exit, t1);
+        if (enter > exit) return false;
+    }
+    hit.entity = entities[item];
+    hit.distance = enter;
+    hit.point = ray.origin + ray.direction * enter;
+    // Local face normals go back to world space by the inverse transpose,
+    // which is a row of the inverse. A ray starting inside hits at once,
+    // facing back along itself.
+    hit.normal = enterAxis >= 0 ? glm::normalize(glm::vec3(toLocal.rows[enterAxis])) * enterSign : -ray.direction;
+    return true;
+}
+
+bool SceneQuery::raycast(const Ray& ray, RayHit& hit) const {
+    hit.entity = Entity();
+    hit.distance = ray.maxDistance;
+    SlabRay r(ray);
+    struct Entry {
+        uint32_t node;
+        float enter;
+    };
+    Entry stack[64];
+    for (int t = 0; t < 2; t++) {
+        const Bvh& tree = t ? dynamicBvh : bvh;
+        uint32_t base = t ? staticCount : 0;
+        float enter;
+        if (tree.nodes.empty() || !slab(r, tree.nodes[0], hit.distance, enter)) continue;
+        int top = 0;
+        stack[top++] = Entry{ 0, enter };
+        while (top > 0) {
+            Entry e = stack[--top];
+            if (e.enter > hit.distance) continue;
+            const BvhNode& n = tree.nodes[e.node];
+            if (n.count) {
+                for (uint32_t i = 0; i < n.count; i++) {
+                    RayHit h;
+                    uint32_t item = base + tree.items[n.leftFirst + i];
+                    if (intersect(item, ray, hit.distance, h) && (hit.entity.isNull() || h.distance < hit.distance))
+                        hit = h;
+                }
+                continue;
+            }
+            // Near child on top, so its hits can cut the far one short.
+            float enterA, enterB;
+            bool a = slab(r, tree.nodes[n.leftFirst], hit.distance, enterA);
+            bool b = slab(r, tree.nodes[n.leftFirst + 1], hit.distance, enterB);
+            if (a && b) {
+                bool aFirst = enterA <= enterB;
+                stack[top++] = aFirst ? Entry{ n.leftFirst + 1, enterB } : Entry{ n.leftFirst, enterA };
+                stack[top++] = aFirst ? Entry{ n.leftFirst, enterA } : Entry{ n.leftFirst + 1, enterB };
+            }
+            else if (a) {
+                stack[top++] = Entry{ n.leftFirst, enterA };
+            }
+            else if (b) {
+                stack[top++] = Entry{ n.leftFirst + 1, enterB };
+            }
+        }
+    }
+    return !hit.entity.isNull();
+}
+
+void SceneQuery::raycastAll(const Ray& ray, std::vector<RayHit>& out) const {
+    out.clear();
+    SlabRay r(ray);
+    uint32_t stack[64];
+    for (int t = 0; t < 2; t++) {
+        const Bvh& tree = t ? dynamicBvh : bvh;
+        uint32_t base = t ? staticCount : 0;
+        if (tree.nodes.empty()) continue;
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BvhNode& n = tree.nodes[stack[--top]];
+            float enter;
+            if (!slab(r, n, ray.maxDistance, enter)) continue;
+            if (n.count) {
+                for (uint32_t i = 0; i < n.count; i++) {
+                    RayHit h;
+                    if (intersect(base + tree.items[n.leftFirst + i], ray, ray.maxDistance, h)) out.push_back(h);
+                }
+            }
+            else {
+                stack[top++] = n.leftFirst;
+                stack[top++] = n.leftFirst + 1;
+            }
+        }
+    }
+    std::sort(out.begin(), out.end(), [](const RayHit& a, const RayHit& b) { return a.distance < b.distance; });
+}
+
+void SceneQuery::overlapBox(const OBB& box, std::vector<Entity>& out) const {
+    out.clear();
+    AABB bounds = box.bounds();
+    bvh.view().queryBox(bounds, [&](uint32_t item) {
+        if (overlaps(box, boxes[item])) out.push_back(entities[item]);
+    });
+    dynamicBvh.view().queryBox(bounds, [&](uint32_t item) {
+        item += staticCount;
+        if (!entities[item].isNull() && overlaps(box, boxes[item])) out.push_back(entities[item]);
+    });
+}
+
+bool SceneQuery::overlapsSphere(uint32_t item, const glm::vec3& center, float radius) const {
+    // Distance to the closest point of the box, in its frame.
+    const OBB& box = boxes[item];
+    glm::vec3 offset = center - box.center;
+    float distance2 = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        float d = glm::dot(offset, box.axes[k]);
+        float outside = std::fabs(d) - box.halfExtents[k];
+        if (outside > 0.0f) distance2 += outside * outside;
+    }
+    return distance2 <= radius * radius;
+}
+
+void SceneQuery::overlapSphere(const glm::vec3& center, float radius, std::vector<Entity>& out) const {
+    out.clear();
+    AABB bounds;
+    bounds.min = center - glm::vec3(radius);
+    bounds.max = center + glm::vec3(radius);
+    bvh.view().queryBox(bounds, [&](uint32_t item) {
+        if (overlapsSphere(item, center, radius)) out.push_back(entities[item]);
+    });
+    dynamicBvh.view().queryBox(bounds, [&](uint32_t item) {
+        item += staticCount;
+        if (!entities[item].isNull() && overlapsSphere(item, center, radius)) out.push_back(entities[item]);
+    });
+}
+
+// Up to four rays down the BVH together. Lanes past count start with a
+// negative reach, so no box ever counts as hit for them. Rays pointing
+// different ways split up early and would drag each other through nodes
+// only one of them needs, so those go one at a time instead.
+void SceneQuery::tracePacket(const Ray* rays, int count, RayHit* hits) const {
+#ifdef SCENEQUERY_SSE2
+    bool coherent = true;
+    for (int l = 1; l < count; l++) coherent = coherent && glm::dot(rays[l].direction, rays[0].direction) > 0.95f;
+    if (!coherent) {
+        for (int l = 0; l < count; l++) raycast(rays[l], hits[l]);
+        return;
+    }
+    float ox[4], oy[4], oz[4], ix[4], iy[4], iz[4], reach[4];
+    for (int l = 0; l < 4; l++) {
+        const Ray& ray = rays[l < count ? l : 0];
+        ox[l] = ray.origin.x;
+        oy[l] = ray.origin.y;
+        oz[l] = ray.origin.z;
+        ix[l] = safeInverse(ray.direction.x);
+        iy[l] = safeInverse(ray.direction.y);
+        iz[l] = safeInverse(ray.direction.z);
+        reach[l] = l < count ? ray.maxDistance : -1.0f;
+        if (l < count) {
+            hits[l].entity = Entity();
+            hits[l].distance = ray.maxDistance;
+        }
+    }
+    const __m128 originX = _mm_loadu_ps(ox), originY = _mm_loadu_ps(oy), originZ = _mm_loadu_ps(oz);
+    const __m128 inverseX = _mm_loadu_ps(ix), inverseY = _mm_loadu_ps(iy), inverseZ = _mm_loadu_ps(iz);
+    const __m128 zero = _mm_setzero_ps();
+    // Which child is nearer is decided by the first ray alone.
+    glm::vec3 lead = rays[0].direction;
+
+    uint32_t stack[64];
+    for (int t = 0; t < 2; t++) {
+        const Bvh& tree = t ? dynamicBvh : bvh;
+        uint32_t base = t ? staticCount : 0;
+        if (tree.nodes.empty()) continue;
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BvhNode& n = tree.nodes[stack[--top]];
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min.x), originX), inverseX);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max.x), originX), inverseX);
+            __m128 near = _mm_min_ps(t0, t1), far = _mm_max_ps(t0, t1);
+            t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min.y), originY), inverseY);
+            t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max.y), originY), inverseY);
+            near = _mm_max_ps(near, _mm_min_ps(t0, t1));
+            far = _mm_min_ps(far, _mm_max_ps(t0, t1));
+            t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.min.z), originZ), inverseZ);
+            t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.max.z), originZ), inverseZ);
+            near = _mm_max_ps(_mm_max_ps(near, _mm_min_ps(t0, t1)), zero);
+            far = _mm_min_ps(_mm_min_ps(far, _mm_max_ps(t0, t1)), _mm_loadu_ps(reach));
+            int lanes = _mm_movemask_ps(_mm_cmple_ps(near, far));
+            if (!lanes) continue;
+
+            if (n.count) {
+                for (int l = 0; l < count; l++) {
+                    if (!(lanes & (1 << l))) continue;
+                    for (uint32_t i = 0; i < n.count; i++) {
+                        RayHit h;
+                        uint32_t item = base + tree.items[n.leftFirst + i];
+                        if (intersect(item, rays[l], reach[l], h) && (hits[l].entity.isNull() || h.distance < reach[l])) {
+                            hits[l] = h;
+                            reach[l] = h.distance;
+                        }
+                    }
+                }
+                continue;
+            }
+            const BvhNode& a = tree.nodes[n.leftFirst];
+            const BvhNode& b = tree.nodes[n.leftFirst + 1];
+            glm::vec3 apart = (b.min + b.max) - (a.min + a.max);
+            bool aFirst = glm::dot(apart, lead) >= 0.0f;
+            stack[top++] = aFirst ? n.leftFirst + 1 : n.leftFirst;
+            stack[top++] = aFirst ? n.leftFirst : n.leftFirst + 1;
+        }
+    }
+#else
+    for (int l = 0; l < count; l++) raycast(rays[l], hits[l]);
+#endif
+}
+
+void SceneQuery::raycastBatch(const Ray* rays, size_t count, RayHit* hits) const {
+    size_t packets = (count + 3) / 4;
+    int chunks = (int)std::min(packets, (size_t)pool.size() * 8);
+    if (chunks <= 0) return;
+    pool.parallelFor(chunks, [&](int chunk) {
+        size_t end = packets * (chunk + 1) / chunks;
+        for (size_t p = packets * chunk / chunks; p < end; p++) {
+            size_t first = p * 4;
+            tracePacket(rays + first, (int)std::min<size_t>(4, count - first), hits + first);
+        }
+    });
+}
@@ -0,0 +1,91 @@
+#ifndef SCENEQUERY_H
+#define SCENEQUERY_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Bvh.h"
+#include "Collision.h"
+#include "Components.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+#include "World.h"
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;    // unit
+    float maxDistance;
+};
+
+struct RayHit {
+    Entity entity;
+    float distance;
+    glm::vec3 point;
+    glm::vec3 normal;       // of the face hit
+};
+
+// Ray casts and overlap tests against the entities with Bounds, answered
+// with their handles. build() takes a snapshot: an oriented box and the
+// inverse world transform per entity (its unit cube after transform, like
+// the building mesh) and a flat BVH over their bounds; call it again after
+// the city changes. Rays meet an entity in its own frame, against the unit
+// cube.
+//
+// Entities that move every frame (cars, animated props) are named with
+// setDynamic() and kept out of that BVH, in a second one of their own that
+// updateDynamic() refits to their current transforms. Only queries need it
+// fresh, so callers refit on the frames they query.
+//
+// A single ray walks the BVH near child first, testing each node box with
+// one SSE slab test over x, y and z, and stops descending once a node
+// starts beyond the closest hit so far. raycastBatch() traces groups of
+// four rays as a packet: each node box is tested against all four lanes at
+// once and the packet descends while any lane still hits, which pays off
+// when the rays are coherent (neighbouring pixels, a fan of sight lines)
+// and walk the same nodes; four rays that point apart are traced one by
+// one. Batches run over the pool.
+class SceneQuery {
+public:
+    explicit SceneQuery(ThreadPool& pool);
+
+    // Call before build(), which leaves these entities out of the static BVH.
+    void setDynamic(const std::vector<Entity>& list);
+    void build(const Scene& scene, const World& world);
+    // Takes the dynamic entities' transforms from the last Scene::update.
+    void updateDynamic(const Scene& scene);
+
+    // Closest hit within maxDistance.
+    bool raycast(const Ray& ray, RayHit& hit) const;
+    // Every hit within maxDistance, nearest first.
+    void raycastAll(const Ray& ray, std::vector<RayHit>& out) const;
+    void overlapBox(const OBB& box, std::vector<Entity>& out) const;
+    void overlapSphere(const glm::vec3& center, float radius, std::vector<Entity>& out) const;
+
+    // hits[i] answers rays[i]; its entity is null where nothing was hit.
+    // Rays are packed four at a time in the order given.
+    void raycastBatch(const Ray* rays, size_t count, RayHit* hits) const;
+
+    size_t entityCount() const { return entities.size(); }
+
+private:
+    ThreadPool& pool;
+    Bvh bvh;
+    Bvh dynamicBvh;                     // items offset by staticCount
+    // world.bounds order, then the dynamic entities again; a dynamic entity
+    // that no longer exists is left in place with a null handle.
+    std::vector<Entity> entities;
+    std::vector<OBB> boxes;
+    std::vector<Affine3x4> worldToLocal;
+    uint32_t staticCount;
+    std::vector<Entity> dynamicEntities;
+    std::vector<uint32_t> dynamicKeys;  // sorted handle values
+    std::vector<AABB> dynamicBounds;
+
+    void takeDynamicTransforms(const Scene& scene);
+
+    bool intersect(uint32_t item, const Ray& ray, float maxDistance, RayHit& hit) const;
+    bool overlapsSphere(uint32_t item, const glm::vec3& center, float radius) const;
+    void tracePacket(const Ray* rays, int count, RayHit* hits) const;
+};
+
+#endif
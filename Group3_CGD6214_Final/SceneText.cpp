@@ -0,0 +1,391 @@
+#include "SceneText.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <sys/stat.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCENETEXT_SSE2 1
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+const size_t MinChunkBytes = 256 * 1024;
+
+const char* const TypeNames[] = { "HOUSE", "SHOP", "SKYSCRAPER", "TREE", "FIELD", "ROAD", "CAR", "MOUNTAIN", "PROP" };
+const char* const GroupName = "GROUP";
+
+struct ParsedNode {
+    int32_t id;
+    int32_t parent;
+    uint32_t line;          // chunk-relative
+    uint8_t type;
+    double values[7];       // position, scale, yaw in degrees
+};
+
+struct Chunk {
+    const char* begin;
+    const char* end;
+    std::vector<ParsedNode> nodes;
+    size_t lines;           // line ends inside the chunk
+    size_t errorLine;       // chunk-relative, meaningful when error is set
+    const char* error;
+};
+
+inline int lowestBit(unsigned int mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+const char* findNewline(const char* p, const char* end) {
+#ifdef SCENETEXT_SSE2
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+        if (mask) return p + lowestBit((unsigned int)mask);
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '\n') p++;
+    return p;
+}
+
+size_t countNewlines(const char* p, const char* end) {
+    size_t count = 0;
+#ifdef SCENETEXT_SSE2
+    const __m128i nl = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        // Matches are -1 per byte; subtracting them counts per lane, and a
+        // lane can take 255 blocks before it has to be summed out.
+        __m128i acc = _mm_setzero_si128();
+        for (int blocks = 0; blocks < 255 && end - p >= 16; blocks++, p += 16)
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+        __m128i sums = _mm_sad_epu8(acc, _mm_setzero_si128());
+        count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+#endif
+    while (p < end) count += *p++ == '\n';
+    return count;
+}
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipSpaces(const char* p, const char* end) {
+    while (p < end && isSpace(*p)) p++;
+    return p;
+}
+
+// Every field has to be followed by whitespace or the end of the line.
+inline bool fieldEnds(const char* p, const char* end) {
+    return p == end || isSpace(*p);
+}
+
+bool parseInt(const char*& p, const char* end, int32_t& out) {
+    bool negative = p < end && *p == '-';
+    if (negative) p++;
+    const char* start = p;
+    int64_t v = 0;
+    while (p < end && *p >= '0' && *p <= '9' && v <= 0x7FFFFFFF) v = v * 10 + (*p++ - '0');
+    if (p == start || v > 0x7FFFFFFF || !fieldEnds(p, end)) return false;
+    out = (int32_t)(negative ? -v : v);
+    return true;
+}
+
+// Plain decimal with optional fraction and exponent; no locale, no strtod.
+bool parseNumber(const char*& p, const char* end, double& out) {
+    static const double Pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+        if (mantissa < 100000000000000000ull) mantissa = mantissa * 10 + (*p - '0');
+        else exponent++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, digits++) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+    if (digits == 0) return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int32_t e;
+        if (!parseInt(p, end, e)) return false;
+        exponent += e;
+    }
+    if (!fieldEnds(p, end)) return false;
+
+    // The mantissa and a power of ten are both exact doubles here, so one
+    // multiply or divide rounds correctly. Longer numbers, like the 17
+    // digits save() writes for positions, go through strtod.
+    if (mantissa > (1ull << 53) || exponent < -22 || exponent > 22) {
+        char buffer[64];
+        size_t length = (size_t)(p - start);
+        if (length >= sizeof(buffer)) return false;
+        std::memcpy(buffer, start, length);
+        buffer[length] = '\0';
+        out = std::strtod(buffer, NULL);
+        return true;
+    }
+    double v = (double)mantissa;
+    if (exponent < 0) v = -exponent <= 22 ? v / Pow10[-exponent] : v * std::pow(10.0, exponent);
+    else if (exponent > 0) v = exponent <= 22 ? v * Pow10[exponent] : v * std::pow(10.0, exponent);
+    out = negative ? -v : v;
+    return true;
+}
+
+bool parseType(const char*& p, const char* end, uint8_t& out) {
+    const char* start = p;
+    while (p < end && !isSpace(*p)) p++;
+    size_t length = (size_t)(p - start);
+    for (int t = 0; t < BuildingTypeCount; t++) {
+        if (std::strlen(TypeNames[t]) == length && std::memcmp(TypeNames[t], start, length) == 0) {
+            out = (uint8_t)t;
+            return true;
+        }
+    }
+    if (length == 5 && std::memcmp(GroupName, start, 5) == 0) {
+        out = SceneFile::GroupNode;
+        return true;
+    }
+    return false;
+}
+
+// Returns NULL on success (including blank and comment lines) or a message.
+const char* parseLine(const char* p, const char* end, ParsedNode& node, bool& hasNode) {
+    hasNode = false;
+    p = skipSpaces(p, end);
+    if (p == end || *p == '#') return NULL;
+
+    if (!parseInt(p, end, node.id) || node.id < 0) return "bad id";
+    p = skipSpaces(p, end);
+    if (!parseInt(p, end, node.parent) || node.parent < -1) return "bad parent";
+    p = skipSpaces(p, end);
+    if (!parseType(p, end, node.type)) return "unknown type";
+    for (int i = 0; i < 6; i++) {
+        p = skipSpaces(p, end);
+        if (!parseNumber(p, end, node.values[i])) return "bad number";
+    }
+    node.values[6] = 0.0;
+    p = skipSpaces(p, end);
+    if (p < end && *p != '#') {
+        if (!parseNumber(p, end, node.values[6])) return "bad yaw";
+        p = skipSpaces(p, end);
+        if (p < end && *p != '#') return "trailing characters";
+    }
+    hasNode = true;
+    return NULL;
+}
+
+void parseChunk(Chunk& chunk) {
+    chunk.lines = countNewlines(chunk.begin, chunk.end);
+    chunk.nodes.reserve(chunk.lines + 1);
+    chunk.error = NULL;
+
+    ParsedNode node;
+    size_t line = 0;
+    for (const char* p = chunk.begin; p < chunk.end; line++) {
+        const char* eol = findNewline(p, chunk.end);
+        bool hasNode;
+        const char* error = parseLine(p, eol, node, hasNode);
+        if (error) {
+            chunk.error = error;
+            chunk.errorLine = line;
+            return;
+        }
+        if (hasNode) {
+            node.line = (uint32_t)line;
+            chunk.nodes.push_back(node);
+        }
+        p = eol + 1;
+    }
+}
+
+}
+
+bool SceneText::parse(const char* text, size_t length, ThreadPool* pool, SceneData& data) {
+    const char* end = text + length;
+
+    // Chunks end right after a line break so no line is split.
+    size_t chunkCount = 1;
+    if (pool) chunkCount = std::max<size_t>(1, std::min<size_t>(pool->size() * 4, length / MinChunkBytes));
+    std::vector<Chunk> chunks(chunkCount);
+    const char* begin = text;
+    for (size_t i = 0; i < chunkCount; i++) {
+        const char* chunkEnd = end;
+        if (i + 1 < chunkCount) {
+            const char* target = std::max(begin, text + length * (i + 1) / chunkCount);
+            chunkEnd = findNewline(target, end);
+            if (chunkEnd < end) chunkEnd++;
+        }
+        chunks[i].begin = begin;
+        chunks[i].end = chunkEnd;
+        begin = chunkEnd;
+    }
+
+    if (pool && chunkCount > 1) pool->parallelFor((int)chunkCount, [&](int i) { parseChunk(chunks[i]); });
+    else parseChunk(chunks[0]);
+
+    size_t total = 0;
+    size_t firstLine = 1;
+    int32_t maxId = -1;
+    for (const Chunk& c : chunks) {
+        if (c.error) {
+            std::cout << "ERROR::SCENETEXT::LINE " << firstLine + c.errorLine << ": " << c.error << std::endl;
+            return false;
+        }
+        total += c.nodes.size();
+        firstLine += c.lines;
+        for (const ParsedNode& n : c.nodes) maxId = std::max(maxId, n.id);
+    }
+
+    // ids map to file order; a flat table when ids are reasonably dense.
+    const int32_t Unset = -1;
+    bool dense = (size_t)maxId < total * 4 + 1024;
+    std::vector<int32_t> denseIndex(dense ? (size_t)maxId + 1 : 0, Unset);
+    std::unordered_map<int32_t, int32_t> sparseIndex;
+    if (!dense) sparseIndex.reserve(total);
+
+    data.clear();
+    data.parents.reserve(total);
+    data.transforms.reserve(total);
+    data.types.reserve(total);
+    data.colors.reserve(total);
+    data.renderables.reserve(total);
+    Renderable archetypeDefault = { -1, -1 };
+    firstLine = 1;
+    for (const Chunk& c : chunks) {
+        for (const ParsedNode& n : c.nodes) {
+            int32_t index = (int32_t)data.parents.size();
+            int32_t parent = -1;
+            if (n.parent >= 0) {
+                parent = Unset;
+                if (dense) {
+                    if (n.parent <= maxId) parent = denseIndex[n.parent];
+                }
+                else {
+                    std::unordered_map<int32_t, int32_t>::const_iterator it = sparseIndex.find(n.parent);
+                    if (it != sparseIndex.end()) parent = it->second;
+                }
+                if (parent == Unset) {
+                    std::cout << "ERROR::SCENETEXT::LINE " << firstLine + n.line << ": parent "
+                              << n.parent << " not defined on an earlier line" << std::endl;
+                    return false;
+                }
+            }
+            bool duplicate;
+            if (dense) {
+                duplicate = denseIndex[n.id] != Unset;
+                denseIndex[n.id] = index;
+            }
+            else {
+                duplicate = !sparseIndex.insert(std::make_pair(n.id, index)).second;
+            }
+            if (duplicate) {
+                std::cout << "ERROR::SCENETEXT::LINE " << firstLine + n.line << ": duplicate id " << n.id << std::endl;
+                return false;
+            }
+
+            SceneTransform t;
+            t.position = glm::dvec3(n.values[0], n.values[1], n.values[2]);
+            t.scale = glm::vec3((float)n.values[3], (float)n.values[4], (float)n.values[5]);
+            t.rotation = n.values[6] == 0.0 ? glm::quat(1.0f, 0.0f, 0.0f, 0.0f)
+                : glm::angleAxis(glm::radians((float)n.values[6]), glm::vec3(0.0f, 1.0f, 0.0f));
+            t.padding = 0.0f;
+            data.parents.push_back(parent);
+            data.transforms.push_back(t);
+            data.types.push_back(n.type);
+            data.colors.push_back(n.type < BuildingTypeCount ? buildingColor((BuildingType)n.type) : glm::vec3(1.0f));
+            data.renderables.push_back(archetypeDefault);
+        }
+        firstLine += c.lines;
+    }
+    return true;
+}
+
+bool SceneText::load(const char* path, ThreadPool* pool, SceneData& data) {
+    FILE* f = std::fopen(path, "rb");
+    if (!f) {
+        std::cout << "ERROR::SCENETEXT::CANNOT_OPEN " << path << std::endl;
+        return false;
+    }
+    std::fseek(f, 0, SEEK_END);
+    long size = std::ftell(f);
+    std::fseek(f, 0, SEEK_SET);
+    std::vector<char> text(size > 0 ? (size_t)size : 0);
+    size_t read = text.empty() ? 0 : std::fread(text.data(), 1, text.size(), f);
+    std::fclose(f);
+    if (read != text.size()) {
+        std::cout << "ERROR::SCENETEXT::READ " << path << std::endl;
+        return false;
+    }
+    return parse(text.data(), text.size(), pool, data);
+}
+
+bool SceneText::save(const char* path, const SceneData& data) {
+    FILE* f = std::fopen(path, "w");
+    if (!f) {
+        std::cout << "ERROR::SCENETEXT::CANNOT_WRITE " << path << std::endl;
+        return false;
+    }
+    std::fprintf(f, "# id parent type px py pz sx sy sz [yaw]\n");
+    for (size_t i = 0; i < data.size(); i++) {
+        const SceneTransform& t = data.transforms[i];
+        uint8_t type = data.types[i];
+        const char* name = type < BuildingTypeCount ? TypeNames[type] : GroupName;
+        // Only rotation about Y is representable; that is all the city uses.
+        float yaw = glm::degrees(2.0f * std::atan2(t.rotation.y, t.rotation.w));
+        // Enough digits that parsing gives back the same double and float.
+        std::fprintf(f, "%d %d %s %.17g %.17g %.17g %.9g %.9g %.9g", (int)i, data.parents[i], name,
+            t.position.x, t.position.y, t.position.z, t.scale.x, t.scale.y, t.scale.z);
+        if (yaw != 0.0f) std::fprintf(f, " %.9g", yaw);
+        std::fprintf(f, "\n");
+    }
+    bool ok = std::ferror(f) == 0;
+    std::fclose(f);
+    return ok;
+}
+
+bool SceneText::open(const char* path, ThreadPool* pool, bool useCache, SceneFile& file) {
+    std::string cachePath = std::string(path) + ".scene";
+    struct stat textStat, cacheStat;
+    if (stat(path, &textStat) != 0) {
+        std::cout << "ERROR::SCENETEXT::CANNOT_OPEN " << path << std::endl;
+        return false;
+    }
+    if (useCache && stat(cachePath.c_str(), &cacheStat) == 0 && cacheStat.st_mtime >= textStat.st_mtime &&
+        file.open(cachePath.c_str()))
+        return true;
+
+    SceneData data;
+    std::vector<unsigned char> image;
+    if (!load(path, pool, data) || !SceneFile::build(data, image)) return false;
+    if (useCache && SceneFile::writeImage(cachePath.c_str(), image) && file.open(cachePath.c_str()))
+        return true;
+    return file.openImage(image);
+}
@@ -0,0 +1,32 @@
+#ifndef SCENETEXT_H
+#define SCENETEXT_H
+
+#include <cstddef>
+#include "SceneFile.h"
+#include "ThreadPool.h"
+
+// Line-oriented text scenes (.city), meant to be written and diffed by hand:
+//
+//   # comment
+//   <id> <parent> <TYPE> <px> <py> <pz> <sx> <sy> <sz> [yawDegrees]
+//
+// ids are unique non-negative integers; parent is -1 for the scene root or
+// the id of a node on an earlier line. TYPE is a BuildingType name (HOUSE,
+// SKYSCRAPER, ...) or GROUP for a transform-only node.
+//
+// Big files are split at line boundaries into chunks parsed in parallel;
+// SSE2 is used to find and count line ends.
+class SceneText {
+public:
+    // pool may be NULL to parse on the calling thread only.
+    static bool parse(const char* text, size_t length, ThreadPool* pool, SceneData& data);
+    static bool load(const char* path, ThreadPool* pool, SceneData& data);
+    static bool save(const char* path, const SceneData& data);
+
+    // Opens a text scene into file. With useCache the parsed result is kept
+    // next to it as "<path>.scene" and mapped directly on later runs, as long
+    // as it is newer than the text.
+    static bool open(const char* path, ThreadPool* pool, bool useCache, SceneFile& file);
+};
+
+#endif
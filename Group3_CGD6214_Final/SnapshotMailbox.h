@@ -0,0 +1,73 @@
+#ifndef SNAPSHOTMAILBOX_H
+#define SNAPSHOTMAILBOX_H
+
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+// Passes whole frames from one producer thread to one consumer thread
+// through three slots: the one being written, the newest finished one and
+// the one being read. Each side only ever touches the slot it holds, so
+// nothing is copied and nothing is shared while it works; only the slot
+// indices change hands under the lock.
+//
+// beginWrite() waits until the consumer has taken the last published frame,
+// which keeps the producer exactly one frame ahead: frame N + 1 is built
+// while frame N is read, and no frame is ever skipped.
+template<typename T>
+class SnapshotMailbox {
+public:
+    SnapshotMailbox() : writing(0), ready(1), reading(2), fresh(false), closed(false) {}
+
+    SnapshotMailbox(const SnapshotMailbox&) = delete;
+    SnapshotMailbox& operator=(const SnapshotMailbox&) = delete;
+
+    // Producer: false once closed, otherwise writeSlot() is free to fill.
+    bool beginWrite() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return !fresh || closed; });
+        return !closed;
+    }
+    T& writeSlot() { return slots[writing]; }
+    void publish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::swap(writing, ready);
+            fresh = true;
+        }
+        changed.notify_all();
+    }
+
+    // Consumer: waits for the next frame and keeps it until the next call.
+    // NULL once closed.
+    T* take() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return fresh || closed; });
+            if (closed) return NULL;
+            std::swap(reading, ready);
+            fresh = false;
+        }
+        changed.notify_all();
+        return &slots[reading];
+    }
+
+    // Wakes both sides for good.
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        changed.notify_all();
+    }
+
+private:
+    T slots[3];
+    int writing, ready, reading;
+    bool fresh;         // ready holds a frame the consumer has not taken
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+#endif
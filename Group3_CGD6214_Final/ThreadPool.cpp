@@ -0,0 +1,81 @@
+#include "ThreadPool.h"
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned int threadCount) : stopping(false) {
+    if (threadCount == 0) {
+        unsigned int hw = std::thread::hardware_concurrency();
+        threadCount = hw > 1 ? hw - 1 : 1;
+    }
+    for (unsigned int i = 0; i < threadCount; i++)
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers)
+        t.join();
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) return;
+    if (count == 1 || workers.empty()) {
+        for (int i = 0; i < count; i++) fn(i);
+        return;
+    }
+
+    // Indices are handed out through a shared counter so uneven work
+    // balances itself; the caller keeps pulling until none are left.
+    struct Batch {
+        std::atomic<int> next{ 0 };
+        std::atomic<int> done{ 0 };
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+
+    auto run = [batch, count, &fn]() {
+        int ran = 0;
+        for (int i = batch->next++; i < count; i = batch->next++) {
+            fn(i);
+            ran++;
+        }
+        if (ran > 0 && batch->done.fetch_add(ran) + ran == count) {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->finished.notify_all();
+        }
+    };
+
+    int helpers = (int)workers.size() < count - 1 ? (int)workers.size() : count - 1;
+    for (int i = 0; i < helpers; i++)
+        submit(run);
+    run();
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->finished.wait(lock, [&]() { return batch->done.load() == count; });
+}
+
+void ThreadPool::workerLoop() {
+    for (;;) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+            if (stopping && jobs.empty()) return;
+            job = std::move(jobs.front());
+            jobs.pop_front();
+        }
+        job();
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads shared by the engine systems. parallelFor is
+// the common case: the calling thread joins in and returns once every index
+// has run. submit() queues a fire-and-forget job.
+class ThreadPool {
+public:
+    // threadCount = 0 uses one worker per hardware thread minus the caller.
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads that can run work at once, including the caller.
+    unsigned int size() const { return (unsigned int)workers.size() + 1; }
+
+    void parallelFor(int count, const std::function<void(int)>& fn);
+    void submit(std::function<void()> job);
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    void workerLoop();
+};
+
+#endif
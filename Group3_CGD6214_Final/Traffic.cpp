@@ -0,0 +1,443 @@
+#include "Traffic.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRAFFIC_SSE2 1
+#endif
+
+namespace {
+
+// Stands in for the distance to the car in front on an empty road.
+const float FreeGap = 1000.0f;
+
+struct Idm {
+    float maxAcceleration;
+    float minimumGap;
+    float timeHeadway;
+    float carLength;
+    float maxBraking;
+    float brakingTerm;      // 1 / (2 sqrt(a b))
+};
+
+Idm makeIdm(const TrafficSettings& t) {
+    Idm c;
+    c.maxAcceleration = t.maxAcceleration;
+    c.minimumGap = t.minimumGap;
+    c.timeHeadway = t.timeHeadway;
+    c.carLength = t.carLength;
+    c.maxBraking = t.maxBraking;
+    c.brakingTerm = 0.5f / std::sqrt(t.maxAcceleration * t.comfortableBraking);
+    return c;
+}
+
+// Intelligent driver model: free-road term (v / v0)^4 and interaction term
+// (desired gap / gap)^2.
+float idm(const Idm& c, float v, float v0, float gap, float leaderV) {
+    float desired = c.minimumGap + std::max(0.0f, v * (c.timeHeadway + (v - leaderV) * c.brakingTerm));
+    float speed = v / v0;
+    speed *= speed;
+    float closeness = desired / std::max(gap, 0.1f);
+    return std::max(c.maxAcceleration * (1.0f - speed * speed - closeness * closeness), -c.maxBraking);
+}
+
+// a[i] for i in [1, n), each car following car i - 1.
+void followLeaders(const Idm& c, const float* s, const float* v, const float* v0, float* a, size_t n) {
+    size_t i = 1;
+#ifdef TRAFFIC_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minGap = _mm_set1_ps(c.minimumGap);
+    const __m128 headway = _mm_set1_ps(c.timeHeadway);
+    const __m128 brakingTerm = _mm_set1_ps(c.brakingTerm);
+    const __m128 carLength = _mm_set1_ps(c.carLength);
+    const __m128 maxAcceleration = _mm_set1_ps(c.maxAcceleration);
+    const __m128 maxBraking = _mm_set1_ps(-c.maxBraking);
+    const __m128 smallestGap = _mm_set1_ps(0.1f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 pos = _mm_loadu_ps(s + i);
+        __m128 speed = _mm_loadu_ps(v + i);
+        __m128 leaderPos = _mm_loadu_ps(s + i - 1);
+        __m128 leaderSpeed = _mm_loadu_ps(v + i - 1);
+        __m128 gap = _mm_max_ps(_mm_sub_ps(_mm_sub_ps(leaderPos, pos), carLength), smallestGap);
+        __m128 dynamic = _mm_mul_ps(speed, _mm_add_ps(headway, _mm_mul_ps(_mm_sub_ps(speed, leaderSpeed), brakingTerm)));
+        __m128 desired = _mm_add_ps(minGap, _mm_max_ps(dynamic, zero));
+        __m128 ratio = _mm_div_ps(speed, _mm_loadu_ps(v0 + i));
+        ratio = _mm_mul_ps(ratio, ratio);
+        __m128 closeness = _mm_div_ps(desired, gap);
+        __m128 acc = _mm_sub_ps(_mm_sub_ps(one, _mm_mul_ps(ratio, ratio)), _mm_mul_ps(closeness, closeness));
+        _mm_storeu_ps(a + i, _mm_max_ps(_mm_mul_ps(maxAcceleration, acc), maxBraking));
+    }
+#endif
+    for (; i < n; i++)
+        a[i] = idm(c, v[i], v0[i], s[i - 1] - s[i] - c.carLength, v[i - 1]);
+}
+
+// Speeds never go negative; positions move by the average speed over dt.
+void integrate(float* s, float* v, const float* a, size_t n, float dt) {
+    size_t i = 0;
+#ifdef TRAFFIC_SSE2
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128 halfStep = _mm_set1_ps(dt * 0.5f);
+    for (; i + 4 <= n; i += 4) {
+        __m128 speed = _mm_loadu_ps(v + i);
+        __m128 next = _mm_max_ps(_mm_add_ps(speed, _mm_mul_ps(_mm_loadu_ps(a + i), step)), zero);
+        _mm_storeu_ps(s + i, _mm_add_ps(_mm_loadu_ps(s + i), _mm_mul_ps(_mm_add_ps(speed, next), halfStep)));
+        _mm_storeu_ps(v + i, next);
+    }
+#endif
+    for (; i < n; i++) {
+        float next = std::max(v[i] + a[i] * dt, 0.0f);
+        s[i] += (v[i] + next) * 0.5f * dt;
+        v[i] = next;
+    }
+}
+
+uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+}
+
+void Traffic::Lane::insert(size_t i, uint32_t id, float position, float speed, float desired, float acceleration) {
+    s.insert(s.begin() + i, position);
+    v.insert(v.begin() + i, speed);
+    v0.insert(v0.begin() + i, desired);
+    a.insert(a.begin() + i, acceleration);
+    car.insert(car.begin() + i, id);
+}
+
+void Traffic::Lane::erase(size_t i) {
+    s.erase(s.begin() + i);
+    v.erase(v.begin() + i);
+    v0.erase(v0.begin() + i);
+    a.erase(a.begin() + i);
+    car.erase(car.begin() + i);
+}
+
+Traffic::Traffic(const RoadNetwork& network, ThreadPool& pool)
+    : planner(NULL), network(network), pool(pool), elapsed(0.0), ticks(0) {
+    size_t edgeCount = network.edges.size();
+    firstLane.resize(edgeCount);
+    signalSlot.resize(edgeCount);
+    outbox.resize(edgeCount);
+    needRoute.resize(edgeCount);
+    int laneTotal = 0;
+    for (size_t e = 0; e < edgeCount; e++) {
+        firstLane[e] = laneTotal;
+        laneTotal += network.edges[e].lanes;
+    }
+    lanes.resize(laneTotal);
+    for (const RoadNode& node : network.nodes) {
+        for (size_t k = 0; k < node.incoming.size(); k++)
+            signalSlot[node.incoming[k]] = (int)k;
+    }
+}
+
+// Contiguous runs of edges, a few per thread.
+template<typename Fn>
+void Traffic::forEachEdge(Fn fn) const {
+    int count = (int)network.edges.size();
+    int chunks = std::min(count, (int)pool.size() * 8);
+    if (chunks <= 0) return;
+    pool.parallelFor(chunks, [&](int chunk) {
+        int end = (int)((int64_t)count * (chunk + 1) / chunks);
+        for (int e = (int)((int64_t)count * chunk / chunks); e < end; e++) fn(e);
+    });
+}
+
+bool Traffic::isGreen(int edge) const {
+    const RoadNode& node = network.nodes[network.edges[edge].to];
+    if (node.incoming.size() < 3) return true;
+    return (int)(elapsed / settings.signalPeriod) % (int)node.incoming.size() == signalSlot[edge];
+}
+
+int Traffic::pickNext(int edge, uint32_t& random) const {
+    const RoadEdge& e = network.edges[edge];
+    const std::vector<int>& exits = network.nodes[e.to].outgoing;
+    int choices = (int)exits.size() - 1;    // the way back is always one of them
+    if (choices <= 0) return e.reverse;
+    int k = (int)(nextRandom(random) % (uint32_t)choices);
+    for (int exit : exits) {
+        if (exit == e.reverse) continue;
+        if (k-- == 0) return exit;
+    }
+    return e.reverse;
+}
+
+// The next edge of the car's route if it continues from here, otherwise a
+// random turn and a request for a new route.
+int Traffic::nextEdge(uint32_t car, int edge) {
+    const std::vector<int>& route = carRoute[car];
+    uint32_t& step = carRouteStep[car];
+    if (step < route.size() && network.edges[route[step]].from == network.edges[edge].to)
+        return route[step++];
+    if (planner) needRoute[edge].push_back(car);
+    return pickNext(edge, carRandom[car]);
+}
+
+void Traffic::planRoutes() {
+    if (destinationNodes.empty()) {
+        uint32_t random = 0x2545F491u;
+        int count = settings.destinations > 0 ? settings.destinations : (int)network.nodes.size();
+        for (int i = 0; i < count; i++)
+            destinationNodes.push_back(settings.destinations > 0 ? (int)(nextRandom(random) % network.nodes.size()) : i);
+    }
+    requests.clear();
+    requestCars.clear();
+    for (std::vector<uint32_t>& cars : needRoute) {
+        for (uint32_t car : cars) {
+            RouteRequest r;
+            r.from = network.edges[carNext[car]].to;
+            r.to = destinationNodes[nextRandom(carRandom[car]) % destinationNodes.size()];
+            requests.push_back(r);
+            requestCars.push_back(car);
+        }
+        cars.clear();
+    }
+    if (requests.empty()) return;
+    planner->route(requests, routes);
+    for (size_t i = 0; i < requestCars.size(); i++) {
+        carRoute[requestCars[i]].swap(routes[i].edges);
+        carRouteStep[requestCars[i]] = 0;
+    }
+}
+
+glm::vec3 Traffic::carPosition(int edge, int lane, float s) const {
+    const RoadEdge& e = network.edges[edge];
+    return e.start + e.direction * s + e.right * ((lane + 0.5f) * e.laneWidth)
+        + glm::vec3(0.0f, settings.carScale.y * 0.5f, 0.0f);
+}
+
+int Traffic::spawn(int count, uint32_t seed, BuildingFactory* factory, NodeHandle parent) {
+    float spacing = settings.carLength + settings.minimumGap * 2.0f;
+    int placed = 0;
+    for (int row = 0; placed < count; row++) {
+        bool room = false;
+        for (size_t e = 0; e < network.edges.size() && placed < count; e++) {
+            const RoadEdge& edge = network.edges[e];
+            float s = edge.length - spacing * (row + 0.5f);
+            if (s < 0.0f) continue;
+            room = true;
+            for (int l = 0; l < edge.lanes && placed < count; l++) {
+                uint32_t id = (uint32_t)carEntity.size();
+                uint32_t random = (seed * 0x9E3779B9u) ^ ((id + 1) * 0x85EBCA6Bu);
+                if (random == 0) random = 1;
+                float jitter = (nextRandom(random) >> 8) * (1.0f / 16777216.0f) * 2.0f - 1.0f;
+                float v0 = settings.desiredSpeed * (1.0f + settings.speedVariation * jitter);
+
+                Entity entity;
+                if (factory) {
+                    entity = factory->create(parent, glm::dvec3(carPosition((int)e, l, s)), edge.rotation,
+                        settings.carScale, BuildingType::CAR);
+                }
+                carEntity.push_back(entity);
+                carRandom.push_back(random);
+                carRoute.push_back(std::vector<int>());
+                carRouteStep.push_back(0);
+                carLaneChanged.push_back(0xFFFFFFFFu);
+                carNext.push_back(nextEdge(id, (int)e));
+                Lane& lane = lanes[firstLane[e] + l];
+                lane.insert(lane.size(), id, s, v0 * 0.5f, v0, 0.0f);
+                placed++;
+            }
+        }
+        if (!room) break;
+    }
+    if (planner) planRoutes();
+    previousPosition.resize(carEntity.size());
+    currentPosition.resize(carEntity.size());
+    previousRotation.resize(carEntity.size());
+    currentRotation.resize(carEntity.size());
+    capturePoses();
+    previousPosition = currentPosition;
+    previousRotation = currentRotation;
+    return placed;
+}
+
+void Traffic::tick(float dt) {
+    dt = std::min(dt, settings.maxStep);
+    if (dt <= 0.0f) return;
+    // Each pass only writes the edges it is given; reads across edges happen
+    // in passes where the other side is not written.
+    forEachEdge([this](int e) { accelerate(e); });
+    forEachEdge([this, dt](int e) { move(e, dt); });
+    forEachEdge([this](int e) { changeLanes(e); });
+    forEachEdge([this](int e) { arrive(e); });
+    if (planner) planRoutes();
+    capturePoses();
+    elapsed += dt;
+    ticks++;
+}
+
+// The poses after this tick become the ones before the next.
+void Traffic::capturePoses() {
+    previousPosition.swap(currentPosition);
+    previousRotation.swap(currentRotation);
+    forEachEdge([this](int edge) {
+        const RoadEdge& e = network.edges[edge];
+        for (int l = 0; l < e.lanes; l++) {
+            const Lane& lane = lanes[firstLane[edge] + l];
+            for (size_t i = 0; i < lane.size(); i++) {
+                currentPosition[lane.car[i]] = carPosition(edge, l, lane.s[i]);
+                currentRotation[lane.car[i]] = e.rotation;
+            }
+        }
+    });
+}
+
+void Traffic::carBoxes(std::vector<OBB>& out) const {
+    out.resize(currentPosition.size());
+    for (size_t car = 0; car < currentPosition.size(); car++) {
+        glm::mat3 axes = glm::mat3_cast(currentRotation[car]);
+        OBB& box = out[car];
+        box.center = currentPosition[car];
+        for (int i = 0; i < 3; i++) box.axes[i] = axes[i];
+        box.halfExtents = settings.carScale * 0.5f;
+    }
+}
+
+void Traffic::accelerate(int edge) {
+    const RoadEdge& e = network.edges[edge];
+    Idm c = makeIdm(settings);
+    bool green = isGreen(edge);
+    for (int l = 0; l < e.lanes; l++) {
+        Lane& lane = lanes[firstLane[edge] + l];
+        lane.frontMayLeave = false;
+        size_t n = lane.size();
+        if (n == 0) continue;
+
+        // The front car follows the last car of the lane it turns into, or
+        // stops at the line when that is red or full.
+        float gap = e.length - lane.s[0];
+        float leaderV = 0.0f;
+        if (green) {
+            int next = carNext[lane.car[0]];
+            const Lane& target = lanes[firstLane[next] + std::min(l, network.edges[next].lanes - 1)];
+            if (target.s.empty()) {
+                gap += FreeGap;
+                leaderV = lane.v[0];
+                lane.frontMayLeave = true;
+            }
+            else if (target.s.back() > settings.carLength + settings.minimumGap) {
+                gap += target.s.back() - settings.carLength;
+                leaderV = target.v.back();
+                lane.frontMayLeave = true;
+            }
+        }
+        lane.a[0] = idm(c, lane.v[0], lane.v0[0], gap, leaderV);
+        followLeaders(c, lane.s.data(), lane.v.data(), lane.v0.data(), lane.a.data(), n);
+    }
+}
+
+void Traffic::move(int edge, float dt) {
+    const RoadEdge& e = network.edges[edge];
+    outbox[edge].clear();
+    for (int l = 0; l < e.lanes; l++) {
+        Lane& lane = lanes[firstLane[edge] + l];
+        size_t n = lane.size();
+        if (n == 0) continue;
+        integrate(lane.s.data(), lane.v.data(), lane.a.data(), n, dt);
+        // The model keeps cars apart; this only keeps the order exact.
+        for (size_t i = 1; i < n; i++) {
+            if (lane.s[i] > lane.s[i - 1] - 0.1f) {
+                lane.s[i] = lane.s[i - 1] - 0.1f;
+                lane.v[i] = std::min(lane.v[i], lane.v[i - 1]);
+            }
+        }
+        if (lane.s[0] < e.length) continue;
+        if (lane.frontMayLeave) {
+            Transfer t = { lane.car[0], carNext[lane.car[0]], l, lane.s[0] - e.length, lane.v[0], lane.v0[0] };
+            outbox[edge].push_back(t);
+            lane.erase(0);
+        }
+        else {
+            lane.s[0] = e.length;
+            lane.v[0] = 0.0f;
+        }
+    }
+}
+
+void Traffic::changeLanes(int edge) {
+    const RoadEdge& e = network.edges[edge];
+    if (e.lanes < 2 || (ticks + (uint32_t)edge) % (uint32_t)settings.laneChangeInterval != 0) return;
+    Idm c = makeIdm(settings);
+    bool green = isGreen(edge);
+    for (int l = 0; l < e.lanes; l++) {
+        Lane& lane = lanes[firstLane[edge] + l];
+        for (size_t i = 0; i < lane.size();) {
+            // A car that just moved up into this lane keeps it until the
+            // next pass; its acceleration was for the lane it left.
+            if (carLaneChanged[lane.car[i]] == ticks) {
+                i++;
+                continue;
+            }
+            float s = lane.s[i], v = lane.v[i], v0 = lane.v0[i];
+            int best = -1;
+            size_t bestAt = 0;
+            float bestGain = settings.laneChangeGain;
+            for (int side = -1; side <= 1; side += 2) {
+                int t = l + side;
+                if (t < 0 || t >= e.lanes) continue;
+                const Lane& target = lanes[firstLane[edge] + t];
+                // Cars in target ahead of this one come before at.
+                size_t at = std::lower_bound(target.s.begin(), target.s.end(), s, std::greater<float>()) - target.s.begin();
+                float leadGap = at > 0 ? target.s[at - 1] - s - settings.carLength : e.length - s + (green ? FreeGap : 0.0f);
+                float leadV = at > 0 ? target.v[at - 1] : (green ? v : 0.0f);
+                float backGap = at < target.size() ? s - target.s[at] - settings.carLength : FreeGap;
+                if (leadGap < settings.minimumGap || backGap < settings.minimumGap) continue;
+                // The new follower must not have to brake hard.
+                if (at < target.size() && idm(c, target.v[at], target.v0[at], backGap, v) < -settings.comfortableBraking)
+                    continue;
+                float gain = idm(c, v, v0, leadGap, leadV) - lane.a[i];
+                if (gain > bestGain) {
+                    best = t;
+                    bestAt = at;
+                    bestGain = gain;
+                }
+            }
+            if (best < 0) {
+                i++;
+                continue;
+            }
+            carLaneChanged[lane.car[i]] = ticks;
+            lanes[firstLane[edge] + best].insert(bestAt, lane.car[i], s, v, v0, lane.a[i]);
+            lane.erase(i);
+        }
+    }
+}
+
+void Traffic::arrive(int edge) {
+    const RoadEdge& e = network.edges[edge];
+    for (int in : network.nodes[e.from].incoming) {
+        for (const Transfer& t : outbox[in]) {
+            if (t.edge != edge) continue;
+            Lane& lane = lanes[firstLane[edge] + std::min(t.lane, e.lanes - 1)];
+            size_t at = lane.size();
+            while (at > 0 && lane.s[at - 1] < t.s) at--;
+            lane.insert(at, t.car, t.s, t.v, t.v0, 0.0f);
+            carNext[t.car] = nextEdge(t.car, edge);
+        }
+    }
+}
+
+void Traffic::syncTransforms(Scene& scene, float alpha) const {
+    int count = carCount();
+    int chunks = std::min(count, (int)pool.size() * 8);
+    if (chunks <= 0) return;
+    alpha = std::min(std::max(alpha, 0.0f), 1.0f);
+    pool.parallelFor(chunks, [&](int chunk) {
+        int end = (int)((int64_t)count * (chunk + 1) / chunks);
+        for (int car = (int)((int64_t)count * chunk / chunks); car < end; car++) {
+            Node* node = scene.get(carEntity[car]);
+            if (!node) continue;
+            node->setPosition(glm::dvec3(glm::mix(previousPosition[car], currentPosition[car], alpha)));
+            node->setRotation(glm::slerp(previousRotation[car], currentRotation[car], alpha));
+        }
+    });
+}
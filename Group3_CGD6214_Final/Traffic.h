@@ -0,0 +1,141 @@
+#ifndef TRAFFIC_H
+#define TRAFFIC_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include "BuildingFactory.h"
+#include "Collision.h"
+#include "RoadNetwork.h"
+#include "RoutePlanner.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+// Intelligent driver model parameters plus the traffic rules around it.
+struct TrafficSettings {
+    float maxAcceleration;
+    float comfortableBraking;
+    float maxBraking;           // hard physical limit
+    float timeHeadway;          // seconds kept to the car in front
+    float minimumGap;           // bumper to bumper when stopped
+    float carLength;
+    float desiredSpeed;         // mean; each car differs by up to speedVariation of it
+    float speedVariation;
+    float signalPeriod;         // seconds of green per approach at intersections
+    float laneChangeGain;       // acceleration a lane change must win
+    int laneChangeInterval;     // ticks between lane change passes over an edge
+    int destinations;           // routed cars head for one of this many nodes, 0 = any node
+    float maxStep;              // longer ticks are clamped to this
+    glm::vec3 carScale;
+
+    TrafficSettings() : maxAcceleration(1.5f), comfortableBraking(2.0f), maxBraking(9.0f),
+        timeHeadway(1.2f), minimumGap(2.0f), carLength(4.5f), desiredSpeed(12.0f), speedVariation(0.2f),
+        signalPeriod(8.0f), laneChangeGain(0.3f), laneChangeInterval(4), destinations(64), maxStep(0.1f),
+        carScale(1.8f, 1.4f, 4.2f) {}
+};
+
+// Cars driving over a RoadNetwork. Each lane keeps its cars as parallel
+// arrays sorted front to back, so the car in front of car i is car i - 1 and
+// car following runs four cars at a time with SSE. A tick is a few passes,
+// each parallel over the edges: accelerations from the state as it was, then
+// movement and cars leaving their edge, then lane changes, then cars arriving
+// on the edges they turned into. Intersections where three or more roads
+// meet give each approach a turn at green.
+//
+// Without a planner cars pick a random exit that is not a U-turn unless at a
+// dead end. With one, every car drives a route to a destination; cars that
+// arrive (or were just spawned) keep turning at random until the routes
+// asked for at the end of the tick come back as one batch.
+class Traffic {
+public:
+    TrafficSettings settings;
+    RoutePlanner* planner;          // NULL: random turns only
+
+    Traffic(const RoadNetwork& network, ThreadPool& pool);
+
+    // Spreads up to count cars evenly over every lane, with room to move,
+    // and returns how many fit; call once. With a factory each car also
+    // becomes a CAR entity under parent (which should sit at the origin),
+    // whose transform syncTransforms() keeps up to date.
+    int spawn(int count, uint32_t seed, BuildingFactory* factory = NULL, NodeHandle parent = NodeHandle());
+
+    void tick(float dt);
+    // Writes position and heading into every car's node; call before
+    // Scene::update. alpha blends from the pose before the last tick (0) to
+    // the one after it (1), for drawing between fixed ticks.
+    void syncTransforms(Scene& scene, float alpha = 1.0f) const;
+
+    // Every car's box as of the last tick, indexed like its entity.
+    void carBoxes(std::vector<OBB>& out) const;
+
+    int carCount() const { return (int)carEntity.size(); }
+    // Each car's entity; null when spawned without a factory.
+    const std::vector<Entity>& cars() const { return carEntity; }
+    double time() const { return elapsed; }
+
+private:
+    struct Lane {
+        std::vector<float> s;       // distance along the edge
+        std::vector<float> v;
+        std::vector<float> v0;      // desired speed
+        std::vector<float> a;       // from the last accelerate pass
+        std::vector<uint32_t> car;
+        bool frontMayLeave;         // green and room in the lane the front car turns into
+
+        Lane() : frontMayLeave(false) {}
+        size_t size() const { return car.size(); }
+        void insert(size_t i, uint32_t id, float position, float speed, float desired, float acceleration);
+        void erase(size_t i);
+    };
+
+    struct Transfer {
+        uint32_t car;
+        int edge;                   // where it is going
+        int lane;
+        float s, v, v0;
+    };
+
+    const RoadNetwork& network;
+    ThreadPool& pool;
+    std::vector<Lane> lanes;
+    std::vector<int> firstLane;     // per edge
+    std::vector<int> signalSlot;    // per edge, its turn at the node it leads into
+    std::vector<std::vector<Transfer>> outbox;  // per edge, cars that left it this tick
+
+    // Per car, indexed by Lane::car.
+    std::vector<Entity> carEntity;
+    std::vector<int> carNext;       // edge taken at the end of the current one
+    std::vector<uint32_t> carRandom;
+    std::vector<std::vector<int>> carRoute;
+    std::vector<uint32_t> carRouteStep;
+    std::vector<uint32_t> carLaneChanged;   // tick of the last lane change
+    std::vector<glm::vec3> previousPosition, currentPosition;  // around the last tick
+    std::vector<glm::quat> previousRotation, currentRotation;
+
+    // Cars that ran out of route, per edge they were on, and the batch made
+    // from them.
+    std::vector<std::vector<uint32_t>> needRoute;
+    std::vector<int> destinationNodes;
+    std::vector<RouteRequest> requests;
+    std::vector<uint32_t> requestCars;
+    std::vector<Route> routes;
+
+    double elapsed;
+    uint32_t ticks;
+
+    template<typename Fn>
+    void forEachEdge(Fn fn) const;
+    bool isGreen(int edge) const;
+    int pickNext(int edge, uint32_t& random) const;
+    int nextEdge(uint32_t car, int edge);
+    void planRoutes();
+    glm::vec3 carPosition(int edge, int lane, float s) const;
+    void capturePoses();
+
+    void accelerate(int edge);
+    void move(int edge, float dt);
+    void changeLanes(int edge);
+    void arrive(int edge);
+};
+
+#endif
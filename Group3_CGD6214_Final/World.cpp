@@ -0,0 +1,17 @@
+#include "World.h"
+
+void World::destroy(Entity e) {
+    buildings.remove(e);
+    colors.remove(e);
+    renderables.remove(e);
+    bounds.remove(e);
+    screenSizes.remove(e);
+    impostors.remove(e);
+}
+
+void World::updateBounds(const Scene& scene) {
+    for (size_t i = 0; i < bounds.size(); i++) {
+        const Node* node = scene.get(bounds.entity(i));
+        if (node && node->worldChanged) bounds[i].box = transformUnitCube(node->worldTransform);
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <vector>
+#include "Building.h"
+#include "Components.h"
+#include "Scene.h"
+
+// Component storage for the entities of a Scene, plus the shared mesh and
+// material tables Renderable points into. Every entity with a Renderable
+// also has Bounds; systems join the two by index without checking.
+struct World {
+    ComponentArray<BuildingInfo> buildings;
+    ComponentArray<Color> colors;
+    ComponentArray<Renderable> renderables;
+    ComponentArray<Bounds> bounds;
+    ComponentArray<ScreenSizeCull> screenSizes;
+    ComponentArray<ImpostorProxy> impostors;
+    std::vector<Mesh> meshes;
+    std::vector<Material> materials;
+
+    // Drops every component of e; pair with Scene::destroySubtree.
+    void destroy(Entity e);
+    // Refreshes Bounds of nodes that moved in the last Scene::update.
+    void updateBounds(const Scene& scene);
+};
+
+#endif
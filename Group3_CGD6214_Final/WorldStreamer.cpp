@@ -0,0 +1,376 @@
+#include "WorldStreamer.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+namespace {
+
+// Rough runtime cost of one instantiated node: its pool slot plus components.
+const size_t NodeBytes = sizeof(Node) + sizeof(BuildingInfo) + sizeof(Color) +
+    sizeof(Renderable) + sizeof(Bounds) + 4 * sizeof(Entity);
+
+const char* ManifestTag = "tiles";
+const int ManifestVersion = 1;
+
+}
+
+StreamingStats::StreamingStats() : resident(0), pending(0), loading(0), bytes(0) {
+    resetCounters();
+}
+
+void StreamingStats::resetCounters() {
+    loadsStarted = evictions = needed = hits = wasted = frames = 0;
+    updateMs = maxUpdateMs = 0.0;
+}
+
+void StreamingStats::print() const {
+    std::cout << std::fixed << std::setprecision(2)
+        << "stream: " << resident << " resident, " << pending << " pending, " << loading << " loading, "
+        << bytes / (1024.0 * 1024.0) << " MB | " << loadsStarted << " loads, " << evictions << " evictions, "
+        << wasted << " wasted | " << hits << "/" << needed << " hits ("
+        << (needed ? 100.0 * hits / needed : 100.0) << "%) | update "
+        << (frames ? updateMs / frames : 0.0) << " ms avg, " << maxUpdateMs << " ms max" << std::endl;
+}
+
+CameraPredictor::CameraPredictor()
+    : window(0.25f), lastPosition(0.0f), currentVelocity(0.0f) {}
+
+void CameraPredictor::addSample(double time, const glm::vec3& position, const glm::vec3& front, float movementSpeed) {
+    Sample sample = { time, position };
+    history.push_back(sample);
+    while (history.size() > 2 && history.front().time < time - window)
+        history.pop_front();
+    lastPosition = position;
+
+    const Sample& oldest = history.front();
+    double elapsed = time - oldest.time;
+    currentVelocity = elapsed > 0.0 ? (position - oldest.position) / (float)elapsed : glm::vec3(0.0f);
+
+    // Forward plus strafe is the fastest the keyboard moves the camera.
+    float maxSpeed = movementSpeed * 1.415f;
+    float speed = glm::length(currentVelocity);
+    if (speed > maxSpeed) {
+        currentVelocity *= maxSpeed / speed;
+        speed = maxSpeed;
+    }
+    if (speed > 1e-4f && glm::dot(currentVelocity / speed, front) > 0.7f)
+        currentVelocity = front * speed;
+}
+
+WorldStreamer::WorldStreamer(Scene& scene, BuildingFactory& factory, World& world, ThreadPool& pool)
+    : scene(scene), factory(factory), world(world), pool(pool), tileSize(0.0f),
+      committedBytes(0), instantiatedBuildings(0), loading(0), frame(0), changed(false) {}
+
+WorldStreamer::~WorldStreamer() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        loadDone.wait(lock, [this]() { return (int)finished.size() == loading; });
+    }
+    for (Tile* tile : tiles)
+        delete tile;
+}
+
+std::string WorldStreamer::tilePath(const std::string& base, int x, int z) {
+    return base + "." + std::to_string(x) + "_" + std::to_string(z);
+}
+
+bool WorldStreamer::writeTiles(const char* path, const SceneData& data, float tileSize) {
+    if (tileSize <= 0.0f) return false;
+
+    // Parents come first, so a child's tile and new index are known by then.
+    std::map<std::pair<int, int>, SceneData> split;
+    std::vector<std::pair<int, int>> tileOf(data.size());
+    std::vector<int32_t> remap(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        int32_t parent = data.parents[i];
+        if (parent < 0) {
+            const glm::dvec3& p = data.transforms[i].position;
+            tileOf[i] = std::make_pair((int)std::floor(p.x / tileSize), (int)std::floor(p.z / tileSize));
+        }
+        else {
+            tileOf[i] = tileOf[parent];
+        }
+        SceneData& tile = split[tileOf[i]];
+        remap[i] = (int32_t)tile.size();
+        tile.parents.push_back(parent < 0 ? -1 : remap[parent]);
+        tile.transforms.push_back(data.transforms[i]);
+        tile.types.push_back(data.types[i]);
+        tile.colors.push_back(data.colors[i]);
+        tile.renderables.push_back(data.renderables[i]);
+    }
+
+    std::ofstream manifest(path);
+    if (!manifest) return false;
+    manifest << ManifestTag << " " << ManifestVersion << " " << tileSize << "\n";
+    std::vector<unsigned char> image;
+    for (auto& entry : split) {
+        int x = entry.first.first, z = entry.first.second;
+        if (!SceneFile::build(entry.second, image) || !SceneFile::writeImage(tilePath(path, x, z).c_str(), image))
+            return false;
+        manifest << x << " " << z << " " << entry.second.size() << " " << image.size() << "\n";
+    }
+    return manifest.good();
+}
+
+bool WorldStreamer::open(const char* path) {
+    std::ifstream in(path);
+    std::string tag;
+    int version = 0;
+    float size = 0.0f;
+    if (!(in >> tag >> version >> size) || tag != ManifestTag || version != ManifestVersion || size <= 0.0f) {
+        std::cout << "ERROR::STREAMER::BAD_MANIFEST " << path << std::endl;
+        return false;
+    }
+
+    int x, z;
+    uint32_t nodes;
+    size_t fileBytes;
+    while (in >> x >> z >> nodes >> fileBytes) {
+        Tile* tile = new Tile();
+        tile->x = x;
+        tile->z = z;
+        tile->nodeCount = nodes;
+        tile->cost = fileBytes + nodes * NodeBytes;
+        tile->state = TileUnloaded;
+        tile->distance = tile->priority = tile->pathPriority = 0.0f;
+        tile->pathFrame = tile->candidateFrame = tile->neededFrame = -1;
+        tile->used = false;
+        tiles.push_back(tile);
+        lookup[key(x, z)] = tile;
+    }
+    basePath = path;
+    tileSize = size;
+    return true;
+}
+
+bool WorldStreamer::takeChanged() {
+    bool was = changed;
+    changed = false;
+    return was;
+}
+
+void WorldStreamer::collectFinished() {
+    std::vector<std::pair<Tile*, bool>> done;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done.swap(finished);
+        loading -= (int)done.size();
+    }
+    for (auto& entry : done) {
+        Tile* tile = entry.first;
+        if (!entry.second) {
+            // Left out for the rest of the session instead of retried every frame.
+            std::cout << "ERROR::STREAMER::TILE_LOAD_FAILED " << tilePath(basePath, tile->x, tile->z) << std::endl;
+            lookup.erase(key(tile->x, tile->z));
+            live.erase(std::find(live.begin(), live.end(), tile));
+            committedBytes -= tile->cost;
+            tile->state = TileUnloaded;
+            continue;
+        }
+        tile->state = TileLoaded;
+        BvhView bvh = tile->file.bvh();
+        if (bvh.nodeCount > 0) {
+            tile->bounds.min = bvh.nodes[0].min;
+            tile->bounds.max = bvh.nodes[0].max;
+        }
+    }
+}
+
+void WorldStreamer::prioritize(Tile& tile, const glm::vec2& eye, const glm::vec2& direction) const {
+    glm::vec2 center((tile.x + 0.5f) * tileSize, (tile.z + 0.5f) * tileSize);
+    glm::vec2 offset = center - eye;
+    tile.distance = glm::length(offset);
+    float facing = tile.distance > 1e-4f ? glm::dot(offset / tile.distance, direction) : 1.0f;
+    tile.priority = tile.distance * (1.0f + settings.viewWeight * (1.0f - facing));
+    if (tile.pathFrame == frame)
+        tile.priority = std::min(tile.priority, tile.pathPriority);
+}
+
+template<typename Fn>
+void WorldStreamer::forTilesNear(const glm::vec2& center, float radius, Fn fn) {
+    int x0 = (int)std::floor((center.x - radius) / tileSize), x1 = (int)std::floor((center.x + radius) / tileSize);
+    int z0 = (int)std::floor((center.y - radius) / tileSize), z1 = (int)std::floor((center.y + radius) / tileSize);
+    for (int z = z0; z <= z1; z++) {
+        for (int x = x0; x <= x1; x++) {
+            auto it = lookup.find(key(x, z));
+            if (it == lookup.end()) continue;
+            glm::vec2 tileCenter((x + 0.5f) * tileSize, (z + 0.5f) * tileSize);
+            float distance = glm::length(tileCenter - center);
+            if (distance <= radius) fn(it->second, distance);
+        }
+    }
+}
+
+void WorldStreamer::addCandidate(Tile* tile) {
+    if (tile->state != TileUnloaded || tile->candidateFrame == frame) return;
+    tile->candidateFrame = frame;
+    candidates.push_back(tile);
+}
+
+void WorldStreamer::startLoad(Tile* tile) {
+    tile->state = TileLoading;
+    tile->used = false;
+    live.push_back(tile);
+    committedBytes += tile->cost;
+    loading++;
+    counters.loadsStarted++;
+
+    std::string path = tilePath(basePath, tile->x, tile->z);
+    pool.submit([this, tile, path]() {
+        bool ok = tile->file.open(path.c_str());
+        if (ok) tile->file.prefetch();
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(std::make_pair(tile, ok));
+        loadDone.notify_all();
+    });
+}
+
+uint32_t WorldStreamer::instantiate(Tile* tile, uint32_t maxNodes) {
+    if (!tile->file.isOpen()) return 0;
+    if (tile->group.isNull()) {
+        tile->group = scene.create();
+        scene.addChild(scene.root(), tile->group);
+        tile->progress.parent = tile->group;
+    }
+    uint32_t before = tile->progress.next;
+    size_t buildingsBefore = tile->progress.buildings.size();
+    if (tile->file.instantiate(scene, factory, world, tile->progress, maxNodes))
+        tile->state = TileResident;
+    for (size_t i = buildingsBefore; i < tile->progress.buildings.size(); i++)
+        world.bounds.get(tile->progress.buildings[i])->streamed = true;
+    instantiatedBuildings += tile->progress.buildings.size() - buildingsBefore;
+    changed = true;
+    return tile->progress.next - before;
+}
+
+void WorldStreamer::evict(Tile* tile) {
+    for (uint32_t i = 0; i < tile->progress.next; i++)
+        world.destroy(tile->progress.entities[i]);
+    if (!tile->group.isNull())
+        scene.destroySubtree(tile->group);
+    if (tile->progress.next > 0)
+        changed = true;
+    instantiatedBuildings -= tile->progress.buildings.size();
+    tile->progress = SceneInstantiation();
+    tile->group = NodeHandle();
+    tile->file.close();
+    tile->state = TileUnloaded;
+    committedBytes -= tile->cost;
+    counters.evictions++;
+    if (!tile->used) counters.wasted++;
+    live.erase(std::find(live.begin(), live.end(), tile));
+}
+
+WorldStreamer::Tile* WorldStreamer::worstEvictable(float thanPriority) const {
+    Tile* worst = NULL;
+    for (Tile* tile : live) {
+        if (tile->state == TileLoading || tile->priority <= thanPriority) continue;
+        if (!worst || tile->priority > worst->priority) worst = tile;
+    }
+    return worst;
+}
+
+void WorldStreamer::update(double time, const glm::vec3& eye, const glm::vec3& front, float movementSpeed) {
+    if (!isOpen()) return;
+    auto start = std::chrono::high_resolution_clock::now();
+    frame++;
+    collectFinished();
+    predictor.addSample(time, eye, front, movementSpeed);
+
+    glm::vec2 eye2(eye.x, eye.z);
+    glm::vec2 direction(front.x, front.z);
+    float length = glm::length(direction);
+    direction = length > 1e-4f ? direction / length : glm::vec2(0.0f);
+    candidates.clear();
+
+    // Walk the predicted path: a tile near it gets the distance to the path
+    // sample plus the distance travelled to get there, so the later the
+    // camera should arrive the less urgent the tile.
+    glm::vec3 velocity = predictor.velocity();
+    float speed = glm::length(glm::vec2(velocity.x, velocity.z));
+    if (settings.prefetchSeconds > 0.0f && settings.prefetchStep > 0.0f && speed * settings.prefetchSeconds > tileSize * 0.5f) {
+        for (float t = settings.prefetchStep; t <= settings.prefetchSeconds; t += settings.prefetchStep) {
+            glm::vec3 ahead = predictor.predict(t);
+            float travelled = speed * t * settings.arrivalWeight;
+            forTilesNear(glm::vec2(ahead.x, ahead.z), settings.prefetchRadius, [&](Tile* tile, float distance) {
+                float priority = distance + travelled;
+                if (tile->pathFrame != frame || priority < tile->pathPriority) {
+                    tile->pathFrame = frame;
+                    tile->pathPriority = priority;
+                }
+                addCandidate(tile);
+            });
+        }
+    }
+
+    // The ring around the camera. A tile coming within needDistance counts
+    // as a hit if it was already loaded.
+    forTilesNear(eye2, std::max(settings.loadDistance, settings.needDistance), [&](Tile* tile, float distance) {
+        if (distance <= settings.needDistance) {
+            if (tile->neededFrame != frame - 1) {
+                counters.needed++;
+                if (tile->state == TileLoaded || tile->state == TileResident) counters.hits++;
+            }
+            tile->neededFrame = frame;
+            tile->used = true;
+        }
+        if (distance <= settings.loadDistance) addCandidate(tile);
+    });
+    for (Tile* tile : live)
+        prioritize(*tile, eye2, direction);
+    for (Tile* tile : candidates)
+        prioritize(*tile, eye2, direction);
+
+    std::sort(candidates.begin(), candidates.end(),
+        [](const Tile* a, const Tile* b) { return a->priority < b->priority; });
+
+    // Evictions and instantiation share one node budget per frame. A tile
+    // bigger than the whole budget is still evicted in one go when it is the
+    // first thing done this frame, so a small budget cannot wedge streaming.
+    uint32_t work = settings.nodesPerFrame;
+    for (Tile* tile : candidates) {
+        if (loading >= settings.maxLoads) break;
+        bool fits = true;
+        while (committedBytes + tile->cost > settings.memoryBudget) {
+            Tile* victim = worstEvictable(tile->priority);
+            if (!victim || (victim->progress.next > work && work < settings.nodesPerFrame)) {
+                fits = false;
+                break;
+            }
+            work -= std::min(work, victim->progress.next);
+            evict(victim);
+        }
+        if (!fits) break;
+        startLoad(tile);
+    }
+
+    // Finish the most important loaded tiles first; tiles that drifted out of
+    // range wait, cheaply mapped, until they are wanted again or evicted.
+    candidates.clear();
+    for (Tile* tile : live) {
+        if (tile->state == TileLoaded && isWanted(*tile))
+            candidates.push_back(tile);
+    }
+    std::sort(candidates.begin(), candidates.end(),
+        [](const Tile* a, const Tile* b) { return a->priority < b->priority; });
+    for (Tile* tile : candidates) {
+        if (work == 0) break;
+        work -= instantiate(tile, work);
+    }
+
+    counters.resident = counters.pending = 0;
+    for (Tile* tile : live) {
+        if (tile->state == TileResident) counters.resident++;
+        else if (tile->state == TileLoaded) counters.pending++;
+    }
+    counters.loading = loading;
+    counters.bytes = committedBytes;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    counters.updateMs += ms;
+    counters.maxUpdateMs = std::max(counters.maxUpdateMs, ms);
+    counters.frames++;
+}
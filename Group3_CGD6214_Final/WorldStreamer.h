@@ -0,0 +1,193 @@
+#ifndef WORLDSTREAMER_H
+#define WORLDSTREAMER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "BuildingFactory.h"
+#include "Culling.h"
+#include "Scene.h"
+#include "SceneFile.h"
+#include "ThreadPool.h"
+#include "World.h"
+
+struct StreamingSettings {
+    float loadDistance;         // tiles whose centre is closer are wanted
+    float needDistance;         // closer than this a tile must be in, for the hit rate
+    float viewWeight;           // 0 = distance only, higher pushes tiles behind the camera back
+    size_t memoryBudget;        // mapped files plus runtime nodes, estimated
+    uint32_t nodesPerFrame;     // nodes created or destroyed per update()
+    int maxLoads;               // background loads in flight
+
+    // Prefetch along the predicted camera path; 0 seconds turns it off.
+    float prefetchSeconds;
+    float prefetchStep;         // seconds between path samples
+    float prefetchRadius;       // tiles whose centre is this close to a sample are wanted
+    float arrivalWeight;        // priority added per unit travelled before arriving
+
+    StreamingSettings() : loadDistance(256.0f), needDistance(200.0f), viewWeight(0.5f),
+        memoryBudget((size_t)256 << 20), nodesPerFrame(4096), maxLoads(4),
+        prefetchSeconds(2.0f), prefetchStep(0.25f), prefetchRadius(96.0f), arrivalWeight(1.0f) {}
+};
+
+// Resident state is refreshed every update(); the counters add up until
+// resetCounters(), so they cover the last stats interval.
+struct StreamingStats {
+    int resident;           // fully instantiated tiles
+    int pending;            // loaded, instantiation not finished
+    int loading;            // being mapped on the pool
+    size_t bytes;           // estimated, counts loading tiles
+    int loadsStarted;
+    int evictions;
+    int needed;             // tiles that came within needDistance
+    int hits;               // ... and were already loaded
+    int wasted;             // evicted without ever being needed
+    double updateMs;        // summed over frames
+    double maxUpdateMs;
+    int frames;
+
+    StreamingStats();
+    void resetCounters();
+    void print() const;
+};
+
+// Where the camera is heading, from its recent positions. The measured
+// velocity is capped at what Camera::ProcessKeyboard can produce, and while
+// moving mostly forward it follows Front, since turning redirects the motion
+// straight away.
+class CameraPredictor {
+public:
+    float window;           // seconds of history the velocity is measured over
+
+    CameraPredictor();
+    void addSample(double time, const glm::vec3& position, const glm::vec3& front, float movementSpeed);
+    const glm::vec3& velocity() const { return currentVelocity; }
+    glm::vec3 predict(float seconds) const { return lastPosition + currentVelocity * seconds; }
+
+private:
+    struct Sample {
+        double time;
+        glm::vec3 position;
+    };
+    std::deque<Sample> history;
+    glm::vec3 lastPosition;
+    glm::vec3 currentVelocity;
+};
+
+// Pages a city split into square tiles (see writeTiles) in and out around the
+// camera. Tile files are mapped and prefetched on the pool; their nodes are
+// created on the calling thread in update(), a bounded number per call, so a
+// fast flythrough costs a steady slice of every frame rather than a stall.
+// Once the memory budget is needed for a better tile, the tile with the worst
+// priority (far away, behind the camera) is evicted. Tiles along the path
+// the camera is predicted to take are fetched early, more urgently the sooner
+// it should get there.
+class WorldStreamer {
+public:
+    StreamingSettings settings;
+    CameraPredictor predictor;
+
+    WorldStreamer(Scene& scene, BuildingFactory& factory, World& world, ThreadPool& pool);
+    // Waits for loads still running on the pool.
+    ~WorldStreamer();
+
+    WorldStreamer(const WorldStreamer&) = delete;
+    WorldStreamer& operator=(const WorldStreamer&) = delete;
+
+    // Splits data into tiles by the XZ position of each root-level node, whose
+    // subtree goes along with it. Writes a manifest to path and a SceneFile per
+    // non-empty tile next to it ("<path>.<x>_<z>").
+    static bool writeTiles(const char* path, const SceneData& data, float tileSize);
+
+    bool open(const char* path);
+    bool isOpen() const { return tileSize > 0.0f; }
+
+    // Call once per frame, before Scene::update(), with the Camera's
+    // Position, Front and MovementSpeed.
+    void update(double time, const glm::vec3& eye, const glm::vec3& front, float movementSpeed);
+
+    // Streamed entities (buildings) whose tile BVH reaches into the frustum.
+    template<typename Fn>
+    void queryFrustum(const Frustum& frustum, Fn fn) const {
+        for (const Tile* tile : live) {
+            const std::vector<Entity>& buildings = tile->progress.buildings;
+            if (buildings.empty() || !frustum.intersects(tile->bounds)) continue;
+            tile->file.bvh().queryFrustum(frustum, [&](uint32_t item) {
+                if (item < buildings.size()) fn(buildings[item]);
+            });
+        }
+    }
+    // Streamed buildings currently in the World.
+    size_t buildingCount() const { return instantiatedBuildings; }
+
+    // True once after streamed entities were added or removed, for caches
+    // built from the whole World such as the GPU culler's instance list.
+    bool takeChanged();
+
+    const StreamingStats& stats() const { return counters; }
+    void resetCounters() { counters.resetCounters(); }
+
+private:
+    enum TileState { TileUnloaded, TileLoading, TileLoaded, TileResident };
+
+    struct Tile {
+        int x, z;
+        uint32_t nodeCount;
+        size_t cost;                // estimated bytes once instantiated
+        TileState state;
+        float distance;
+        float priority;             // lower loads first and is evicted last
+        float pathPriority;         // from the predicted path, valid if pathFrame is this frame
+        int pathFrame;
+        int candidateFrame;
+        int neededFrame;            // last frame it was within needDistance
+        bool used;                  // needed since it was loaded
+        SceneFile file;
+        NodeHandle group;           // parent of the tile's nodes
+        SceneInstantiation progress;
+        AABB bounds;                // of its buildings, once loaded
+    };
+
+    Scene& scene;
+    BuildingFactory& factory;
+    World& world;
+    ThreadPool& pool;
+
+    std::string basePath;
+    float tileSize;
+    std::vector<Tile*> tiles;
+    std::unordered_map<uint64_t, Tile*> lookup;
+    std::vector<Tile*> live;        // every tile not TileUnloaded
+    std::vector<Tile*> candidates;
+    size_t committedBytes;
+    size_t instantiatedBuildings;
+    int loading;
+    int frame;
+    bool changed;
+    StreamingStats counters;
+
+    // Written by loader jobs.
+    std::mutex mutex;
+    std::condition_variable loadDone;
+    std::vector<std::pair<Tile*, bool>> finished;
+
+    static uint64_t key(int x, int z) { return ((uint64_t)(uint32_t)x << 32) | (uint32_t)z; }
+    static std::string tilePath(const std::string& base, int x, int z);
+    void collectFinished();
+    template<typename Fn>
+    void forTilesNear(const glm::vec2& center, float radius, Fn fn);
+    void prioritize(Tile& tile, const glm::vec2& eye, const glm::vec2& direction) const;
+    bool isWanted(const Tile& tile) const { return tile.distance <= settings.loadDistance || tile.pathFrame == frame; }
+    void addCandidate(Tile* tile);
+    void startLoad(Tile* tile);
+    uint32_t instantiate(Tile* tile, uint32_t maxNodes);
+    void evict(Tile* tile);
+    Tile* worstEvictable(float thanPriority) const;
+};
+
+#endif
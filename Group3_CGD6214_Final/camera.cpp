@@ -1,10 +1,13 @@
 #include "Camera.h"
 
-Camera::Camera(glm::vec3 position, glm::vec3 up, float yaw, float pitch)
+Camera::Camera(glm::dvec3 position, glm::vec3 up, float yaw, float pitch)
     : Front(glm::vec3(0.0f, 0.0f, -1.0f)),
     MovementSpeed(SPEED),
     MouseSensitivity(SENSITIVITY),
-    Zoom(ZOOM) {
+    Zoom(ZOOM),
+    Collider(NULL),
+    CollisionRadius(0.3f),
+    CollisionLayers(CollideGround | CollideSolid) {
     Position = position;
     WorldUp = up;
     Yaw = yaw;
@@ -12,20 +15,36 @@ Camera::Camera(glm::vec3 position, glm::vec3 up, float yaw, float pitch)
     updateCameraVectors();
 }
 
-glm::mat4 Camera::GetViewMatrix() {
-    return glm::lookAt(Position, Position + Front, Up);
+glm::mat4 Camera::GetViewMatrix(const glm::dvec3& origin) const {
+    glm::vec3 eye(Position - origin);
+    return glm::lookAt(eye, eye + Front, Up);
+}
+
+glm::mat4 Camera::GetProjectionMatrix(float aspect, bool reversedZ) const {
+    if (!reversedZ)
+        return glm::infinitePerspective(glm::radians(Zoom), aspect, NEAR_PLANE);
+    // clip z = near, clip w = -z_view: depth near / distance.
+    float f = 1.0f / tan(glm::radians(Zoom) * 0.5f);
+    glm::mat4 m(0.0f);
+    m[0][0] = f / aspect;
+    m[1][1] = f;
+    m[2][3] = -1.0f;
+    m[3][2] = NEAR_PLANE;
+    return m;
 }
 
 void Camera::ProcessKeyboard(Camera_Movement direction, float deltaTime) {
-    float velocity = MovementSpeed * deltaTime;
+    double velocity = MovementSpeed * deltaTime;
+    glm::dvec3 target = Position;
     if (direction == FORWARD)
-        Position += Front * velocity;
+        target += glm::dvec3(Front) * velocity;
     if (direction == BACKWARD)
-        Position -= Front * velocity;
+        target -= glm::dvec3(Front) * velocity;
     if (direction == LEFT)
-        Position -= Right * velocity;
+        target -= glm::dvec3(Right) * velocity;
     if (direction == RIGHT)
-        Position += Right * velocity;
+        target += glm::dvec3(Right) * velocity;
+    Position = Collider ? Collider->slide(Position, target, CollisionRadius, CollisionLayers) : target;
 }
 
 void Camera::ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch) {
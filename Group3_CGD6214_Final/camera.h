@@ -4,6 +4,7 @@
 #include <gl/glew.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include "Collision.h"
 
 enum Camera_Movement {
     FORWARD,
@@ -17,10 +18,11 @@ const float PITCH = 0.0f;
 const float SPEED = 2.5f;
 const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
+const float NEAR_PLANE = 0.1f;
 
 class Camera {
 public:
-    glm::vec3 Position;
+    glm::dvec3 Position;        // double so the camera stays steady far from the origin
     glm::vec3 Front;
     glm::vec3 Up;
     glm::vec3 Right;
@@ -33,11 +35,23 @@ public:
     float MouseSensitivity;
     float Zoom;
 
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f),
+    // When set, keyboard movement slides along the static boxes in
+    // CollisionLayers instead of passing through them.
+    const CollisionWorld* Collider;
+    float CollisionRadius;
+    uint32_t CollisionLayers;
+
+    Camera(glm::dvec3 position = glm::dvec3(0.0),
         glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f),
         float yaw = YAW, float pitch = PITCH);
 
-    glm::mat4 GetViewMatrix();
+    // View for geometry given relative to origin; pass Position itself for
+    // camera-relative rendering, which leaves only the rotation.
+    glm::mat4 GetViewMatrix(const glm::dvec3& origin) const;
+    // Infinite far plane. reversedZ maps the near plane to depth 1 and
+    // infinity to 0 and needs glClipControl(..., GL_ZERO_TO_ONE); otherwise
+    // the usual GL depth range.
+    glm::mat4 GetProjectionMatrix(float aspect, bool reversedZ) const;
     void ProcessKeyboard(Camera_Movement direction, float deltaTime);
     void ProcessMouseMovement(float xoffset, float yoffset, GLboolean constrainPitch = true);
     void ProcessMouseScroll(float yoffset);
@@ -4,35 +4,133 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include "shader.h"
 #include "camera.h"
 #include "Node.h"
+#include "Scene.h"
+#include "Animation.h"
+#include "Benchmarks.h"
 #include "Building.h"
+#include "BuildingFactory.h"
+#include "World.h"
+#include "Impostor.h"
+#include "Culling.h"
+#include "Crowd.h"
+#include "OcclusionCuller.h"
+#include "ThreadPool.h"
+#include "Traffic.h"
+#include "HiZCuller.h"
+#include "RenderTarget.h"
+#include "InstanceBuffer.h"
+#include "PickReadback.h"
+#include "PVS.h"
+#include "RoadNetwork.h"
+#include "RoutePlanner.h"
+#include "Bvh.h"
+#include "Collision.h"
+#include "SceneFile.h"
+#include "SceneQuery.h"
+#include "SceneText.h"
+#include "WorldStreamer.h"
+#include "FixedStepScheduler.h"
+#include "SnapshotMailbox.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-// Camera
-Camera camera(glm::vec3(0.0f, 3.0f, 15.0f));
+// What the render thread passes the simulation thread: key state, and mouse
+// movement and clicks added up since the simulation last took it.
+struct FrameInput {
+    bool forward, backward, left, right;
+    float mouseX, mouseY, scroll;
+    bool pick;              // left click, picks what is under the crosshair
+    bool gpuPicked;         // the ID buffer answered a pick
+    uint32_t gpuPickId;     // entity handle + 1, 0 = nothing
+    int gpuPickLatency;     // frames between the click's frame and the answer
+    bool gpuCulling;
+    int height;
+
+    FrameInput() : forward(false), backward(false), left(false), right(false),
+        mouseX(0.0f), mouseY(0.0f), scroll(0.0f), pick(false), gpuPicked(false), gpuPickId(0), gpuPickLatency(0),
+        gpuCulling(false), height(720) {}
+};
+
+// One frame as the render thread draws it, built by the simulation thread.
+// Everything in it is relative to the frame's origin already.
+struct FrameSnapshot {
+    struct ImpostorDraw {
+        glm::vec3 center;
+        int archetype;
+    };
+
+    bool gpuCulling;
+    bool pick;                                          // read the ID buffer under the crosshair
+    glm::mat4 projection, view, worldView, viewProjection;
+    glm::vec3 eye, eyeRelative;
+    float pixelScale;
+    std::vector<std::vector<Affine3x4>> drawBatches;    // CPU culling, by material * meshCount + mesh
+    std::vector<std::vector<uint32_t>> drawBatchIds;    // pick IDs alongside, when the ID buffer is on
+    std::vector<ImpostorDraw> impostors;
+    bool instancesChanged;                              // GPU culler input to upload
+    std::vector<HiZCuller::Instance> instances;         // static ones, only when instancesChanged
+    bool movingChanged;
+    std::vector<HiZCuller::Instance> movingInstances;
+    CullStats cullStats;
+    bool statsDue;                                      // once per stats interval
+    StreamingStats streamingStats;
+    double simulateMs;                                  // per frame, averaged over the interval
+    int carPairs, buildingPairs;                        // cars touching each other, and buildings
+    double collisionMs;
+
+    FrameSnapshot() : gpuCulling(false), pick(false), pixelScale(0.0f), instancesChanged(false), movingChanged(false), statsDue(false), simulateMs(0.0),
+        carPairs(0), buildingPairs(0), collisionMs(0.0) {}
+};
+
+// Camera, owned by the simulation thread once it starts.
+Camera camera(glm::dvec3(0.0, 3.0, 15.0));
 float lastX = 1280.0f / 2.0;
 float lastY = 720.0f / 2.0;
 bool firstMouse = true;
 
-float deltaTime = 0.0f;
-float lastFrame = 0.0f;
+FrameInput input;
+std::mutex inputMutex;
+
+// GPU Hi-Z culling, only offered on GL 4.5 contexts; toggled with G.
+bool gpuCullingSupported = false;
+bool gpuCulling = false;
 
 void processInput(GLFWwindow* window) {
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    int fbWidth, fbHeight;
+    glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.forward = glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS;
+    input.backward = glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS;
+    input.left = glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS;
+    input.right = glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
+    input.gpuCulling = gpuCulling;
+    input.height = fbHeight;
+}
+
+// Camera movement is part of the simulation and runs once per tick.
+void processMovement(const FrameInput& keys, float deltaTime) {
+    if (keys.forward)
         camera.ProcessKeyboard(FORWARD, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if (keys.backward)
         camera.ProcessKeyboard(BACKWARD, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if (keys.left)
         camera.ProcessKeyboard(LEFT, deltaTime);
-    if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if (keys.right)
         camera.ProcessKeyboard(RIGHT, deltaTime);
 }
 
@@ -40,6 +138,14 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
 }
 
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if (action != GLFW_PRESS) return;
+    if (key == GLFW_KEY_G && gpuCullingSupported) {
+        gpuCulling = !gpuCulling;
+        std::cout << "GPU culling " << (gpuCulling ? "on" : "off") << std::endl;
+    }
+}
+
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     if (firstMouse) {
         lastX = xpos;
@@ -50,11 +156,20 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     float yoffset = lastY - ypos;
     lastX = xpos;
     lastY = ypos;
-    camera.ProcessMouseMovement(xoffset, yoffset);
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.mouseX += xoffset;
+    input.mouseY += yoffset;
 }
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
-    camera.ProcessMouseScroll(yoffset);
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.scroll += (float)yoffset;
+}
+
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) return;
+    std::lock_guard<std::mutex> lock(inputMutex);
+    input.pick = true;
 }
 
 unsigned int loadTexture(const char* path) {
@@ -81,13 +196,302 @@ unsigned int loadTexture(const char* path) {
     return textureID;
 }
 
-int main() {
+// Bounds of every cullable entity, indexed like world.bounds.
+// Occluders also block sight for the PVS.
+void gatherStaticBounds(const World& world, std::vector<AABB>& bounds, std::vector<char>& occluders) {
+    bounds.resize(world.bounds.size());
+    occluders.resize(world.bounds.size());
+    for (size_t i = 0; i < world.bounds.size(); i++) {
+        bounds[i] = world.bounds[i].box;
+        occluders[i] = world.bounds[i].occluder;
+    }
+}
+
+// The camera's static collision set: every building except those in moving.
+// Fields and roads are ground: cars always touch them, so cars are only
+// checked against buildings and each other.
+void gatherCollisionStatic(const Scene& scene, const World& world, const std::vector<Entity>& moving,
+    std::vector<OBB>& boxes, std::vector<uint32_t>& layers) {
+    std::vector<char> skip(world.buildings.size() + 1, 0);
+    for (size_t i = 0; i < moving.size(); i++) skip[world.buildings.indexOf(moving[i])] = 1;
+    boxes.clear();
+    layers.clear();
+    for (size_t i = 0; i < world.buildings.size(); i++) {
+        if (skip[i]) continue;
+        BuildingType type = world.buildings[i].type;
+        boxes.push_back(OBB::fromTransform(scene.get(world.buildings.entity(i))->worldTransform));
+        bool ground = type == BuildingType::FIELD || type == BuildingType::ROAD;
+        layers.push_back(ground ? CollideGround : CollideSolid);
+    }
+}
+
+// Lays one value per component out in world.bounds order, so systems can
+// join it by index instead of looking each entity up: fill where an entity
+// has none, and one spare slot at the end, which is where indexOf() sends
+// entities without Bounds.
+template<typename T, typename V, typename Fn>
+void scatterToBounds(const World& world, const ComponentArray<T>& components, V fill, Fn value, std::vector<V>& out) {
+    out.assign(world.bounds.size() + 1, fill);
+    for (size_t i = 0; i < components.size(); i++)
+        out[world.bounds.indexOf(components.entity(i))] = value(components[i]);
+}
+
+// GPU culler input: every entity with a mesh but those in moving, with model
+// matrices relative to origin.
+void gatherGpuInstances(const Scene& scene, const World& world, const glm::dvec3& origin,
+    const std::vector<Entity>& moving, std::vector<HiZCuller::Instance>& instances) {
+    std::vector<int> impostorOf;
+    std::vector<float> minPixelsOf;
+    scatterToBounds(world, world.impostors, -1, [](const ImpostorProxy& p) { return p.archetype; }, impostorOf);
+    scatterToBounds(world, world.screenSizes, 0.0f, [](const ScreenSizeCull& s) { return s.minPixels; }, minPixelsOf);
+    std::vector<char> skip(world.renderables.size() + 1, 0);
+    for (size_t i = 0; i < moving.size(); i++) skip[world.renderables.indexOf(moving[i])] = 1;
+
+    instances.clear();
+    for (size_t i = 0; i < world.renderables.size(); i++) {
+        if (skip[i]) continue;
+        Entity e = world.renderables.entity(i);
+        size_t b = world.bounds.indexOf(e);
+        HiZCuller::Instance inst;
+        inst.model = scene.get(e)->relativeTransform(origin);
+        inst.bounds = world.bounds[b].box;
+        inst.group = world.renderables[i].material;
+        inst.hasImpostor = impostorOf[b] >= 0;
+        inst.minPixels = minPixelsOf[b];
+        inst.pickId = e.value + 1;
+        instances.push_back(inst);
+    }
+}
+
+// The moving entities' instances, in list order, for HiZCuller's moving range.
+// Looked up one by one: there are few of them and they are gathered every
+// frame. Entities without a mesh or node are left out.
+void gatherMovingInstances(const Scene& scene, const World& world, const glm::dvec3& origin,
+    const std::vector<Entity>& moving, std::vector<HiZCuller::Instance>& instances) {
+    instances.clear();
+    for (size_t i = 0; i < moving.size(); i++) {
+        Entity e = moving[i];
+        const Renderable* r = world.renderables.get(e);
+        const Bounds* bounds = world.bounds.get(e);
+        const Node* node = scene.get(e);
+        if (!r || !bounds || !node) continue;
+        const ScreenSizeCull* size = world.screenSizes.get(e);
+        HiZCuller::Instance inst;
+        inst.model = node->relativeTransform(origin);
+        inst.bounds = bounds->box;
+        inst.group = r->material;
+        inst.hasImpostor = world.impostors.get(e) != NULL;
+        inst.minPixels = size ? size->minPixels : 0.0f;
+        inst.pickId = e.value + 1;
+        instances.push_back(inst);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc > 2 && std::string(argv[1]) == "--bench")
+        return runBenchmark(argv[2]) ? 0 : 1;
+
+    bool bakePvs = false;
+    const char* scenePath = NULL;
+    const char* writeScenePath = NULL;
+    bool useSceneCache = true;
+    const char* streamPath = NULL;
+    const char* writeTilesPath = NULL;
+    float writeTileSize = 0.0f;
+    int carCount = 24;
+    int peopleCount = 2000;
+    double tickRate = 60.0;
+    bool pickBuffer = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bake-pvs")
+            bakePvs = true;
+        else if (arg == "--scene" && i + 1 < argc)
+            scenePath = argv[++i];
+        else if (arg == "--write-scene" && i + 1 < argc)
+            writeScenePath = argv[++i];
+        else if (arg == "--no-scene-cache")
+            useSceneCache = false;
+        else if (arg == "--stream" && i + 1 < argc)
+            streamPath = argv[++i];
+        else if (arg == "--write-tiles" && i + 2 < argc) {
+            writeTilesPath = argv[++i];
+            writeTileSize = (float)std::atof(argv[++i]);
+        }
+        else if (arg == "--cars" && i + 1 < argc)
+            carCount = std::atoi(argv[++i]);
+        else if (arg == "--people" && i + 1 < argc)
+            peopleCount = std::atoi(argv[++i]);
+        else if (arg == "--tick-rate" && i + 1 < argc)
+            tickRate = std::atof(argv[++i]);
+        else if (arg == "--pick-buffer")
+            pickBuffer = true;
+    }
+
+    // The city is plain nodes plus components; GL names for the shared cube
+    // mesh and the materials are filled in once the context exists.
+    Scene scene;
+    World world;
+    world.meshes.push_back(Mesh{ 0, 36 });
+    world.materials.resize(BuildingFactory::MaterialCount);
+    ScreenSizeCuller screenSize;
+    BuildingFactory factory(scene, world);
+
+    ThreadPool threadPool;
+
+    // The static city either comes from a scene file, whose BVH is used in
+    // place from the mapping, or is the built-in one with a BVH built here.
+    // Text scenes (.city) are parsed on the pool and cached as binary.
+    // When streaming, the built-in city is left out and tiles come and go
+    // on top of whatever static scene was given.
+    SceneFile sceneFile;
+    Bvh builtBvh;
+    BvhView staticBvh;
+    NodeHandle root = scene.root();
+    if (scenePath) {
+        std::string path = scenePath;
+        bool isText = path.size() > 5 && path.compare(path.size() - 5, 5, ".city") == 0;
+        bool opened = isText ? SceneText::open(scenePath, &threadPool, useSceneCache, sceneFile)
+                             : sceneFile.open(scenePath);
+        if (!opened) {
+            std::cout << "Failed to open scene " << scenePath << std::endl;
+            return -1;
+        }
+        sceneFile.instantiate(scene, factory, world);
+        staticBvh = sceneFile.bvh();
+    }
+    else if (!streamPath) {
+        factory.create(root, glm::dvec3(0, -1, 0), glm::vec3(50, 0.2, 50), BuildingType::FIELD);
+        factory.create(root, glm::dvec3(0, -0.9, 0), glm::vec3(40, 0.1, 6), BuildingType::ROAD);
+        factory.create(root, glm::dvec3(5, 0, -5), glm::vec3(4, 20, 4), BuildingType::SKYSCRAPER);
+    }
+    scene.update();
+    world.updateBounds(scene);
+    if (!sceneFile.isOpen()) {
+        std::vector<AABB> boxes;
+        std::vector<char> unused;
+        gatherStaticBounds(world, boxes, unused);
+        builtBvh.build(boxes.data(), (uint32_t)boxes.size());
+        staticBvh = builtBvh.view();
+    }
+
+    if (writeScenePath) {
+        bool ok = SceneFile::write(writeScenePath, SceneData::capture(scene, world));
+        std::cout << (ok ? "Wrote " : "Failed to write ") << writeScenePath << std::endl;
+        return ok ? 0 : -1;
+    }
+    if (writeTilesPath) {
+        bool ok = WorldStreamer::writeTiles(writeTilesPath, SceneData::capture(scene, world), writeTileSize);
+        std::cout << (ok ? "Wrote " : "Failed to write ") << writeTilesPath << std::endl;
+        return ok ? 0 : -1;
+    }
+
+    // Street-level visibility is baked offline: run with --bake-pvs after
+    // changing the city, the result is picked up on the next launch.
+    const char* pvsPath = "city.pvs";
+    std::vector<AABB> staticBounds;
+    std::vector<char> staticOccluders;
+    gatherStaticBounds(world, staticBounds, staticOccluders);
+    if (bakePvs) {
+        PotentiallyVisibleSet bakedPvs;
+        bakedPvs.bake(staticBounds, staticOccluders, PvsBakeSettings(), threadPool);
+        if (!bakedPvs.save(pvsPath)) {
+            std::cout << "Failed to write " << pvsPath << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+    PotentiallyVisibleSet pvs;
+    if (!pvs.load(pvsPath, PotentiallyVisibleSet::hashScene(staticBounds)))
+        std::cout << "No up-to-date " << pvsPath << ", run with --bake-pvs to enable PVS culling" << std::endl;
+
+    // The camera slides along the static city instead of flying through it.
+    // Streamed tiles change the static set; it is rebuilt whenever they do.
+    // Car pairs are only detected and counted: the lane model already keeps
+    // cars apart along a lane, so the pairs are where it does not (crossings,
+    // props and buildings too close to the road), and nothing pushes the
+    // cars apart.
+    // Cars and animated props, filled in once they exist below; nothing
+    // moves yet.
+    std::vector<Entity> movers;
+    CollisionWorld collision(threadPool);
+    std::vector<OBB> collisionBoxes;
+    std::vector<uint32_t> collisionLayers;
+    gatherCollisionStatic(scene, world, movers, collisionBoxes, collisionLayers);
+    collision.setStatic(collisionBoxes, collisionLayers);
+    camera.Collider = &collision;
+    // Ray casts and overlap queries over the city; a left click names what
+    // is under the crosshair. Built on the first pick, once every node has a
+    // world transform, and again after streamed tiles come or go.
+    SceneQuery sceneQuery(threadPool);
+    bool sceneQueryStale = true;
+    std::vector<OBB> carBoxes;
+    std::vector<CollisionPair> collisionPairs;
+
+    // Traffic drives on the roads of the static city, each car routed to a
+    // destination. The cars come after the static bounds were gathered, so
+    // culling tests them one by one.
+    RoadNetwork roads;
+    roads.addRoads(scene, world);
+    roads.build();
+    RoutePlanner routePlanner(roads, threadPool);
+    routePlanner.preprocess();
+    Traffic traffic(roads, threadPool);
+    traffic.planner = &routePlanner;
+    if (carCount > 0 && !roads.edges.empty()) {
+        int placed = traffic.spawn(carCount, 1, &factory, root);
+        std::cout << placed << " cars on " << roads.edges.size() << " road edges" << std::endl;
+    }
+
+    // A fan spinning on every skyscraper roof, each at its own pace. Like the
+    // cars they come after the static bounds.
+    AnimationSystem animation(threadPool);
+    AnimationClip fanClip(AnimationClip::Rotation, AnimationWrap::Loop);
+    for (int k = 0; k <= 4; k++)
+        fanClip.addRotationKey(k * 0.5f, glm::angleAxis(k * 1.5707963f, glm::vec3(0.0f, 1.0f, 0.0f)));
+    int fanSpin = animation.addClip(fanClip);
+    std::vector<Entity> towers;
+    for (size_t i = 0; i < world.buildings.size(); i++) {
+        if (world.buildings[i].type == BuildingType::SKYSCRAPER)
+            towers.push_back(world.buildings.entity(i));
+    }
+    for (size_t i = 0; i < towers.size(); i++) {
+        const Node* tower = scene.get(towers[i]);
+        const Affine3x4& m = tower->worldTransform;
+        float width = std::min(glm::length(m.axis(0)), glm::length(m.axis(2)));
+        glm::dvec3 roof = tower->worldPosition + glm::dvec3(0.0, glm::length(m.axis(1)) * 0.5 + 0.3, 0.0);
+        Entity fan = factory.create(root, roof, glm::vec3(width * 0.8f, 0.1f, width * 0.15f), BuildingType::PROP);
+        animation.play(fan, fanSpin, 0.0, 0.5f + (i % 4) * 0.25f);
+    }
+    // Cars and fans move every frame, so ray casts see them through a tree
+    // refitted on the frames that pick rather than the rebuilt static one,
+    // and the GPU culler rewrites only their instances.
+    for (size_t i = 0; i < traffic.cars().size(); i++) {
+        if (!traffic.cars()[i].isNull()) movers.push_back(traffic.cars()[i]);
+    }
+    movers.insert(movers.end(), animation.playing().begin(), animation.playing().end());
+    sceneQuery.setDynamic(movers);
+
+    // Pedestrians on the sidewalks. They are not scene nodes: the crowd keeps
+    // its own arrays and each frame hands over the visible ones as impostors.
+    Crowd crowd(roads, threadPool);
+    if (peopleCount > 0 && !roads.edges.empty()) {
+        crowd.spawn(peopleCount, 7);
+        std::cout << crowd.agentCount() << " pedestrians on the sidewalks" << std::endl;
+    }
+
     glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    // Ask for 4.5 for the GPU culling path, fall back to the baseline 3.3.
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
     GLFWwindow* window = glfwCreateWindow(1280, 720, "Planned City GTA-V Style", NULL, NULL);
+    if (window == NULL) {
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        window = glfwCreateWindow(1280, 720, "Planned City GTA-V Style", NULL, NULL);
+    }
     if (window == NULL) {
         std::cout << "Failed to create GLFW window" << std::endl;
         glfwTerminate();
@@ -97,6 +501,8 @@ int main() {
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetKeyCallback(window, key_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     if (glewInit() != GLEW_OK) {
@@ -105,6 +511,7 @@ int main() {
     }
 
     glEnable(GL_DEPTH_TEST);
+    gpuCullingSupported = GLEW_VERSION_4_5 != 0;
 
     Shader ourShader("shaders/vertexShader.vs", "shaders/fragmentShader.fs");
 
@@ -170,59 +577,447 @@ int main() {
     unsigned int texGrass = loadTexture("textures/grass.jpg");
     unsigned int texRoad = loadTexture("textures/road.jpg");
     unsigned int texHigh = loadTexture("textures/high.jpg");
+    InstanceBuffer cubeInstances;
+    cubeInstances.attach(VAO);
+    world.meshes[0].vao = VAO;
+    world.materials[BuildingFactory::MaterialGrass].texture = texGrass;
+    world.materials[BuildingFactory::MaterialRoad].texture = texRoad;
+    world.materials[BuildingFactory::MaterialFacade].texture = texHigh;
 
     ourShader.use();
     ourShader.setInt("texture1", 0);
 
-    Node cityRoot;
+    // Bake one impostor per distinct size among the entities with a proxy.
+    ImpostorSystem impostors;
+    for (size_t i = 0; i < world.impostors.size(); i++) {
+        Entity e = world.impostors.entity(i);
+        const Affine3x4& m = scene.get(e)->worldTransform;
+        glm::vec3 scale(glm::length(m.axis(0)), glm::length(m.axis(1)), glm::length(m.axis(2)));
+        world.impostors[i].archetype = impostors.addArchetype(scale, world.materials[world.renderables.get(e)->material].texture);
+    }
+    int pedestrianArchetype = impostors.addArchetype(glm::vec3(0.5f, crowd.settings.height, 0.4f), texHigh);
+    std::vector<glm::vec3> pedestrians;
+    const float pedestrianDistance = 250.0f;    // a couple of pixels tall beyond this
+    Shader bakeShader("shaders/vertexShader.vs", "shaders/impostorBake.fs");
+    bakeShader.use();
+    bakeShader.setInt("texture1", 0);
+    impostors.bake(bakeShader, VAO, 36, cubeInstances);
+
+    // Reversed-Z from here on (the bake above uses the usual depth range):
+    // with a [0, 1] clip range and a float depth buffer, precision no longer
+    // runs out a few hundred units from the camera.
+    bool reversedZ = GLEW_VERSION_4_5 || GLEW_ARB_clip_control;
+    if (reversedZ) {
+        glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+        glClearDepth(0.0);
+        glDepthFunc(GL_GREATER);
+    }
+    impostors.zeroToOneDepth = reversedZ;
+
+    WorldStreamer streamer(scene, factory, world, threadPool);
+    if (streamPath && !streamer.open(streamPath)) {
+        std::cout << "Failed to open tiles " << streamPath << std::endl;
+        return -1;
+    }
+
+    OcclusionCuller occlusion(threadPool);
+    std::vector<char> visible;
+    size_t meshCount = world.meshes.size();
+    float impostorDistance = impostors.distance;
+    bool streaming = streamer.isOpen();
+
+    // With --pick-buffer the scene also writes entity IDs, and a click reads
+    // the one under the crosshair back a frame or two later, next to the
+    // ray cast's answer.
+    RenderTarget sceneTarget;
+    sceneTarget.enableIds(pickBuffer);
+    PickReadback pickReadback;
+    uint64_t renderedFrameCount = 0;
+    HiZCuller* hiZ = NULL;
+    // The GPU instance list is uploaded relative to this and only rebuilt
+    // when the camera strays far from it.
+    glm::dvec3 gpuOrigin = camera.Position;
+    if (gpuCullingSupported) {
+        hiZ = new HiZCuller(VBO, 36);
+        hiZ->impostorDistance = impostors.distance;
+        std::vector<HiZCuller::Instance> instances, moving;
+        gatherGpuInstances(scene, world, gpuOrigin, movers, instances);
+        gatherMovingInstances(scene, world, gpuOrigin, movers, moving);
+        hiZ->setInstances(instances, moving);
+        std::cout << "GL 4.5 context: press G to toggle GPU Hi-Z culling" << std::endl;
+    }
+
+    // The simulation (camera movement, traffic and pedestrians) runs in fixed
+    // ticks; each frame draws the camera, cars and people between the last two.
+    FixedStepScheduler scheduler(tickRate);
+    glm::dvec3 cameraTicked = camera.Position;
+    glm::dvec3 cameraBeforeTick = camera.Position;
+    float statsTimer = 0.0f;
+    double simulateMs = 0.0;
+    int simulatedFrames = 0;
+
+    // Builds the next frame: simulation, scene update and culling, down to
+    // the draw lists. Runs on the simulation thread, which from here on is
+    // the only one to touch the scene, world, camera and streamer; the
+    // render thread only sees the snapshots.
+    auto simulateFrame = [&](FrameSnapshot& frame) {
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        FrameInput in;
+        {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            in = input;
+            input.mouseX = input.mouseY = input.scroll = 0.0f;
+            input.pick = false;
+            input.gpuPicked = false;
+        }
+        camera.ProcessMouseMovement(in.mouseX, in.mouseY);
+        if (in.scroll != 0.0f) camera.ProcessMouseScroll(in.scroll);
+
+        int ticks = scheduler.advance();
+        camera.Position = cameraTicked;
+        for (int t = 0; t < ticks; t++) {
+            cameraBeforeTick = camera.Position;
+            processMovement(in, scheduler.step());
+            traffic.tick(scheduler.step());
+            crowd.tick(scheduler.step());
+        }
+        cameraTicked = camera.Position;
+        if (ticks > 0 && traffic.carCount() > 0) {
+            traffic.carBoxes(carBoxes);
+            collision.setDynamic(carBoxes);
+            collision.findPairs(CollideSolid, collisionPairs);
+        }
+        float alpha = scheduler.alpha();
+        camera.Position = cameraBeforeTick + (cameraTicked - cameraBeforeTick) * (double)alpha;
+
+        glm::vec3 eye(camera.Position);
+        if (in.pick) {
+            Ray ray = { eye, camera.Front, 2000.0f };
+            RayHit hit;
+            if (sceneQueryStale) {
+                sceneQuery.build(scene, world);
+                sceneQueryStale = false;
+            }
+            else
+                sceneQuery.updateDynamic(scene);
+            if (sceneQuery.raycast(ray, hit)) {
+                const BuildingInfo* info = world.buildings.get(hit.entity);
+                std::cout << "Picked " << (info ? buildingTypeName(info->type) : "entity") << " " << hit.entity.index()
+                          << " at " << hit.distance << " m" << std::endl;
+            }
+            else
+                std::cout << "Nothing under the crosshair" << std::endl;
+        }
+        frame.pick = in.pick;
+        if (in.gpuPicked) {
+            NodeHandle picked;
+            picked.value = in.gpuPickId - 1;
+            const BuildingInfo* info = in.gpuPickId ? world.buildings.get(picked) : NULL;
+            if (in.gpuPickId)
+                std::cout << "ID buffer: " << (info ? buildingTypeName(info->type) : "entity") << " " << picked.index();
+            else
+                std::cout << "ID buffer: nothing";
+            std::cout << ", " << in.gpuPickLatency << " frames after the click" << std::endl;
+        }
+
+        // Sync point: structural edits queued during the last frame land here.
+        scene.flush();
+        traffic.syncTransforms(scene, alpha);
+        // At the moment the interpolated cars show, a step behind the last tick.
+        animation.evaluate(scene, scheduler.simulatedTime() - (1.0 - alpha) * scheduler.step());
+        streamer.update(scheduler.realTime(), eye, camera.Front, camera.MovementSpeed);
+        scene.update();
+        world.updateBounds(scene);
+        bool rebased = false;
+        if (hiZ && glm::distance(camera.Position, gpuOrigin) > 1024.0) {
+            gpuOrigin = camera.Position;
+            rebased = true;
+        }
+        bool streamedChanged = streamer.takeChanged();
+        if (streamedChanged) {
+            gatherCollisionStatic(scene, world, movers, collisionBoxes, collisionLayers);
+            collision.setStatic(collisionBoxes, collisionLayers);
+            sceneQueryStale = true;
+        }
+        // Cars and animated props only rewrite their own range of the upload
+        // each frame.
+        frame.instancesChanged = (streamedChanged || rebased) && hiZ;
+        frame.movingChanged = !movers.empty() && hiZ;
+        if (frame.instancesChanged)
+            gatherGpuInstances(scene, world, gpuOrigin, movers, frame.instances);
+        if (frame.instancesChanged || frame.movingChanged)
+            gatherMovingInstances(scene, world, gpuOrigin, movers, frame.movingInstances);
+
+        // Everything drawn is relative to origin, so the float model-view
+        // never holds large coordinates; culling stays in world space.
+        float aspect = 1280.0f / 720.0f;
+        frame.gpuCulling = in.gpuCulling && hiZ;
+        glm::dvec3 origin = frame.gpuCulling ? gpuOrigin : camera.Position;
+        glm::vec3 eyeRelative(camera.Position - origin);
+        frame.eye = eye;
+        frame.eyeRelative = eyeRelative;
+        frame.projection = camera.GetProjectionMatrix(aspect, reversedZ);
+        frame.view = camera.GetViewMatrix(origin);
+        frame.worldView = camera.GetViewMatrix(glm::dvec3(0.0));
+        frame.viewProjection = camera.GetProjectionMatrix(aspect, false) * frame.worldView;
+        screenSize.setup(camera.Zoom, (float)in.height);
+        frame.pixelScale = screenSize.pixelScale;
+        frame.impostors.clear();
+        CullStats& cullStats = frame.cullStats;
 
-    Building ground(glm::vec3(0, -1, 0), glm::vec3(50, 0.2, 50), BuildingType::FIELD);
-    Building road(glm::vec3(0, -0.9, 0), glm::vec3(40, 0.1, 6), BuildingType::ROAD);
-    Building skyscraper(glm::vec3(5, 0, -5), glm::vec3(4, 20, 4), BuildingType::SKYSCRAPER);
+        if (frame.gpuCulling) {
+            // Visibility is decided on the GPU, only impostor selection
+            // stays here.
+            for (size_t i = 0; i < world.impostors.size(); i++) {
+                if (world.impostors[i].archetype < 0) continue;
+                glm::vec3 center(scene.get(world.impostors.entity(i))->worldPosition - origin);
+                if (glm::distance(center, eyeRelative) > impostorDistance)
+                    frame.impostors.push_back(FrameSnapshot::ImpostorDraw{ center, world.impostors[i].archetype });
+            }
+        }
+        else {
+            // Frustum test everything, rasterize the biggest nearby solid buildings
+            // as occluders, then test the rest against the occlusion buffer.
+            auto cullStart = std::chrono::high_resolution_clock::now();
+            Frustum frustum;
+            frustum.extract(frame.viewProjection);
+            occlusion.begin(frame.viewProjection, eye);
+            cullStats.reset();
+            const unsigned char* pvsBits = pvs.lookup(eye);
 
-    cityRoot.addChild(&ground);
-    cityRoot.addChild(&road);
-    cityRoot.addChild(&skyscraper);
+            // visible is in world.bounds order, with a spare slot at the end
+            // that stays 0: systems joining other components through
+            // indexOf() land there for entities without Bounds.
+            size_t count = world.bounds.size();
+            visible.assign(count + 1, 0);
+            cullStats.tested = (int)count;
+            auto cullEntity = [&](uint32_t i) {
+                if (pvsBits && (int)i < pvs.objectCount() && !PotentiallyVisibleSet::test(pvsBits, (int)i)) {
+                    cullStats.pvsCulled++;
+                    return;
+                }
+                if (!frustum.intersects(world.bounds[i].box)) {
+                    cullStats.frustumCulled++;
+                    return;
+                }
+                visible[i] = 1;
+            };
+            // The static BVH and the streamed tiles' BVHs reject whole blocks
+            // outside the frustum; anything else created after the static BVH
+            // was built is tested one by one.
+            int reached = 0;
+            staticBvh.queryFrustum(frustum, [&](uint32_t i) {
+                reached++;
+                cullEntity(i);
+            });
+            size_t staticCount = std::min<size_t>(staticBvh.nodeCount ? staticBounds.size() : 0, count);
+            cullStats.frustumCulled += (int)staticCount - reached;
+            int streamedReached = 0;
+            streamer.queryFrustum(frustum, [&](Entity e) {
+                streamedReached++;
+                cullEntity((uint32_t)world.bounds.indexOf(e));
+            });
+            cullStats.frustumCulled += (int)streamer.buildingCount() - streamedReached;
+            for (size_t i = staticCount; i < count; i++) {
+                if (!world.bounds[i].streamed)
+                    cullEntity((uint32_t)i);
+            }
+            // Only entities with a threshold can be too small.
+            for (size_t i = 0; i < world.screenSizes.size(); i++) {
+                size_t b = world.bounds.indexOf(world.screenSizes.entity(i));
+                if (visible[b] && screenSize.isTooSmall(world.bounds[b].box, world.screenSizes[i].minPixels, eye)) {
+                    visible[b] = 0;
+                    cullStats.smallCulled++;
+                }
+            }
+            for (size_t i = 0; i < count; i++) {
+                if (visible[i] && world.bounds[i].occluder)
+                    occlusion.addOccluder(world.bounds[i].box, (int)i);
+            }
+            occlusion.rasterize();
+            for (size_t i = 0; i < count; i++) {
+                if (!visible[i] || occlusion.isOccluder((int)i)) continue;
+                if (!occlusion.isVisible(world.bounds[i].box)) {
+                    visible[i] = 0;
+                    cullStats.occluded++;
+                }
+            }
+            cullStats.occluders = occlusion.occluderCount();
+            cullStats.occluderMs = occlusion.rasterMs();
+            cullStats.cullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cullStart).count();
 
+            frame.drawBatches.resize(world.materials.size() * meshCount);
+            frame.drawBatchIds.resize(pickBuffer ? frame.drawBatches.size() : 0);
+            for (size_t b = 0; b < frame.drawBatches.size(); b++) frame.drawBatches[b].clear();
+            for (size_t b = 0; b < frame.drawBatchIds.size(); b++) frame.drawBatchIds[b].clear();
+            // Far visible entities with a baked impostor take it instead of
+            // their mesh (marked 2 so the mesh pass skips them).
+            for (size_t i = 0; i < world.impostors.size(); i++) {
+                Entity e = world.impostors.entity(i);
+                size_t b = world.bounds.indexOf(e);
+                int archetype = world.impostors[i].archetype;
+                if (visible[b] != 1 || archetype < 0) continue;
+                glm::vec3 center(scene.get(e)->worldPosition - origin);
+                if (glm::distance(center, eyeRelative) > impostorDistance) {
+                    frame.impostors.push_back(FrameSnapshot::ImpostorDraw{ center, archetype });
+                    visible[b] = 2;
+                    cullStats.drawn++;
+                }
+            }
+            for (size_t i = 0; i < world.renderables.size(); i++) {
+                Entity e = world.renderables.entity(i);
+                if (visible[world.bounds.indexOf(e)] != 1) continue;
+                const Renderable& renderable = world.renderables[i];
+                size_t batch = renderable.material * meshCount + renderable.mesh;
+                frame.drawBatches[batch].push_back(scene.get(e)->relativeTransform(origin));
+                if (pickBuffer)
+                    frame.drawBatchIds[batch].push_back(e.value + 1);
+                cullStats.drawn++;
+            }
+        }
+
+        // Pedestrians are always impostors, culled by the crowd itself.
+        if (crowd.agentCount() > 0) {
+            Frustum frustum;
+            frustum.extract(frame.viewProjection);
+            crowd.gatherVisible(frustum, eye, pedestrianDistance, alpha, pedestrians);
+            for (const glm::vec3& p : pedestrians)
+                frame.impostors.push_back(FrameSnapshot::ImpostorDraw{ glm::vec3(glm::dvec3(p) - origin), pedestrianArchetype });
+        }
+
+        simulateMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count();
+        simulatedFrames++;
+        statsTimer += scheduler.frameTime();
+        frame.statsDue = statsTimer >= 1.0f;
+        if (frame.statsDue) {
+            statsTimer = 0.0f;
+            frame.streamingStats = streamer.stats();
+            streamer.resetCounters();
+            frame.simulateMs = simulateMs / simulatedFrames;
+            frame.carPairs = frame.buildingPairs = 0;
+            for (const CollisionPair& pair : collisionPairs)
+                (pair.isStatic ? frame.buildingPairs : frame.carPairs)++;
+            frame.collisionMs = collision.pairsMs();
+            simulateMs = 0.0;
+            simulatedFrames = 0;
+        }
+    };
+
+    // Frame N + 1 is simulated and culled while this thread submits frame N
+    // to GL, so a frame costs the slower of the two instead of their sum.
+    SnapshotMailbox<FrameSnapshot> frames;
+    std::thread simulationThread([&]() {
+        while (frames.beginWrite()) {
+            simulateFrame(frames.writeSlot());
+            frames.publish();
+        }
+    });
+
+    auto lastFrameStart = std::chrono::high_resolution_clock::now();
+    double frameMs = 0.0, submitMs = 0.0;
+    int renderedFrames = 0;
     while (!glfwWindowShouldClose(window)) {
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
         processInput(window);
+        FrameSnapshot* frame = frames.take();
+        if (!frame) break;
+        auto submitStart = std::chrono::high_resolution_clock::now();
+        frameMs += std::chrono::duration<double, std::milli>(submitStart - lastFrameStart).count();
+        lastFrameStart = submitStart;
 
-        glClearColor(0.1f, 0.1f, 0.15f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        sceneTarget.resize(fbWidth, fbHeight);
+        sceneTarget.bind();
 
+        const float background[4] = { 0.1f, 0.1f, 0.15f, 1.0f };
+        sceneTarget.clear(background, reversedZ ? 0.0f : 1.0f);
+
+        if (frame->instancesChanged)
+            hiZ->setInstances(frame->instances, frame->movingInstances);
+        else if (frame->movingChanged)
+            hiZ->updateMoving(frame->movingInstances);
         ourShader.use();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), 1280.0f / 720.0f, 0.1f, 200.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
-
-        cityRoot.update();
-        for (Node* child : cityRoot.children) {
-            Building* building = dynamic_cast<Building*>(child);
-            if (!building) continue;
-            glm::mat4 model = building->worldTransform;
-            ourShader.setMat4("model", model);
-
-            if (building->type == BuildingType::FIELD)
-                glBindTexture(GL_TEXTURE_2D, texGrass);
-            else if (building->type == BuildingType::ROAD)
-                glBindTexture(GL_TEXTURE_2D, texRoad);
-            else
-                glBindTexture(GL_TEXTURE_2D, texHigh);
+        ourShader.setMat4("projection", frame->projection);
+        ourShader.setMat4("view", frame->view);
+
+        impostors.clear();
+        for (const FrameSnapshot::ImpostorDraw& d : frame->impostors)
+            impostors.addInstance(d.center, d.archetype);
+        if (frame->gpuCulling) {
+            // Visibility never comes back to the CPU: the compute pass fills
+            // the indirect draws.
+            hiZ->cull(frame->viewProjection, frame->eye, frame->pixelScale);
+            hiZ->shader().use();
+            hiZ->shader().setMat4("projection", frame->projection);
+            hiZ->shader().setMat4("view", frame->view);
+            glActiveTexture(GL_TEXTURE0);
+            for (size_t group = 0; group < world.materials.size(); group++) {
+                glBindTexture(GL_TEXTURE_2D, world.materials[group].texture);
+                hiZ->draw((int)group);
+            }
+        }
+        else {
+            for (size_t b = 0; b < frame->drawBatches.size(); b++) {
+                if (frame->drawBatches[b].empty()) continue;
+                const Mesh& mesh = world.meshes[b % meshCount];
+                glBindTexture(GL_TEXTURE_2D, world.materials[b / meshCount].texture);
+                cubeInstances.draw(mesh.vao, mesh.vertexCount, frame->drawBatches[b],
+                    pickBuffer ? &frame->drawBatchIds[b] : NULL);
+            }
+        }
+        impostors.draw(frame->view, frame->projection, frame->eyeRelative);
+
+        // Queued now, read back once the GPU has drawn this frame.
+        if (frame->pick && pickBuffer)
+            pickReadback.request(sceneTarget, sceneTarget.width / 2, sceneTarget.height / 2, renderedFrameCount);
+        PickReadback::Result picked;
+        if (pickReadback.poll(picked)) {
+            std::lock_guard<std::mutex> lock(inputMutex);
+            input.gpuPicked = true;
+            input.gpuPickId = picked.id;
+            input.gpuPickLatency = (int)(renderedFrameCount - picked.frame);
+        }
+        renderedFrameCount++;
+
+        sceneTarget.blitToScreen();
+        if (frame->gpuCulling)
+            hiZ->buildPyramid(sceneTarget.depthTexture, sceneTarget.width, sceneTarget.height,
+                frame->projection * frame->worldView);
+        else if (hiZ)
+            hiZ->invalidatePyramid();
+        submitMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - submitStart).count();
+        renderedFrames++;
 
-            glBindVertexArray(VAO);
-            glDrawArrays(GL_TRIANGLES, 0, 36);
+        if (frame->statsDue) {
+            if (frame->gpuCulling)
+                hiZ->readStats(frame->cullStats);
+            frame->cullStats.print();
+            if (streaming)
+                frame->streamingStats.print();
+            std::cout << std::fixed << std::setprecision(2)
+                << "frame: " << frameMs / renderedFrames << " ms | simulate+cull " << frame->simulateMs
+                << " ms, submit " << submitMs / renderedFrames << " ms | collision " << frame->carPairs
+                << " car/car, " << frame->buildingPairs << " car/building pairs, " << frame->collisionMs << " ms" << std::endl;
+            frameMs = submitMs = 0.0;
+            renderedFrames = 0;
         }
 
         glfwSwapBuffers(window);
         glfwPollEvents();
     }
+    frames.close();
+    simulationThread.join();
 
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
+    impostors.destroy();
+    cubeInstances.destroy();
+    pickReadback.destroy();
+    sceneTarget.destroy();
+    if (hiZ) {
+        hiZ->destroy();
+        delete hiZ;
+    }
 
     glfwTerminate();
     return 0;
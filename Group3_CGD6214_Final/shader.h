@@ -9,13 +9,17 @@ public:
     unsigned int ID;
 
     Shader(const char* vertexPath, const char* fragmentPath);
+    // Compute-only program (needs a GL 4.3+ context).
+    explicit Shader(const char* computePath);
     void use() const;
 
     void setBool(const std::string& name, bool value) const;
     void setInt(const std::string& name, int value) const;
     void setFloat(const std::string& name, float value) const;
     void setMat4(const std::string& name, const glm::mat4& mat) const;
+    void setVec2(const std::string& name, const glm::vec2& value) const;
     void setVec3(const std::string& name, const glm::vec3& value) const;
+    void setVec4(const std::string& name, const glm::vec4& value) const;
 };
 
 #endif // SHADER_H
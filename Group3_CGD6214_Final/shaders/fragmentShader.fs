@@ -1,10 +1,14 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+// Read only when the scene target has an ID attachment.
+layout (location = 1) out uint PickId;
 
 in vec2 TexCoord;
+flat in uint EntityId;
 
 uniform sampler2D texture1;
 
 void main() {
     FragColor = texture(texture1, TexCoord);
+    PickId = EntityId;
 }
@@ -0,0 +1,31 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+// Impostors are not pickable.
+layout (location = 1) out uint PickId;
+
+in vec3 TexCoord;
+in vec3 WorldPos;
+in vec3 FrameDir;
+flat in float Radius;
+
+uniform sampler2DArray colorAtlas;
+uniform sampler2DArray depthAtlas;
+uniform mat4 view;
+uniform mat4 projection;
+uniform bool zeroToOneDepth;
+
+void main() {
+    vec4 color = texture(colorAtlas, TexCoord);
+    if (color.a < 0.5)
+        discard;
+
+    // The bake camera sat 2r from the centre with an ortho depth range of
+    // [r, 3r], so the stored depth moves the quad point onto the box surface.
+    float bakedDepth = texture(depthAtlas, TexCoord).r;
+    vec3 surface = WorldPos + FrameDir * (Radius - bakedDepth * 2.0 * Radius);
+    vec4 clip = projection * view * vec4(surface, 1.0);
+    gl_FragDepth = zeroToOneDepth ? clip.z / clip.w : clip.z / clip.w * 0.5 + 0.5;
+
+    FragColor = vec4(color.rgb, 1.0);
+    PickId = 0u;
+}
@@ -0,0 +1,57 @@
+#version 330 core
+layout (location = 0) in vec2 aCorner;
+layout (location = 1) in vec4 aCenterRadius;
+layout (location = 2) in float aLayer;
+
+out vec3 TexCoord;
+out vec3 WorldPos;
+out vec3 FrameDir;
+flat out float Radius;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 cameraPos;
+uniform int framesPerSide;
+
+// Must match octDecode in Impostor.cpp.
+vec3 octDecode(vec2 uv) {
+    vec2 p = uv * 2.0 - 1.0;
+    vec3 d = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+    if (d.y < 0.0) {
+        vec2 s = vec2(d.x >= 0.0 ? 1.0 : -1.0, d.z >= 0.0 ? 1.0 : -1.0);
+        d.xz = (1.0 - abs(d.zx)) * s;
+    }
+    return normalize(d);
+}
+
+vec2 octEncode(vec3 d) {
+    d /= abs(d.x) + abs(d.y) + abs(d.z);
+    vec2 p = d.xz;
+    if (d.y < 0.0) {
+        vec2 s = vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+        p = (1.0 - abs(p.yx)) * s;
+    }
+    return p * 0.5 + 0.5;
+}
+
+void main() {
+    vec3 center = aCenterRadius.xyz;
+    float radius = aCenterRadius.w;
+
+    // Snap the view direction to the nearest baked frame and orient the quad
+    // with that frame's basis so the baked image lines up with the box.
+    float n = float(framesPerSide);
+    vec2 frame = clamp(floor(octEncode(normalize(cameraPos - center)) * n), 0.0, n - 1.0);
+    vec3 dir = octDecode((frame + 0.5) / n);
+    vec3 up = abs(dir.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    vec3 right = normalize(cross(up, dir));
+    up = cross(dir, right);
+
+    vec3 worldPos = center + (right * aCorner.x + up * aCorner.y) * radius;
+
+    TexCoord = vec3((frame + aCorner * 0.5 + 0.5) / n, aLayer);
+    WorldPos = worldPos;
+    FrameDir = dir;
+    Radius = radius;
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}
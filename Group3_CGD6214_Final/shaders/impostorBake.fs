@@ -0,0 +1,12 @@
+#version 330 core
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out float FragDepth;
+
+in vec2 TexCoord;
+
+uniform sampler2D texture1;
+
+void main() {
+    FragColor = vec4(texture(texture1, TexCoord).rgb, 1.0);
+    FragDepth = gl_FragCoord.z;
+}
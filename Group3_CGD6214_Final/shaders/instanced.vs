@@ -0,0 +1,25 @@
+#version 430 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in uint aInstance;
+
+out vec2 TexCoord;
+flat out uint EntityId;
+
+// Affine model matrices, three rows per instance (see Affine3x4).
+layout (std430, binding = 3) readonly buffer InstanceModels { vec4 modelRows[]; };
+// Pick IDs in the same order.
+layout (std430, binding = 5) readonly buffer InstanceIds { uint entityIds[]; };
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+    vec4 p = vec4(aPos, 1.0);
+    uint base = aInstance * 3u;
+    vec3 worldPos = vec3(dot(modelRows[base], p), dot(modelRows[base + 1u], p), dot(modelRows[base + 2u], p));
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+    TexCoord = aTexCoord;
+    EntityId = entityIds[aInstance];
+}
@@ -2,14 +2,23 @@
 layout (location = 0) in vec3 aPos;    
 layout (location = 1) in vec3 aNormal; 
 layout (location = 2) in vec2 aTexCoord;
+// Per-instance affine model matrix, row-major, translation in w.
+layout (location = 3) in vec4 aModelRow0;
+layout (location = 4) in vec4 aModelRow1;
+layout (location = 5) in vec4 aModelRow2;
+// Per-instance pick ID: entity handle + 1, 0 for nothing.
+layout (location = 6) in uint aEntityId;
 
 out vec2 TexCoord;
+flat out uint EntityId;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    vec4 p = vec4(aPos, 1.0);
+    vec3 worldPos = vec3(dot(aModelRow0, p), dot(aModelRow1, p), dot(aModelRow2, p));
+    gl_Position = projection * view * vec4(worldPos, 1.0);
     TexCoord = aTexCoord;
+    EntityId = aEntityId;
 }